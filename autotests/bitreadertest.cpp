@@ -22,10 +22,14 @@ private Q_SLOTS:
     void testRead8Bit();
     void testRead16Bit();
     void testRead12Bit();
+    void testPeekConsume();
+    void testPadded();
     void benchmarkInit();
     void benchmarkInitSlice();
     void benchmarkRead();
     void benchmarkRead_data();
+    void benchmarkReadSlices();
+    void benchmarkReadSlices_data();
 };
 
 void BitReaderTest::testRead_1()
@@ -192,6 +196,48 @@ void BitReaderTest::testRead12Bit()
     QVERIFY(!r.eat(1));
 }
 
+void BitReaderTest::testPeekConsume()
+{
+    QByteArray data("\x01\xff\xaa\x81\x7e", 5);
+
+    BitReader r(data);
+
+    QCOMPARE(r.peek(1), 0x0);
+    QCOMPARE(r.peek(8), 0x01);
+    QCOMPARE(r.peek(12), 0x01f);
+    r.consume(7);
+    QCOMPARE(r.left(), 33);
+    QCOMPARE(r.peek(), 0xffd540bf);
+    QCOMPARE(r.peek(3), 0x7);
+    r.consume(30);
+    QCOMPARE(r.left(), 3);
+    QCOMPARE(r.peek(), 0xc0000000);
+    QCOMPARE(r.peek(4), 0xc);
+    r.consume(3);
+    QCOMPARE(r.left(), 0);
+    QCOMPARE(r.peek(32), 0x00000000);
+}
+
+void BitReaderTest::testPadded()
+{
+    // Padding content must not be visible
+    QByteArray data("\x01\xff\xaa\xff\xff\xff\xff\xff\xff\xff\xff", 11);
+    const auto view = QByteArrayView(data).first(3);
+
+    BitReader r(view, BitReader::Padded());
+
+    QCOMPARE(r.left(), 24);
+    QCOMPARE(r.peek(), 0x01ffaa00);
+    QVERIFY(r.eat(12));
+    QCOMPARE(r.peek(), 0xfaa00000);
+    QVERIFY(r.eat(11));
+    QCOMPARE(r.peek(), 0x00000000);
+    QVERIFY(r.eat(1));
+    QCOMPARE(r.left(), 0);
+    QCOMPARE(r.peek(), 0x00000000);
+    QVERIFY(!r.eat(1));
+}
+
 void BitReaderTest::benchmarkInit()
 {
     QByteArray data(1024, '\0');
@@ -238,6 +284,38 @@ void BitReaderTest::benchmarkRead_data()
     QTest::addRow("7") << QByteArray(1024, '\x01') << 7;
 }
 
+void BitReaderTest::benchmarkReadSlices()
+{
+    QFETCH(int, count);
+
+    // Padded 16 byte slices, resembling Huffdic dictionary entries
+    QByteArray data(1024 + BitReader::Padding, '\x01');
+    QList<QByteArrayView> slices;
+    for (qsizetype i = 0; i < 1024; i += 16) {
+        slices.append(QByteArrayView(data).sliced(i, 16));
+    }
+
+    qint64 t = 0;
+    QBENCHMARK {
+        for (auto slice : std::as_const(slices)) {
+            BitReader r(slice, BitReader::Padded());
+            while (r.left() > 0) {
+                t += r.peek();
+                r.consume(count);
+            }
+        }
+    }
+    QVERIFY(t > (1024 / count));
+}
+
+void BitReaderTest::benchmarkReadSlices_data()
+{
+    QTest::addColumn<int>("count");
+
+    QTest::addRow("4") << 4;
+    QTest::addRow("12") << 12;
+}
+
 QTEST_GUILESS_MAIN(BitReaderTest)
 
 #include "bitreadertest.moc"
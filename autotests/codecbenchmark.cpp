@@ -0,0 +1,310 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE contributors
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#include "../lib/bitreader_p.h"
+#include "../lib/decompressor.h"
+#include "../lib/trailingdata_p.h"
+#include "syntheticbook.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+
+#include <functional>
+#include <limits>
+
+#ifdef Q_OS_LINUX
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace Mobipocket;
+
+/**
+ * Codec micro benchmarks, reporting throughput and (where available) CPU
+ * cycles per byte for fixed, generated input sets.
+ *
+ * Results can be stored as a baseline, and later runs compared against it:
+ *   codecbenchmark --save-baseline before.json
+ *   codecbenchmark --baseline before.json --threshold 5
+ * The exit code is 2 if any case regressed by more than the threshold.
+ */
+namespace
+{
+class CycleCounter
+{
+public:
+    CycleCounter()
+    {
+#ifdef Q_OS_LINUX
+        perf_event_attr attr = {};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~CycleCounter()
+    {
+#ifdef Q_OS_LINUX
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
+    }
+
+    Q_DISABLE_COPY(CycleCounter);
+
+    bool isValid() const
+    {
+        return fd >= 0;
+    }
+
+    void start()
+    {
+#ifdef Q_OS_LINUX
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    qint64 stop()
+    {
+#ifdef Q_OS_LINUX
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        long long count = 0;
+        if (read(fd, &count, sizeof(count)) == sizeof(count)) {
+            return count;
+        }
+#endif
+        return -1;
+    }
+
+private:
+    int fd = -1;
+};
+
+struct Case {
+    QString name;
+    // Runs one iteration over the whole input set, returns the number of bytes processed
+    std::function<qint64()> run;
+};
+
+struct Result {
+    QString name;
+    qint64 bytes = 0;
+    qint64 nsecs = 0;
+    qint64 cycles = -1;
+    int iterations = 0;
+
+    double mbPerSecond() const
+    {
+        return nsecs ? (bytes / (1024.0 * 1024.0)) / (nsecs / 1e9) : 0.0;
+    }
+
+    double cyclesPerByte() const
+    {
+        return (cycles >= 0 && bytes) ? double(cycles) / bytes : -1.0;
+    }
+};
+
+// Prevents the compiler from discarding results
+volatile quint64 sink = 0;
+
+QList<Case> createCases()
+{
+    QList<Case> cases;
+
+    SyntheticBook::Options options;
+    options.textSize = 1024 * 1024;
+    const QByteArray text = SyntheticBook::generateText(options);
+
+    auto decompressorCase = [&cases, &text](const QString &name, SyntheticBook::Compression compression) {
+        const auto records = SyntheticBook::textRecords(text, compression);
+        std::shared_ptr<Decompressor> decompressor = Decompressor::create(quint8(compression), SyntheticBook::huffdicTables());
+        cases.append({name, [records, decompressor]() {
+                          qint64 bytes = 0;
+                          for (const auto &record : records) {
+                              bytes += decompressor->decompress(record).size();
+                          }
+                          return bytes;
+                      }});
+    };
+    decompressorCase(QStringLiteral("noop"), SyntheticBook::Compression::None);
+    decompressorCase(QStringLiteral("rle"), SyntheticBook::Compression::PalmDoc);
+    decompressorCase(QStringLiteral("huffdic"), SyntheticBook::Compression::Huffdic);
+
+    const QByteArray bits = text.left(64 * 1024);
+    for (int n : {1, 7, 8, 12, 24}) {
+        cases.append({QStringLiteral("bitreader-%1").arg(n), [bits, n]() {
+                          quint64 t = 0;
+                          BitReader r(bits);
+                          while (r.left() > 0) {
+                              t += r.read();
+                              r.eat(n);
+                          }
+                          sink = sink + t;
+                          return qint64(bits.size());
+                      }});
+    }
+
+    // Text records with a multibyte and one additional trailing entry
+    QList<QByteArray> trailing = SyntheticBook::textRecords(text, SyntheticBook::Compression::PalmDoc);
+    for (auto &record : trailing) {
+        record.append(QByteArray("\x00\x00\x00\x83", 4));
+    }
+    cases.append({QStringLiteral("trailingdata"), [trailing]() {
+                      qint64 bytes = 0;
+                      quint64 t = 0;
+                      for (const auto &record : trailing) {
+                          t += preTrailingDataLength(record, 0x3);
+                          bytes += record.size();
+                      }
+                      sink = sink + t;
+                      return bytes;
+                  }});
+
+    return cases;
+}
+
+Result measure(const Case &c, qint64 minNsecs, CycleCounter &cycles)
+{
+    Result result;
+    result.name = c.name;
+    result.nsecs = std::numeric_limits<qint64>::max();
+
+    // Warm up caches and branch predictors
+    c.run();
+
+    // Report the fastest iteration, which is the least disturbed one
+    QElapsedTimer total;
+    total.start();
+    do {
+        QElapsedTimer timer;
+        if (cycles.isValid()) {
+            cycles.start();
+        }
+        timer.start();
+        const qint64 bytes = c.run();
+        const qint64 nsecs = timer.nsecsElapsed();
+        const qint64 cycleCount = cycles.isValid() ? cycles.stop() : -1;
+
+        result.iterations++;
+        if (nsecs < result.nsecs) {
+            result.bytes = bytes;
+            result.nsecs = nsecs;
+            result.cycles = cycleCount;
+        }
+    } while (total.nsecsElapsed() < minNsecs);
+
+    return result;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption({QStringLiteral("quick"), QStringLiteral("Run each case only once, to verify it works")});
+    parser.addOption({QStringLiteral("min-time"), QStringLiteral("Minimum run time per case, in milliseconds"), QStringLiteral("ms"), QStringLiteral("500")});
+    parser.addOption({QStringLiteral("filter"), QStringLiteral("Only run cases whose name contains <text>"), QStringLiteral("text")});
+    parser.addOption({QStringLiteral("json"), QStringLiteral("Print results as JSON")});
+    parser.addOption({QStringLiteral("save-baseline"), QStringLiteral("Store results in <file>"), QStringLiteral("file")});
+    parser.addOption({QStringLiteral("baseline"), QStringLiteral("Compare against results stored in <file>"), QStringLiteral("file")});
+    parser.addOption({QStringLiteral("threshold"),
+                      QStringLiteral("Throughput loss, in percent, above which a case is flagged as regression"),
+                      QStringLiteral("percent"),
+                      QStringLiteral("10")});
+    parser.process(app);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    const qint64 minNsecs = parser.isSet(QStringLiteral("quick")) ? 0 : parser.value(QStringLiteral("min-time")).toLongLong() * 1000 * 1000;
+    const double threshold = parser.value(QStringLiteral("threshold")).toDouble() / 100.0;
+
+    QJsonObject baseline;
+    if (parser.isSet(QStringLiteral("baseline"))) {
+        QFile file(parser.value(QStringLiteral("baseline")));
+        if (!file.open(QIODevice::ReadOnly)) {
+            err << "Can not read baseline " << file.fileName() << Qt::endl;
+            return 1;
+        }
+        baseline = QJsonDocument::fromJson(file.readAll()).object().value(QStringLiteral("cases")).toObject();
+    }
+
+    CycleCounter cycles;
+    if (!cycles.isValid()) {
+        err << "CPU cycle counter not available, reporting throughput only" << Qt::endl;
+    }
+
+    QJsonObject results;
+    int regressions = 0;
+    const QString filter = parser.value(QStringLiteral("filter"));
+    const auto cases = createCases();
+    for (const auto &c : cases) {
+        if (!c.name.contains(filter)) {
+            continue;
+        }
+        const Result r = measure(c, minNsecs, cycles);
+
+        QString verdict;
+        if (const auto base = baseline.value(r.name).toObject(); !base.isEmpty()) {
+            const double baseMbps = base.value(QStringLiteral("mbps")).toDouble();
+            const double change = baseMbps > 0 ? r.mbPerSecond() / baseMbps - 1.0 : 0.0;
+            verdict = QStringLiteral("%1%2%").arg(change >= 0 ? QStringLiteral("+") : QString()).arg(change * 100, 0, 'f', 1);
+            if (change < -threshold) {
+                verdict += QStringLiteral(" REGRESSION");
+                regressions++;
+            }
+        }
+
+        results[r.name] = QJsonObject{
+            {QStringLiteral("bytes"), r.bytes},
+            {QStringLiteral("nsecs"), r.nsecs},
+            {QStringLiteral("iterations"), r.iterations},
+            {QStringLiteral("mbps"), r.mbPerSecond()},
+            {QStringLiteral("cyclesPerByte"), r.cyclesPerByte()},
+        };
+
+        if (!parser.isSet(QStringLiteral("json"))) {
+            out << qSetFieldWidth(16) << Qt::left << r.name << qSetFieldWidth(10) << Qt::right //
+                << QString::number(r.mbPerSecond(), 'f', 1) << qSetFieldWidth(0) << " MB/s" //
+                << qSetFieldWidth(10) << (r.cycles >= 0 ? QString::number(r.cyclesPerByte(), 'f', 2) : QStringLiteral("n/a")) //
+                << qSetFieldWidth(0) << " cycles/byte  " << verdict << Qt::endl;
+        }
+    }
+
+    const QJsonDocument doc(QJsonObject{{QStringLiteral("cases"), results}});
+    if (parser.isSet(QStringLiteral("json"))) {
+        out << doc.toJson();
+    }
+
+    if (parser.isSet(QStringLiteral("save-baseline"))) {
+        QFile file(parser.value(QStringLiteral("save-baseline")));
+        if (!file.open(QIODevice::WriteOnly) || file.write(doc.toJson()) < 0) {
+            err << "Can not write baseline " << file.fileName() << Qt::endl;
+            return 1;
+        }
+    }
+
+    if (regressions) {
+        err << regressions << " case(s) regressed by more than " << threshold * 100 << "%" << Qt::endl;
+        return 2;
+    }
+    return 0;
+}
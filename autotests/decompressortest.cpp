@@ -24,6 +24,7 @@ private Q_SLOTS:
     void testHuffInit();
     void testHuffDecompress();
     void testFuzzHuff();
+    void testLimits();
     void benchmarkHuffDecompress();
 };
 
@@ -106,6 +107,11 @@ void DecompressorTest::testRLE()
 
     auto r = decompressor->decompress(data);
     QCOMPARE(r, expected);
+
+    // Appending output, back references must not reach into the existing content
+    QByteArray out("prefix");
+    decompressor->decompress(data, out);
+    QCOMPARE(out, QByteArray("prefix") + expected);
 }
 
 void DecompressorTest::testRLE_data()
@@ -248,6 +254,40 @@ void DecompressorTest::testFuzzHuff()
     }
 }
 
+void DecompressorTest::testLimits()
+{
+    QByteArray d(256, '\0');
+    for (int i = 0; i < d.size(); i++) {
+        d[i] = i;
+    }
+
+    {
+        auto decompressor = Decompressor::create('H', createHuffIdentityDict(), {1024, 32, 256});
+        QCOMPARE(decompressor->decompress(d), d);
+        QVERIFY(decompressor->isValid());
+    }
+    {
+        auto decompressor = Decompressor::create('H', createHuffIdentityDict(), {1024, 32, 255});
+        decompressor->decompress(d);
+        QVERIFY(!decompressor->isValid());
+    }
+    {
+        auto decompressor = Decompressor::create('H', createHuffIdentityDict(), {255, 32, 1024});
+        decompressor->decompress(d);
+        QVERIFY(!decompressor->isValid());
+    }
+    {
+        auto decompressor = Decompressor::create(2, {}, {3, 32, 1024});
+        decompressor->decompress(QByteArray("abcd"));
+        QVERIFY(!decompressor->isValid());
+    }
+    {
+        auto decompressor = Decompressor::create(1, {}, {3, 32, 1024});
+        decompressor->decompress(QByteArray("abcd"));
+        QVERIFY(!decompressor->isValid());
+    }
+}
+
 QTEST_GUILESS_MAIN(DecompressorTest)
 
 #include "decompressortest.moc"
@@ -0,0 +1,201 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE contributors
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#include "mobipocket.h"
+#include "syntheticbook.h"
+
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTest>
+
+using namespace Mobipocket;
+
+/**
+ * Benchmarks of the public Document API on generated books.
+ *
+ * By default only small books are generated, set MOBIPOCKET_BENCHMARK_LARGE=1
+ * in the environment to include books of up to 200 MB text.
+ */
+class DocumentBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void benchmarkOpen();
+    void benchmarkOpen_data();
+    void benchmarkMetadata();
+    void benchmarkMetadata_data();
+    void benchmarkText();
+    void benchmarkText_data();
+    void benchmarkImages();
+    void benchmarkImages_data();
+    void benchmarkThumbnail();
+    void benchmarkThumbnail_data();
+
+private:
+    void addBooks();
+
+    struct GeneratedBook {
+        QString path;
+        SyntheticBook::Options options;
+        qsizetype textSize = 0;
+    };
+
+    QTemporaryDir dir;
+    QList<GeneratedBook> books;
+};
+
+void DocumentBenchmark::initTestCase()
+{
+    QVERIFY(dir.isValid());
+
+    QList<qint64> sizes = {100 * 1024, 1024 * 1024};
+    if (qEnvironmentVariableIntValue("MOBIPOCKET_BENCHMARK_LARGE")) {
+        sizes += {20 * 1024 * 1024, 200 * 1024 * 1024};
+    }
+
+    QList<SyntheticBook::Options> variants;
+    for (auto compression : {SyntheticBook::Compression::None, SyntheticBook::Compression::PalmDoc, SyntheticBook::Compression::Huffdic}) {
+        for (auto size : std::as_const(sizes)) {
+            variants.append({compression, size, 10, true});
+        }
+    }
+    // Variations of image count and metadata, on a medium sized book
+    variants.append({SyntheticBook::Compression::PalmDoc, 1024 * 1024, 0, true});
+    variants.append({SyntheticBook::Compression::PalmDoc, 1024 * 1024, 100, true});
+    variants.append({SyntheticBook::Compression::PalmDoc, 1024 * 1024, 10, false});
+    variants.append({SyntheticBook::Compression::Huffdic, 1024 * 1024, 10, false});
+
+    for (const auto &options : std::as_const(variants)) {
+        const auto book = SyntheticBook::generate(options);
+        const QString path = dir.filePath(SyntheticBook::describe(options) + QLatin1String(".mobi"));
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QCOMPARE(file.write(book.data), book.data.size());
+        books.append({path, options, QString::fromUtf8(book.text).size()});
+    }
+}
+
+void DocumentBenchmark::addBooks()
+{
+    QTest::addColumn<QString>("path");
+    QTest::addColumn<int>("imageCount");
+    QTest::addColumn<qsizetype>("textSize");
+    QTest::addColumn<bool>("exth");
+
+    for (const auto &book : std::as_const(books)) {
+        QTest::addRow("%s", qPrintable(SyntheticBook::describe(book.options))) << book.path << book.options.imageCount << book.textSize << book.options.exth;
+    }
+}
+
+void DocumentBenchmark::benchmarkOpen()
+{
+    QFETCH(QString, path);
+
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+
+    QBENCHMARK {
+        Document doc(&file);
+        QVERIFY(doc.isValid());
+    }
+}
+
+void DocumentBenchmark::benchmarkOpen_data()
+{
+    addBooks();
+}
+
+void DocumentBenchmark::benchmarkMetadata()
+{
+    QFETCH(QString, path);
+    QFETCH(bool, exth);
+
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    Document doc(&file);
+
+    QBENCHMARK {
+        const auto metadata = doc.metadata();
+        QCOMPARE(metadata.value(Document::Title), QStringLiteral("The Big Brown Bear"));
+        QCOMPARE(metadata.contains(Document::Author), exth);
+    }
+}
+
+void DocumentBenchmark::benchmarkMetadata_data()
+{
+    addBooks();
+}
+
+void DocumentBenchmark::benchmarkText()
+{
+    QFETCH(QString, path);
+    QFETCH(qsizetype, textSize);
+
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    Document doc(&file);
+
+    QBENCHMARK {
+        const auto text = doc.text();
+        QCOMPARE(text.size(), textSize);
+    }
+}
+
+void DocumentBenchmark::benchmarkText_data()
+{
+    addBooks();
+}
+
+void DocumentBenchmark::benchmarkImages()
+{
+    QFETCH(QString, path);
+    QFETCH(int, imageCount);
+
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    Document doc(&file);
+
+    QBENCHMARK {
+        int decoded = 0;
+        for (int i = 0; i < imageCount; i++) {
+            decoded += doc.getImage(i).isNull() ? 0 : 1;
+        }
+        QCOMPARE(decoded, imageCount);
+    }
+}
+
+void DocumentBenchmark::benchmarkImages_data()
+{
+    addBooks();
+}
+
+void DocumentBenchmark::benchmarkThumbnail()
+{
+    QFETCH(QString, path);
+    QFETCH(int, imageCount);
+    QFETCH(bool, exth);
+
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+
+    // Includes opening the document, as the thumbnail is typically
+    // requested once per document
+    QBENCHMARK {
+        Document doc(&file);
+        const auto thumbnail = doc.thumbnail();
+        QCOMPARE(thumbnail.isNull(), imageCount == 0 || !exth);
+    }
+}
+
+void DocumentBenchmark::benchmarkThumbnail_data()
+{
+    addBooks();
+}
+
+QTEST_GUILESS_MAIN(DocumentBenchmark)
+
+#include "documentbenchmark.moc"
@@ -0,0 +1,146 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE contributors
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#include "../lib/htmlstripper_p.h"
+
+#include <QTest>
+
+using namespace Mobipocket;
+
+class HtmlStripperTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testStrip();
+    void testStrip_data();
+    void testSplit();
+    void testSplit_data();
+    void testOffsets();
+    void testOffsets_data();
+    void benchmarkStrip();
+};
+
+namespace
+{
+QString strip(QStringView html)
+{
+    QString out;
+    HtmlStripper stripper;
+    stripper.feed(html, out);
+    stripper.finish(out);
+    return out;
+}
+}
+
+void HtmlStripperTest::testStrip()
+{
+    QFETCH(QString, html);
+    QFETCH(QString, expected);
+
+    QCOMPARE(strip(html), expected);
+}
+
+void HtmlStripperTest::testStrip_data()
+{
+    QTest::addColumn<QString>("html");
+    QTest::addColumn<QString>("expected");
+
+    QTest::addRow("empty") << QString() << QString();
+    QTest::addRow("plain") << QStringLiteral("Just text") << QStringLiteral("Just text");
+    QTest::addRow("inline") << QStringLiteral("<b>bold</b> and <i>italic</i>") << QStringLiteral("bold and italic");
+    QTest::addRow("whitespace") << QStringLiteral("  a \n\t b  ") << QStringLiteral("a b");
+    QTest::addRow("paragraphs") << QStringLiteral("<p>One</p>  <p>Two</p><br/>Three<mbp:pagebreak/><div>Four</div>")
+                                << QStringLiteral("One\nTwo\nThree\nFour");
+    QTest::addRow("head") << QStringLiteral("<html><head><title>T</title><dc:title>Title</dc:title></head><body>Body</body></html>")
+                          << QStringLiteral("Body");
+    QTest::addRow("style") << QStringLiteral("a<style type=\"text/css\">p { x: y }</style>b") << QStringLiteral("ab");
+    QTest::addRow("attributes") << QStringLiteral("<a filepos=0000123 title=\"a > b\">link</a>") << QStringLiteral("link");
+    QTest::addRow("comment") << QStringLiteral("a<!-- <p> -- > -->b") << QStringLiteral("ab");
+    QTest::addRow("entities") << QStringLiteral("&lt;&amp;&gt; &quot;x&quot; &#65;&#x42;&#x1F600;")
+                              << QStringLiteral("<&> \"x\" AB") + QString::fromUcs4(U"\U0001F600", 1);
+    QTest::addRow("bare less than") << QStringLiteral("a < b, 1<2 <<p>x</p> a <") << QStringLiteral("a < b, 1<2 <\nx\na <");
+    QTest::addRow("nbsp") << QStringLiteral("a&nbsp;b") << QStringLiteral("a b");
+    QTest::addRow("unknown entity") << QStringLiteral("&bogus; & x &amp") << QStringLiteral("&bogus; & x &amp");
+    QTest::addRow("sample") << QStringLiteral("<html><head></head><body>" //
+                                              "<p height=\"1em\" width=\"0pt\">This is a sample PDF file for KFileMetaData. </p>" //
+                                              "<mbp:pagebreak/><a ></a> <a ></a> <a ></a></body></html>")
+                            << QStringLiteral("This is a sample PDF file for KFileMetaData.");
+}
+
+void HtmlStripperTest::testSplit()
+{
+    QFETCH(QString, html);
+
+    // Input split at any position, e.g. at record boundaries, gives the same result
+    const QString expected = strip(html);
+    for (qsizetype i = 0; i <= html.size(); i++) {
+        QString out;
+        HtmlStripper stripper;
+        stripper.feed(QStringView(html).first(i), out);
+        stripper.feed(QStringView(html).sliced(i), out);
+        stripper.finish(out);
+        QCOMPARE(out, expected);
+    }
+}
+
+void HtmlStripperTest::testSplit_data()
+{
+    QTest::addColumn<QString>("html");
+
+    QTest::addRow("markup") << QStringLiteral("<p class='x'>One &amp; two</p><!-- c --><br />Three &#x42;");
+    QTest::addRow("head") << QStringLiteral("<head><style>x</style></head> a  b ");
+    QTest::addRow("bare less than") << QStringLiteral("1 < 2 <b>3</b> <");
+}
+
+void HtmlStripperTest::testOffsets()
+{
+    QFETCH(QString, html);
+    QFETCH(HtmlStripper::SourceEncoding, encoding);
+    QFETCH(QList<qint64>, expected);
+
+    // Also when split, the output is checked by testSplit()
+    for (qsizetype i = 0; i <= html.size(); i++) {
+        QString out;
+        QList<qint64> offsets;
+        HtmlStripper stripper;
+        stripper.trackOffsets(&offsets, encoding);
+        stripper.feed(QStringView(html).first(i), out);
+        stripper.feed(QStringView(html).sliced(i), out);
+        stripper.finish(out);
+        QCOMPARE(offsets, expected);
+    }
+}
+
+void HtmlStripperTest::testOffsets_data()
+{
+    QTest::addColumn<QString>("html");
+    QTest::addColumn<HtmlStripper::SourceEncoding>("encoding");
+    QTest::addColumn<QList<qint64>>("expected");
+
+    // Separators are at the following character
+    QTest::addRow("markup") << QStringLiteral("<b>ab</b> c") << HtmlStripper::SingleByte << QList<qint64>{3, 4, 10, 10};
+    QTest::addRow("single byte") << QStringLiteral("\u00e9<i>\u00fc</i> x") << HtmlStripper::SingleByte << QList<qint64>{0, 4, 10, 10};
+    QTest::addRow("utf8") << QStringLiteral("\u00e9<i>\u00fc</i> x") << HtmlStripper::Utf8 << QList<qint64>{0, 5, 12, 12};
+    QTest::addRow("utf8 surrogates") << QString::fromUcs4(U"\U0001F600a", 2) << HtmlStripper::Utf8 << QList<qint64>{0, 2, 4};
+    QTest::addRow("entities") << QStringLiteral("a&amp;\u20ac&#x1F600;") << HtmlStripper::Utf8 << QList<qint64>{0, 1, 6, 9, 9};
+    QTest::addRow("unknown entity") << QStringLiteral("&x y") << HtmlStripper::SingleByte << QList<qint64>{0, 1, 3, 3};
+    QTest::addRow("bare less than") << QStringLiteral("1 <2") << HtmlStripper::SingleByte << QList<qint64>{0, 2, 2, 3};
+}
+
+void HtmlStripperTest::benchmarkStrip()
+{
+    QString html;
+    for (int i = 0; i < 1000; i++) {
+        html += QStringLiteral("<p width=\"0pt\" height=\"1em\">Some <b>text</b> in a paragraph, with &quot;entities&quot;.</p>\n");
+    }
+
+    QBENCHMARK {
+        strip(html);
+    }
+}
+
+QTEST_GUILESS_MAIN(HtmlStripperTest)
+
+#include "htmlstrippertest.moc"
@@ -3,12 +3,24 @@
     SPDX-License-Identifier: LGPL-2.1-or-later
 */
 
+#include "async.h"
+#include "documentpool.h"
 #include "mobipocket.h"
+#include "searchindex.h"
+#include "syntheticbook.h"
 #include "testsconfig.h"
+#include "textcache.h"
 
 #include <QTest>
 
 #include <QBuffer>
+#include <QSemaphore>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QThreadPool>
+#include <QtEndian>
+
+#include <algorithm>
 
 using namespace Mobipocket;
 
@@ -17,6 +29,73 @@ QString testFilePath(const QString& fileName)
 {
     return QLatin1String(TESTS_FILES_PATH) + QLatin1Char('/') + fileName;
 }
+
+qsizetype recordOffset(const QByteArray &pdb, int i)
+{
+    return qFromBigEndian<quint32>(pdb.constData() + 0x4e + 8 * i);
+}
+
+// Delivers the data in small chunks, like a pipe
+class SequentialDevice : public QIODevice
+{
+public:
+    explicit SequentialDevice(const QByteArray &data)
+        : data(data)
+    {
+        open(QIODevice::ReadOnly);
+    }
+
+    bool isSequential() const override
+    {
+        return true;
+    }
+
+    qint64 bytesAvailable() const override
+    {
+        return data.size() - offset + QIODevice::bytesAvailable();
+    }
+
+protected:
+    qint64 readData(char *out, qint64 maxSize) override
+    {
+        const qint64 n = std::min<qint64>({maxSize, data.size() - offset, 1000});
+        memcpy(out, data.constData() + offset, n);
+        offset += n;
+        return n;
+    }
+
+    qint64 writeData(const char *, qint64) override
+    {
+        return -1;
+    }
+
+private:
+    const QByteArray data;
+    qint64 offset = 0;
+};
+
+class CountingReader : public RandomAccessReader
+{
+public:
+    explicit CountingReader(const QByteArray &data)
+        : data(data)
+    {
+    }
+
+    qint64 size() const override
+    {
+        return data.size();
+    }
+
+    QByteArray readAt(qint64 offset, qint64 length) const override
+    {
+        reads++;
+        return data.mid(offset, length);
+    }
+
+    const QByteArray data;
+    mutable std::atomic<int> reads = 0;
+};
 }
 
 class MobipocketTest : public QObject
@@ -29,6 +108,39 @@ private Q_SLOTS:
     void testThumbnail();
     void testTruncation();
     void testInvalidExthRecordLength();
+    void testInstrumentation();
+    void testTraceHandlerSwap();
+    void testExtractionControl();
+    void testAsync();
+    void testAsyncCancel();
+    void testAsyncImages();
+    void testSearchIndex();
+    void testTableOfContents();
+    void testTableOfContents_data();
+    void testShortTextRecord();
+    void testSequential();
+    void testSequentialParts();
+    void testSequentialParts_data();
+    void testValidate();
+    void testValidate_data();
+    void testValidateCorrupt();
+    void testStructure();
+    void testStructureDeferredDictionaries();
+    void testMemoryUsage();
+    void testLimits();
+    void testCombination();
+    void testCombination_data();
+    void testKf8();
+    void testKf8_data();
+    void testKf8ImageCount();
+    void testResourceData();
+    void testTextCache();
+    void testMemorySources();
+    void testPipeline();
+    void testPipeline_data();
+    void testTextStatistics();
+    void testTextStatistics_data();
+    void testDocumentPool();
 };
 
 void MobipocketTest::testMetadata()
@@ -62,6 +174,14 @@ void MobipocketTest::testText()
         "<p height=\"1em\" width=\"0pt\">This is a sample PDF file for KFileMetaData. </p>" //
         "<mbp:pagebreak/><a ></a> <a ></a> <a ></a></body></html>");
     QCOMPARE(text, expected);
+
+    QCOMPARE(doc.plainText(), QStringLiteral("This is a sample PDF file for KFileMetaData."));
+
+    QString streamed;
+    QVERIFY(doc.streamText([&streamed](QStringView chunk) {
+        streamed += chunk;
+    }));
+    QCOMPARE(streamed, expected);
 }
 
 void MobipocketTest::testThumbnail()
@@ -83,6 +203,9 @@ void MobipocketTest::testThumbnail()
     const auto cover = doc.getImage(0);
     QCOMPARE(cover.width(), 566);
     QCOMPARE(cover.height(), 734);
+    QVERIFY(doc.imageData(0).startsWith("\xff\xd8\xff"));
+    QCOMPARE(QImage::fromData(doc.imageData(0)), cover);
+    QVERIFY(doc.imageData(-1).isNull());
 
     // Should not crash
     const auto invalid1 = doc.getImage(doc.imageCount() + 1);
@@ -123,6 +246,1207 @@ void MobipocketTest::testInvalidExthRecordLength()
     const auto thumb = doc.thumbnail();
 }
 
+void MobipocketTest::testInstrumentation()
+{
+    QFile file(testFilePath(QStringLiteral("test.mobi")));
+    QVERIFY(file.open(QFile::ReadOnly));
+
+    {
+        // Disabled by default, nothing is accounted
+        Mobipocket::Document doc(&file);
+        QVERIFY(doc.isValid());
+        doc.text();
+        QCOMPARE(doc.counters().recordsRead, 0);
+    }
+
+    struct Spans {
+        int begin = 0;
+        int end = 0;
+    } spans;
+    Instrumentation::setTraceHandler(
+        [](Instrumentation::Phase, bool begin, void *userData) {
+            auto spans = static_cast<Spans *>(userData);
+            (begin ? spans->begin : spans->end)++;
+        },
+        &spans);
+    Instrumentation::resetGlobalCounters();
+    Instrumentation::setEnabled(true);
+
+    Mobipocket::Document doc(&file);
+    QVERIFY(doc.isValid());
+    const auto text = doc.text();
+    const auto cover = doc.getImage(0);
+
+    Instrumentation::setEnabled(false);
+    Instrumentation::setTraceHandler(nullptr);
+
+    const auto counters = doc.counters();
+    QVERIFY(counters.recordsRead > 2);
+    QVERIFY(counters.bytesRead > 0);
+    QCOMPARE(counters.recordsDecompressed, 1);
+    QCOMPARE(counters.bytesDecompressed[Instrumentation::PalmDocCompression], quint64(text.size()));
+    // The single text record, not the file
+    QVERIFY(counters.bytesCompressed > 0);
+    QVERIFY(counters.bytesCompressed < quint64(file.size()) / 2);
+    QCOMPARE(counters.bytesTranscoded, quint64(text.size()));
+    QVERIFY(counters.imageProbes >= 1);
+    QVERIFY(counters.phaseNsecs[Instrumentation::OpenPhase] > 0);
+
+    QCOMPARE(Instrumentation::globalCounters().recordsRead, counters.recordsRead);
+
+    QVERIFY(spans.begin > 0);
+    QCOMPARE(spans.begin, spans.end);
+}
+
+void MobipocketTest::testTraceHandlerSwap()
+{
+    const auto book = SyntheticBook::generate({});
+    Mobipocket::Document doc(book.data);
+    QVERIFY(doc.isValid());
+
+    Instrumentation::setEnabled(true);
+    std::atomic_bool stop = false;
+    std::unique_ptr<QThread> worker(QThread::create([&]() {
+        while (!stop) {
+            doc.textStatistics();
+        }
+    }));
+    worker->start();
+
+    const auto handler = [](Instrumentation::Phase, bool, void *userData) {
+        ++*static_cast<std::atomic<int> *>(userData);
+    };
+    std::vector<std::unique_ptr<std::atomic<int>>> calls;
+    for (int i = 0; i < 20; i++) {
+        calls.push_back(std::make_unique<std::atomic<int>>(0));
+        Instrumentation::setTraceHandler(handler, calls.back().get());
+        QTRY_VERIFY(*calls.back() > 0);
+    }
+    Instrumentation::setTraceHandler(nullptr);
+
+    // Replaced handlers are not called once setTraceHandler() returned
+    QList<int> counts;
+    for (const auto &count : calls) {
+        counts.append(*count);
+    }
+    QTest::qWait(50);
+    stop = true;
+    worker->wait();
+    Instrumentation::setEnabled(false);
+    for (qsizetype i = 0; i < counts.size(); i++) {
+        QCOMPARE(*calls[i], counts[i]);
+    }
+}
+
+void MobipocketTest::testExtractionControl()
+{
+    QFile file(testFilePath(QStringLiteral("test.mobi")));
+    QVERIFY(file.open(QFile::ReadOnly));
+    Mobipocket::Document doc(&file);
+    QVERIFY(doc.isValid());
+
+    QList<std::pair<qint64, qint64>> steps;
+    ExtractionControl control;
+    control.progress = [&steps](qint64 done, qint64 total) {
+        steps.append({done, total});
+        return true;
+    };
+    QCOMPARE(doc.text(control), doc.text());
+    QCOMPARE(steps, (QList<std::pair<qint64, qint64>>{{1, 1}}));
+    QCOMPARE(doc.getImage(0, control), doc.getImage(0));
+    QCOMPARE(doc.thumbnail(control), doc.thumbnail());
+
+    // Abandoned from the progress callback
+    control.progress = [](qint64, qint64) {
+        return false;
+    };
+    QVERIFY(doc.text(control).isNull());
+    QVERIFY(doc.getImage(0, control).isNull());
+
+    std::atomic_bool cancel = true;
+    ExtractionControl cancelled;
+    cancelled.cancel = &cancel;
+    QVERIFY(doc.text(cancelled).isNull());
+    QVERIFY(doc.getImage(0, cancelled).isNull());
+    QVERIFY(doc.thumbnail(cancelled).isNull());
+    cancel = false;
+    QVERIFY(!doc.text(cancelled).isNull());
+
+    ExtractionControl expired;
+    expired.deadline = QDeadlineTimer(0);
+    QVERIFY(doc.text(expired).isNull());
+    QVERIFY(doc.getImage(1, expired).isNull());
+
+    // Document remains usable
+    QVERIFY(doc.isValid());
+    QVERIFY(!doc.text().isEmpty());
+}
+
+void MobipocketTest::testAsync()
+{
+    QThreadPool pool;
+
+    auto missing = Async::open(testFilePath(QStringLiteral("missing.mobi")), &pool);
+    QVERIFY(!missing.result());
+
+    auto opened = Async::open(testFilePath(QStringLiteral("test.mobi")), &pool);
+    const auto doc = opened.result();
+    QVERIFY(doc);
+    QVERIFY(doc->isValid());
+
+    // Concurrent calls on one document
+    auto text = Async::text(doc, -1, &pool);
+    auto cover = Async::image(doc, 0, &pool);
+    auto thumbnail = Async::thumbnail(doc, &pool);
+    QCOMPARE(text.result(), doc->text());
+    QCOMPARE(cover.result(), doc->getImage(0));
+    QCOMPARE(thumbnail.result(), doc->thumbnail());
+
+    // Chained
+    auto size = Async::open(testFilePath(QStringLiteral("test.mobi")), &pool)
+                    .then([&pool](std::shared_ptr<Document> doc) {
+                        return Async::thumbnail(doc, &pool);
+                    })
+                    .unwrap()
+                    .then([](const QImage &image) {
+                        return image.size();
+                    });
+    QCOMPARE(size.result(), QSize(179, 233));
+}
+
+void MobipocketTest::testAsyncCancel()
+{
+    QFile file(testFilePath(QStringLiteral("test.mobi")));
+    QVERIFY(file.open(QFile::ReadOnly));
+    auto doc = std::make_shared<Document>(&file);
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(1);
+    QSemaphore blocked;
+    pool.start([&blocked]() {
+        blocked.acquire();
+    });
+
+    auto text = Async::text(doc, -1, &pool);
+    text.cancel();
+    blocked.release();
+    text.waitForFinished();
+
+    QVERIFY(text.isCanceled());
+    QCOMPARE(text.resultCount(), 0);
+}
+
+void MobipocketTest::testAsyncImages()
+{
+    SyntheticBook::Options options;
+    options.imageCount = 6;
+    const auto book = SyntheticBook::generate(options);
+    auto doc = std::make_shared<Document>(book.data);
+    QVERIFY(doc->isValid());
+
+    QThreadPool pool;
+    auto images = Async::images(doc, 1, 4, QSize(), &pool);
+    images.waitForFinished();
+    QCOMPARE(images.resultCount(), 4);
+    for (int i = 0; i < 4; i++) {
+        QCOMPARE(images.resultAt(i), doc->getImage(1 + i));
+    }
+    QCOMPARE(images.progressValue(), 4);
+
+    // Scaled down to fit, smaller ones are kept
+    auto scaled = Async::images(doc, 0, 6, QSize(200, 200), &pool);
+    QCOMPARE(scaled.results().size(), 6);
+    QCOMPARE(scaled.resultAt(0).size(), QSize(150, 200));
+    QCOMPARE(scaled.resultAt(1).size(), QSize(200, 150));
+    QCOMPARE(scaled.resultAt(5).size(), QSize(120, 160));
+
+    // Trailing FLIS and FCIS records are not images
+    const auto records = doc->imageData(4, 100);
+    QCOMPARE(records.size(), 4);
+    QCOMPARE(records[1], doc->imageData(5));
+    auto trailing = Async::images(doc, 6, 100, QSize(), &pool);
+    QCOMPARE(trailing.results().size(), 2);
+    QVERIFY(trailing.resultAt(0).isNull());
+
+    QVERIFY(doc->imageData(100, 1).isEmpty());
+    auto outOfRange = Async::images(doc, 100, 1, QSize(), &pool);
+    outOfRange.waitForFinished();
+    QCOMPARE(outOfRange.resultCount(), 0);
+}
+
+void MobipocketTest::testSearchIndex()
+{
+    QFile file(testFilePath(QStringLiteral("test.mobi")));
+    QVERIFY(file.open(QFile::ReadOnly));
+    Mobipocket::Document doc(&file);
+
+    const QString text = doc.plainText();
+    QStringList chunks;
+    QVERIFY(doc.streamPlainText([&chunks](QStringView chunk) {
+        chunks.append(chunk.toString());
+    }));
+    QCOMPARE(chunks.join(QString()), text);
+
+    // Positions are in the uncompressed text, the book is single byte encoded
+    const QString html = doc.text();
+    auto verify = [&text, &html](const SearchIndex &index) {
+        QVERIFY(index.isValid());
+        QCOMPARE(index.textLength(), qint64(text.size()));
+        QCOMPARE(index.termCount(), 8);
+        QCOMPARE(index.find(QStringLiteral("sample")), QList<qint64>{html.indexOf(QLatin1String("sample"))});
+        QCOMPARE(index.find(QStringLiteral("KFILEMETADATA")), QList<qint64>{html.indexOf(QLatin1String("KFileMetaData"))});
+        QCOMPARE(index.find(QStringLiteral("This")), QList<qint64>{html.indexOf(QLatin1String("This"))});
+        QVERIFY(index.find(QStringLiteral("samp")).isEmpty());
+        QVERIFY(index.find(QStringLiteral("zzz")).isEmpty());
+        QVERIFY(index.find(QString()).isEmpty());
+    };
+
+    const auto built = SearchIndex::build(doc);
+    verify(built);
+
+    QTemporaryDir dir;
+    const QString path = dir.filePath(QStringLiteral("test.idx"));
+    QVERIFY(built.save(path));
+    const auto loaded = SearchIndex::load(path);
+    verify(loaded);
+
+    // Truncated and corrupted files are rejected, or at least do not crash
+    QFile indexFile(path);
+    QVERIFY(indexFile.open(QIODevice::ReadOnly));
+    const QByteArray data = indexFile.readAll();
+    for (qsizetype size = 0; size < data.size(); size++) {
+        QFile truncated(path + QLatin1String(".truncated"));
+        QVERIFY(truncated.open(QIODevice::WriteOnly | QIODevice::Truncate));
+        truncated.write(data.first(size));
+        truncated.close();
+        const auto index = SearchIndex::load(truncated.fileName());
+        index.find(QStringLiteral("sample"));
+    }
+
+    QVERIFY(!SearchIndex::load(dir.filePath(QStringLiteral("missing.idx"))).isValid());
+    QVERIFY(!SearchIndex().isValid());
+
+    ExtractionControl cancelled;
+    std::atomic_bool cancel = true;
+    cancelled.cancel = &cancel;
+    QVERIFY(!SearchIndex::build(doc, cancelled).isValid());
+
+    // Matches can be located in a UTF-8 book, e.g. in its table of contents
+    SyntheticBook::Options options;
+    options.ncx = true;
+    const auto book = SyntheticBook::generate(options);
+    QBuffer buf;
+    buf.setData(book.data);
+    buf.open(QIODevice::ReadOnly);
+    Mobipocket::Document synthetic(&buf);
+    const auto index = SearchIndex::build(synthetic);
+    const auto positions = index.find(QStringLiteral("chapter"));
+    QVERIFY(positions.size() >= book.chapters.size());
+    for (qint64 position : positions) {
+        QCOMPARE(synthetic.textRange(position, 7).toCaseFolded(), QStringLiteral("chapter"));
+    }
+    const auto toc = synthetic.tableOfContents();
+    const auto &last = toc.last();
+    const auto title = index.find(last.title.section(QLatin1Char(' '), 1));
+    QVERIFY(std::any_of(title.cbegin(), title.cend(), [&last](qint64 position) {
+        return position >= last.position && position < last.position + last.length;
+    }));
+}
+
+void MobipocketTest::testTableOfContents()
+{
+    QFETCH(SyntheticBook::Compression, compression);
+
+    SyntheticBook::Options options;
+    options.compression = compression;
+    options.ncx = true;
+    const auto book = SyntheticBook::generate(options);
+    QVERIFY(book.chapters.size() > 2);
+
+    QBuffer buf;
+    buf.setData(book.data);
+    buf.open(QIODevice::ReadOnly);
+    Mobipocket::Document doc(&buf);
+    QVERIFY(doc.isValid());
+
+    const auto toc = doc.tableOfContents();
+    QCOMPARE(toc.size(), book.chapters.size());
+    for (int i = 0; i < toc.size(); i++) {
+        QCOMPARE(toc[i].title, QString::fromUtf8(book.chapters[i].title));
+        QCOMPARE(toc[i].position, book.chapters[i].position);
+        QCOMPARE(toc[i].length, book.chapters[i].length);
+        QCOMPARE(toc[i].level, 0);
+        QCOMPARE(toc[i].parent, -1);
+    }
+
+    // The text records are located on first use, after that only the records
+    // spanned by the chapter are decompressed
+    QCOMPARE(doc.textRange(0, 6), QStringLiteral("<html>"));
+    Instrumentation::setEnabled(true);
+    const auto &last = toc.last();
+    const auto text = doc.textRange(last.position, last.length);
+    Instrumentation::setEnabled(false);
+    QCOMPARE(text, QString::fromUtf8(book.text.mid(last.position, last.length)));
+    QVERIFY(text.startsWith(QLatin1String("<mbp:pagebreak/><h2>") + toc.last().title));
+    const qint64 spanned = (last.position + last.length - 1) / 4096 - last.position / 4096 + 1;
+    QCOMPARE(doc.counters().recordsDecompressed, quint64(spanned));
+
+    QVERIFY(doc.textRange(book.text.size(), 10).isNull());
+    QVERIFY(doc.textRange(-1, 10).isNull());
+
+    // No NCX index
+    QFile file(testFilePath(QStringLiteral("test.mobi")));
+    QVERIFY(file.open(QFile::ReadOnly));
+    QVERIFY(Mobipocket::Document(&file).tableOfContents().isEmpty());
+}
+
+void MobipocketTest::testTableOfContents_data()
+{
+    QTest::addColumn<SyntheticBook::Compression>("compression");
+
+    QTest::addRow("none") << SyntheticBook::Compression::None;
+    QTest::addRow("palmdoc") << SyntheticBook::Compression::PalmDoc;
+    QTest::addRow("huffdic") << SyntheticBook::Compression::Huffdic;
+}
+
+void MobipocketTest::testShortTextRecord()
+{
+    SyntheticBook::Options options;
+    options.ncx = true;
+    options.shortRecord = 2;
+    const auto book = SyntheticBook::generate(options);
+    QVERIFY(book.chapters.last().position > 3 * 4096);
+
+    QBuffer buf;
+    buf.setData(book.data);
+    buf.open(QIODevice::ReadOnly);
+
+    // Chapters after the short record, before and after reading the whole text
+    for (bool whole : {false, true}) {
+        Mobipocket::Document doc(&buf);
+        QVERIFY(doc.isValid());
+        if (whole) {
+            QCOMPARE(doc.text(), QString::fromUtf8(book.text));
+        }
+        const auto toc = doc.tableOfContents();
+        QCOMPARE(toc.size(), book.chapters.size());
+        for (int i = toc.size() - 1; i >= 0; i--) {
+            QCOMPARE(doc.textRange(toc[i].position, toc[i].length), QString::fromUtf8(book.text.mid(toc[i].position, toc[i].length)));
+        }
+        QCOMPARE(doc.textRange(2 * 4096, 4096), QString::fromUtf8(book.text.mid(2 * 4096, 4096)));
+        QVERIFY(doc.textRange(book.text.size(), 10).isNull());
+    }
+}
+
+void MobipocketTest::testSequential()
+{
+    QFile file(testFilePath(QStringLiteral("test.mobi")));
+    QVERIFY(file.open(QFile::ReadOnly));
+    const QByteArray data = file.readAll();
+
+    QBuffer buf;
+    buf.setData(data);
+    buf.open(QIODevice::ReadOnly);
+    Mobipocket::Document reference(&buf);
+
+    SequentialDevice dev(data);
+    Mobipocket::Document doc(&dev);
+    QVERIFY(doc.isValid());
+    QVERIFY(dev.atEnd());
+    QCOMPARE(doc.metadata(), reference.metadata());
+    QCOMPARE(doc.text(), reference.text());
+    QCOMPARE(doc.imageCount(), reference.imageCount());
+    QCOMPARE(doc.thumbnail(), reference.thumbnail());
+    QCOMPARE(doc.getImage(0), reference.getImage(0));
+
+    // Should not crash
+    for (qsizetype size = 0; size < data.size(); size += 997) {
+        SequentialDevice truncated(data.left(size));
+        Mobipocket::Document doc(&truncated);
+        doc.text();
+        doc.thumbnail();
+    }
+}
+
+void MobipocketTest::testSequentialParts()
+{
+    QFETCH(SyntheticBook::Compression, compression);
+
+    SyntheticBook::Options options;
+    options.compression = compression;
+    options.imageCount = 3;
+    options.ncx = true;
+    const auto book = SyntheticBook::generate(options);
+
+    QBuffer buf;
+    buf.setData(book.data);
+    buf.open(QIODevice::ReadOnly);
+    Mobipocket::Document reference(&buf);
+    QVERIFY(reference.isValid());
+    QVERIFY(!reference.tableOfContents().isEmpty());
+    QCOMPARE(reference.imageCount(), options.imageCount);
+
+    {
+        SequentialDevice dev(book.data);
+        Mobipocket::Document doc(&dev);
+        QVERIFY(doc.isValid());
+        QCOMPARE(doc.text(), reference.text());
+        QCOMPARE(doc.imageCount(), options.imageCount);
+        QCOMPARE(doc.tableOfContents().size(), reference.tableOfContents().size());
+        for (int i = 0; i < options.imageCount; i++) {
+            QCOMPARE(doc.getImage(i), reference.getImage(i));
+        }
+    }
+
+    {
+        OpenOptions open;
+        open.parts = OpenOptions::Metadata | OpenOptions::Images;
+        open.images = {1};
+        SequentialDevice dev(book.data);
+        Mobipocket::Document doc(&dev, open);
+        QVERIFY(doc.isValid());
+        QCOMPARE(doc.metadata(), reference.metadata());
+        QVERIFY(doc.getImage(0).isNull());
+        QCOMPARE(doc.getImage(1), reference.getImage(1));
+        QVERIFY(doc.tableOfContents().isEmpty());
+    }
+
+    {
+        OpenOptions open;
+        open.parts = OpenOptions::TableOfContents | OpenOptions::Thumbnail;
+        SequentialDevice dev(book.data);
+        Mobipocket::Document doc(&dev, open);
+        QVERIFY(doc.isValid());
+        QVERIFY(doc.text().isEmpty());
+        QCOMPARE(doc.thumbnail(), reference.thumbnail());
+        const auto toc = doc.tableOfContents();
+        QCOMPARE(toc.size(), book.chapters.size());
+        QCOMPARE(toc.last().title, QString::fromUtf8(book.chapters.last().title));
+    }
+}
+
+void MobipocketTest::testSequentialParts_data()
+{
+    QTest::addColumn<SyntheticBook::Compression>("compression");
+
+    QTest::addRow("palmdoc") << SyntheticBook::Compression::PalmDoc;
+    QTest::addRow("huffdic") << SyntheticBook::Compression::Huffdic;
+}
+
+void MobipocketTest::testValidate()
+{
+    QFETCH(QByteArray, data);
+    QFETCH(int, textRecords);
+    QFETCH(int, imageRecords);
+    QFETCH(qint64, textLength);
+
+    QBuffer buf;
+    buf.setData(data);
+    buf.open(QIODevice::ReadOnly);
+    Mobipocket::Document doc(&buf);
+
+    const auto report = doc.validate();
+    QVERIFY2(report.isValid(), qPrintable(report.issues.value(0).message));
+    QVERIFY(!report.drm);
+    QCOMPARE(report.textRecords, textRecords);
+    QCOMPARE(report.imageRecords, imageRecords);
+    QCOMPARE(report.textLength, textLength);
+
+    std::atomic_bool cancel = true;
+    ExtractionControl control;
+    control.cancel = &cancel;
+    const auto cancelled = doc.validate(control);
+    QVERIFY(!cancelled.complete);
+    QVERIFY(!cancelled.isValid());
+}
+
+void MobipocketTest::testValidate_data()
+{
+    QTest::addColumn<QByteArray>("data");
+    QTest::addColumn<int>("textRecords");
+    QTest::addColumn<int>("imageRecords");
+    QTest::addColumn<qint64>("textLength");
+
+    QFile file(testFilePath(QStringLiteral("test.mobi")));
+    QVERIFY(file.open(QFile::ReadOnly));
+    QTest::addRow("test.mobi") << file.readAll() << 1 << 2 << qint64(158);
+
+    for (auto compression : {SyntheticBook::Compression::None, SyntheticBook::Compression::PalmDoc, SyntheticBook::Compression::Huffdic}) {
+        SyntheticBook::Options options;
+        options.compression = compression;
+        options.imageCount = 5;
+        options.ncx = true;
+        const auto book = SyntheticBook::generate(options);
+        const int textRecords = (book.text.size() + 4095) / 4096;
+        QTest::addRow("%s", qPrintable(SyntheticBook::describe(options))) << book.data << textRecords << 5 << qint64(book.text.size());
+    }
+}
+
+void MobipocketTest::testValidateCorrupt()
+{
+    SyntheticBook::Options options;
+    options.imageCount = 2;
+    const auto book = SyntheticBook::generate(options);
+
+    auto validate = [](const QByteArray &data) {
+        QBuffer buf;
+        buf.setData(data);
+        buf.open(QIODevice::ReadOnly);
+        return Mobipocket::Document(&buf).validate();
+    };
+    auto hasIssue = [](const ValidationReport &report, ValidationReport::Check check, int record) {
+        return std::any_of(report.issues.cbegin(), report.issues.cend(), [=](const ValidationReport::Issue &issue) {
+            return issue.check == check && issue.record == record;
+        });
+    };
+
+    // Header, text records, two images, FLIS, FCIS and EOF records
+    const int textRecords = (book.text.size() + 4095) / 4096;
+
+    // The trailing FLIS, FCIS and EOF records start past the end
+    const auto truncated = validate(book.data.left(book.data.size() - 100));
+    QVERIFY(hasIssue(truncated, ValidationReport::RecordTable, textRecords + 3));
+
+    // Image without a known signature
+    QByteArray data = book.data;
+    const qsizetype image = recordOffset(data, textRecords + 2);
+    data.replace(image, 8, "garbage!");
+    const auto badImage = validate(data);
+    QVERIFY(hasIssue(badImage, ValidationReport::ImageRecord, textRecords + 2));
+    QCOMPARE(badImage.imageRecords, 1);
+
+    // Declared text length not matching the records
+    data = book.data;
+    const qsizetype header = recordOffset(data, 0);
+    qToBigEndian<quint32>(book.text.size() - 1, data.data() + header + 4);
+    QVERIFY(hasIssue(validate(data), ValidationReport::TextRecord, -1));
+
+    // Unknown compression
+    qToBigEndian<quint16>(7, data.data() + header);
+    QVERIFY(hasIssue(validate(data), ValidationReport::Header, 0));
+}
+
+void MobipocketTest::testStructure()
+{
+    SyntheticBook::Options options;
+    // Metadata from the HTML head
+    options.exth = false;
+    options.imageCount = 3;
+    options.ncx = true;
+    const auto book = SyntheticBook::generate(options);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("book.structure"));
+
+    QBuffer buf;
+    buf.setData(book.data);
+    buf.open(QIODevice::ReadOnly);
+    Mobipocket::Document reference(&buf);
+    QVERIFY(reference.isValid());
+    QCOMPARE(reference.fingerprint().size(), 20);
+    QVERIFY(reference.saveStructure(path));
+
+    OpenOptions open;
+    open.structurePath = path;
+    Instrumentation::setEnabled(true);
+    Mobipocket::Document doc(&buf, open);
+    QVERIFY(doc.isValid());
+    QCOMPARE(doc.fingerprint(), reference.fingerprint());
+    QCOMPARE(doc.metadata(), reference.metadata());
+    QCOMPARE(doc.getImage(0), reference.getImage(0));
+    const auto toc = doc.tableOfContents();
+    Instrumentation::setEnabled(false);
+
+    // Neither the HTML head, the images nor the NCX index were parsed
+    QCOMPARE(doc.counters().recordsDecompressed, quint64(0));
+    QCOMPARE(doc.counters().imageProbes, quint64(0));
+
+    QCOMPARE(toc.size(), book.chapters.size());
+    for (int i = 0; i < toc.size(); i++) {
+        QCOMPARE(toc[i].title, QString::fromUtf8(book.chapters[i].title));
+        QCOMPARE(doc.textRange(toc[i].position, toc[i].length), reference.textRange(toc[i].position, toc[i].length));
+    }
+
+    // Ignored for other books
+    options.seed = 2;
+    QBuffer other;
+    other.setData(SyntheticBook::generate(options).data);
+    other.open(QIODevice::ReadOnly);
+    const auto expected = Mobipocket::Document(&other).metadata();
+    Mobipocket::Document mismatched(&other, open);
+    QVERIFY(mismatched.isValid());
+    QVERIFY(mismatched.fingerprint() != reference.fingerprint());
+    QCOMPARE(mismatched.metadata(), expected);
+
+    // Ignored if corrupt
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.resize(file.size() - 10));
+    file.close();
+    Mobipocket::Document truncated(&buf, open);
+    QVERIFY(truncated.isValid());
+    QCOMPARE(truncated.metadata(), reference.metadata());
+    QCOMPARE(truncated.tableOfContents().size(), toc.size());
+}
+
+void MobipocketTest::testStructureDeferredDictionaries()
+{
+    SyntheticBook::Options options;
+    options.compression = SyntheticBook::Compression::Huffdic;
+    options.imageCount = 2;
+    const auto book = SyntheticBook::generate(options);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("book.structure"));
+
+    QBuffer buf;
+    buf.setData(book.data);
+    buf.open(QIODevice::ReadOnly);
+    Mobipocket::Document reference(&buf);
+    QVERIFY(reference.isValid());
+    QVERIFY(reference.saveStructure(path));
+
+    OpenOptions open;
+    open.structurePath = path;
+    Instrumentation::setEnabled(true);
+    Mobipocket::Document doc(&buf, open);
+    const auto opened = doc.counters();
+    const int images = doc.imageCount();
+    Instrumentation::setEnabled(false);
+
+    // Neither the dictionaries nor the records following the images were read
+    QVERIFY(doc.isValid());
+    QCOMPARE(opened.phaseNsecs[Instrumentation::DictionaryPhase], quint64(0));
+    QCOMPARE(doc.memoryUsage().dictionaries, qint64(0));
+    QCOMPARE(doc.counters().recordsRead, opened.recordsRead);
+    QCOMPARE(images, options.imageCount);
+
+    QCOMPARE(doc.text(), reference.text());
+    QVERIFY(doc.memoryUsage().dictionaries > 0);
+
+    // Not deferred if the dictionaries exceed the limit
+    OpenOptions limited = open;
+    limited.limits.maxDictionaryBytes = 16;
+    QVERIFY(!Mobipocket::Document(&buf, limited).isValid());
+}
+
+void MobipocketTest::testMemoryUsage()
+{
+    SyntheticBook::Options options;
+    options.compression = SyntheticBook::Compression::Huffdic;
+    const auto book = SyntheticBook::generate(options);
+
+    QBuffer buf;
+    buf.setData(book.data);
+    buf.open(QIODevice::ReadOnly);
+    Mobipocket::Document doc(&buf);
+    QVERIFY(doc.isValid());
+
+    // At least the CDIC record
+    const auto usage = doc.memoryUsage();
+    QVERIFY(usage.dictionaries > SyntheticBook::huffdicTables().last().size());
+    QCOMPARE(usage.records, qint64(0));
+    QCOMPARE(usage.total(), usage.dictionaries + usage.structure);
+
+    SequentialDevice dev(book.data);
+    Mobipocket::Document sequential(&dev);
+    QVERIFY(sequential.memoryUsage().records > book.text.size() / 4);
+}
+
+void MobipocketTest::testLimits()
+{
+    SyntheticBook::Options options;
+    options.compression = SyntheticBook::Compression::Huffdic;
+    const auto book = SyntheticBook::generate(options);
+
+    QBuffer buf;
+    buf.setData(book.data);
+    buf.open(QIODevice::ReadOnly);
+
+    {
+        OpenOptions open;
+        open.limits.maxTextBytes = 1000;
+        Mobipocket::Document doc(&buf, open);
+        QVERIFY(doc.isValid());
+        QVERIFY(doc.text().isNull());
+        QVERIFY(doc.plainText().isNull());
+        QVERIFY(doc.textRange(0, 2000).isNull());
+        QCOMPARE(doc.textRange(0, 100), QString::fromUtf8(book.text.left(100)));
+        QVERIFY(doc.isValid());
+    }
+    {
+        Mobipocket::Document doc(&buf);
+        QCOMPARE(doc.memoryUsage().peakBuffers, qint64(0));
+        QVERIFY(!doc.text().isEmpty());
+        QVERIFY(doc.memoryUsage().peakBuffers >= 4096);
+    }
+    {
+        OpenOptions open;
+        open.limits.maxRecordBytes = 1000;
+        Mobipocket::Document doc(&buf, open);
+        QVERIFY(doc.text().isNull());
+        QVERIFY(!doc.isValid());
+    }
+    {
+        OpenOptions open;
+        open.limits.maxRecordWork = 10;
+        Mobipocket::Document doc(&buf, open);
+        QVERIFY(doc.text().isNull());
+        QVERIFY(!doc.isValid());
+    }
+    {
+        OpenOptions open;
+        open.limits.maxDictionaryBytes = 1000;
+        QVERIFY(!Mobipocket::Document(&buf, open).isValid());
+    }
+}
+
+void MobipocketTest::testCombination()
+{
+    QFETCH(SyntheticBook::Compression, compression);
+
+    SyntheticBook::Options options;
+    options.compression = compression;
+    options.imageCount = 2;
+    options.combination = true;
+    const auto book = SyntheticBook::generate(options);
+    QVERIFY(book.text != book.kf8Text);
+
+    QBuffer buf;
+    buf.setData(book.data);
+    buf.open(QIODevice::ReadOnly);
+
+    {
+        Mobipocket::Document doc(&buf);
+        QVERIFY(doc.isValid());
+        QVERIFY(doc.isCombination());
+        QCOMPARE(doc.section(), OpenOptions::Mobi7Section);
+        QCOMPARE(doc.text(), QString::fromUtf8(book.text));
+        QVERIFY(!doc.thumbnail().isNull());
+        QVERIFY(!doc.getImage(1).isNull());
+        // Neither FLIS and FCIS nor records of the KF8 book are counted
+        QCOMPARE(doc.imageCount(), options.imageCount);
+        const auto report = doc.validate();
+        QVERIFY(report.isValid());
+        QCOMPARE(report.imageRecords, 2);
+    }
+
+    OpenOptions kf8;
+    kf8.section = OpenOptions::Kf8Section;
+    {
+        Mobipocket::Document doc(&buf, kf8);
+        QVERIFY(doc.isValid());
+        QVERIFY(doc.isCombination());
+        QCOMPARE(doc.section(), OpenOptions::Kf8Section);
+        QVERIFY(doc.isKf8());
+        QVERIFY(doc.partCount() > 0);
+        QCOMPARE(doc.metadata().value(Document::Title), QStringLiteral("The Big Brown Bear"));
+        QCOMPARE(doc.text(), QString::fromUtf8(book.kf8Text));
+        // Images of the MOBI 7 book are not probed
+        QVERIFY(doc.getImage(0).isNull());
+        const auto report = doc.validate();
+        QVERIFY(report.isValid());
+        QCOMPARE(report.imageRecords, 0);
+    }
+    {
+        SequentialDevice dev(book.data);
+        Mobipocket::Document doc(&dev);
+        QCOMPARE(doc.section(), OpenOptions::Mobi7Section);
+        QCOMPARE(doc.text(), QString::fromUtf8(book.text));
+        QVERIFY(!doc.getImage(1).isNull());
+    }
+    {
+        SequentialDevice dev(book.data);
+        Mobipocket::Document doc(&dev, kf8);
+        QCOMPARE(doc.section(), OpenOptions::Kf8Section);
+        QCOMPARE(doc.text(), QString::fromUtf8(book.kf8Text));
+    }
+
+    // Other files are opened as a whole
+    options.combination = false;
+    buf.close();
+    buf.setData(SyntheticBook::generate(options).data);
+    buf.open(QIODevice::ReadOnly);
+    Mobipocket::Document doc(&buf, kf8);
+    QVERIFY(doc.isValid());
+    QVERIFY(!doc.isCombination());
+    QCOMPARE(doc.section(), OpenOptions::Mobi7Section);
+    QCOMPARE(doc.text(), QString::fromUtf8(book.text));
+}
+
+void MobipocketTest::testCombination_data()
+{
+    QTest::addColumn<SyntheticBook::Compression>("compression");
+    QTest::addRow("palmdoc") << SyntheticBook::Compression::PalmDoc;
+    QTest::addRow("huffdic") << SyntheticBook::Compression::Huffdic;
+}
+
+void MobipocketTest::testKf8ImageCount()
+{
+    SyntheticBook::Options options;
+    options.kf8 = true;
+    options.imageCount = 3;
+    QByteArray data = SyntheticBook::generate(options).data;
+
+    // KF8 headers hold the FDST index where MOBI 7 headers declare the last
+    // content record, here pointing before the last image
+    const qsizetype header = recordOffset(data, 0);
+    const quint32 firstImage = qFromBigEndian<quint32>(data.constData() + header + 108);
+    qToBigEndian<quint32>(firstImage + 1, data.data() + header + 192);
+
+    Mobipocket::Document doc(data);
+    QVERIFY(doc.isKf8());
+    QCOMPARE(doc.imageCount(), options.imageCount);
+}
+
+void MobipocketTest::testResourceData()
+{
+    SyntheticBook::Options options;
+    options.imageCount = 3;
+    QByteArray data = SyntheticBook::generate(options).data;
+
+    {
+        Mobipocket::Document doc(data);
+        QCOMPARE(doc.resourceCount(), 3);
+        for (int i = 0; i < 3; i++) {
+            QCOMPARE(doc.resourceData(i), doc.imageData(i));
+        }
+        QVERIFY(doc.resourceData(-1).isNull());
+    }
+
+    // Counted from the first resource declared in the header, not from the
+    // first record detected as image
+    const qsizetype header = recordOffset(data, 0);
+    const quint32 firstImage = qFromBigEndian<quint32>(data.constData() + header + 108);
+    qToBigEndian<quint32>(firstImage + 1, data.data() + header + 108);
+    Mobipocket::Document doc(data);
+    QCOMPARE(doc.imageCount(), 3);
+    QCOMPARE(doc.resourceCount(), 2);
+    QCOMPARE(doc.resourceData(0), doc.imageData(1));
+}
+
+void MobipocketTest::testKf8()
+{
+    QFETCH(SyntheticBook::Compression, compression);
+
+    SyntheticBook::Options options;
+    options.compression = compression;
+    options.kf8 = true;
+    const auto book = SyntheticBook::generate(options);
+    QVERIFY(book.parts.size() > 1);
+
+    QBuffer buf;
+    buf.setData(book.data);
+    buf.open(QIODevice::ReadOnly);
+    Mobipocket::Document doc(&buf);
+    QVERIFY(doc.isValid());
+    QVERIFY(doc.isKf8());
+    QCOMPARE(doc.text(), QString::fromUtf8(book.text));
+
+    QCOMPARE(doc.flowCount(), book.flows.size());
+    for (int i = 0; i < book.flows.size(); i++) {
+        QCOMPARE(doc.flow(i), QString::fromUtf8(book.flows[i]));
+    }
+    QVERIFY(doc.flow(book.flows.size()).isNull());
+
+    QCOMPARE(doc.partCount(), book.parts.size());
+    for (int i = 0; i < book.parts.size(); i++) {
+        QCOMPARE(doc.part(i), QString::fromUtf8(book.parts[i]));
+    }
+    QVERIFY(doc.part(-1).isNull());
+    QVERIFY(doc.part(book.parts.size()).isNull());
+
+    // Once the text records are located, only the records spanned by the part
+    // are decompressed
+    Mobipocket::Document fresh(&buf);
+    fresh.partCount();
+    fresh.part(1);
+    Instrumentation::setEnabled(true);
+    fresh.part(0);
+    Instrumentation::setEnabled(false);
+    QVERIFY(fresh.counters().recordsDecompressed < quint64(book.text.size() / 4096));
+
+    SequentialDevice dev(book.data);
+    Mobipocket::Document sequential(&dev);
+    QCOMPARE(sequential.partCount(), book.parts.size());
+    QCOMPARE(sequential.part(1), QString::fromUtf8(book.parts[1]));
+
+    // Other books have a single flow, and no parts
+    options.kf8 = false;
+    buf.close();
+    buf.setData(SyntheticBook::generate(options).data);
+    buf.open(QIODevice::ReadOnly);
+    Mobipocket::Document mobi7(&buf);
+    QVERIFY(!mobi7.isKf8());
+    QCOMPARE(mobi7.flowCount(), 1);
+    QCOMPARE(mobi7.flow(0), mobi7.text());
+    QCOMPARE(mobi7.partCount(), 0);
+    QVERIFY(mobi7.part(0).isNull());
+}
+
+void MobipocketTest::testKf8_data()
+{
+    QTest::addColumn<SyntheticBook::Compression>("compression");
+    QTest::addRow("none") << SyntheticBook::Compression::None;
+    QTest::addRow("palmdoc") << SyntheticBook::Compression::PalmDoc;
+    QTest::addRow("huffdic") << SyntheticBook::Compression::Huffdic;
+}
+
+void MobipocketTest::testTextCache()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const auto book = SyntheticBook::generate({});
+    QBuffer buf;
+    buf.setData(book.data);
+    QVERIFY(buf.open(QIODevice::ReadOnly));
+
+    TextCache cache(dir.filePath(QStringLiteral("cache")));
+    QVERIFY(QDir(cache.directory()).exists());
+    QCOMPARE(cache.size(), 0);
+
+    {
+        Mobipocket::Document doc(&buf);
+        const auto text = cache.text(doc);
+        QVERIFY(!text.isNull());
+        QCOMPARE(text.view(), doc.text());
+        const auto plainText = cache.text(doc, TextCache::PlainText);
+        QCOMPARE(plainText.view(), doc.plainText());
+        QCOMPARE(cache.statistics().misses, qint64(2));
+        QCOMPARE(cache.statistics().hits, qint64(0));
+    }
+    const qint64 size = cache.size();
+    QVERIFY(size > qint64(book.text.size()));
+
+    // Mapped from the cache file, without decompressing again
+    Mobipocket::Document doc(&buf);
+    Instrumentation::setEnabled(true);
+    const auto text = cache.text(doc);
+    Instrumentation::setEnabled(false);
+    QCOMPARE(doc.counters().recordsDecompressed, 0);
+    QCOMPARE(cache.statistics().hits, qint64(1));
+    QCOMPARE(text.toString(), QString::fromUtf8(book.text));
+
+    // Shared by other instances on the same directory
+    TextCache other(cache.directory());
+    QCOMPARE(other.text(doc, TextCache::PlainText).view(), doc.plainText());
+    QCOMPARE(other.statistics().hits, qint64(1));
+
+    // Evicted files remain mapped while in use
+    cache.setMaxSize(size - 1);
+    QCOMPARE(cache.statistics().evictions, qint64(1));
+    QVERIFY(cache.size() < size);
+    QCOMPARE(text.toString(), QString::fromUtf8(book.text));
+
+    cache.clear();
+    QCOMPARE(cache.size(), 0);
+    QVERIFY(cache.text(doc).view() == doc.text());
+    QCOMPARE(cache.statistics().misses, qint64(3));
+}
+
+void MobipocketTest::testMemorySources()
+{
+    SyntheticBook::Options options;
+    options.imageCount = 2;
+    const auto book = SyntheticBook::generate(options);
+    QBuffer buf;
+    buf.setData(book.data);
+    QVERIFY(buf.open(QIODevice::ReadOnly));
+    Mobipocket::Document reference(&buf);
+    QVERIFY(reference.isValid());
+
+    QByteArray imageData;
+    {
+        Mobipocket::Document doc(book.data);
+        QVERIFY(doc.isValid());
+        QCOMPARE(doc.text(), reference.text());
+        QCOMPARE(doc.imageCount(), reference.imageCount());
+        QCOMPARE(doc.getImage(1), reference.getImage(1));
+        QCOMPARE(doc.fingerprint(), reference.fingerprint());
+        imageData = doc.imageData(0);
+    }
+    // Copied out of the shared data
+    QCOMPARE(imageData, reference.imageData(0));
+
+    Mobipocket::Document view{QByteArrayView(book.data)};
+    QVERIFY(view.isValid());
+    QCOMPARE(view.plainText(), reference.plainText());
+    QVERIFY(view.validate().isValid());
+
+    CountingReader reader(book.data);
+    Mobipocket::Document doc(&reader);
+    QVERIFY(doc.isValid());
+    QCOMPARE(doc.text(), reference.text());
+    QCOMPARE(doc.getImage(0), reference.getImage(0));
+    QVERIFY(reader.reads > 0);
+    const auto report = doc.validate();
+    QVERIFY(report.isValid());
+    QCOMPARE(report.imageRecords, 2);
+
+    // Truncated
+    Mobipocket::Document truncated(book.data.left(0x40));
+    QVERIFY(!truncated.isValid());
+}
+
+void MobipocketTest::testPipeline()
+{
+    QFETCH(SyntheticBook::Compression, compression);
+    SyntheticBook::Options options;
+    options.compression = compression;
+    options.textSize = 64 * 1024;
+    const auto book = SyntheticBook::generate(options);
+    QBuffer buf;
+    buf.setData(book.data);
+    QVERIFY(buf.open(QIODevice::ReadOnly));
+
+    OpenOptions open;
+    open.pipelineDepth = 2;
+    Mobipocket::Document doc(&buf, open);
+    QVERIFY(doc.isValid());
+    QCOMPARE(doc.text(), QString::fromUtf8(book.text));
+    QCOMPARE(doc.text(5000), Mobipocket::Document(&buf).text(5000));
+    QCOMPARE(doc.plainText(), Mobipocket::Document(&buf).plainText());
+    QString streamed;
+    QVERIFY(doc.streamText([&](QStringView chunk) {
+        streamed += chunk;
+    }));
+    QCOMPARE(streamed, QString::fromUtf8(book.text));
+
+    // Abandoned while records are queued
+    ExtractionControl control;
+    control.progress = [](qint64 done, qint64) {
+        return done < 2;
+    };
+    QVERIFY(doc.text(control).isNull());
+    QVERIFY(doc.isValid());
+    QCOMPARE(doc.text(), QString::fromUtf8(book.text));
+
+    open.limits.maxRecordBytes = 1000;
+    Mobipocket::Document corrupt(&buf, open);
+    QVERIFY(corrupt.text().isNull());
+    QVERIFY(!corrupt.isValid());
+}
+
+void MobipocketTest::testPipeline_data()
+{
+    QTest::addColumn<SyntheticBook::Compression>("compression");
+    QTest::addRow("none") << SyntheticBook::Compression::None;
+    QTest::addRow("palmdoc") << SyntheticBook::Compression::PalmDoc;
+    QTest::addRow("huffdic") << SyntheticBook::Compression::Huffdic;
+}
+
+void MobipocketTest::testTextStatistics()
+{
+    QFETCH(QByteArray, data);
+    QBuffer buf;
+    buf.setData(data);
+    QVERIFY(buf.open(QIODevice::ReadOnly));
+    Mobipocket::Document doc(&buf);
+    QVERIFY(doc.isValid());
+
+    const QString plainText = doc.plainText();
+    qint64 paragraphs = 0;
+    for (const auto &line : plainText.split(QLatin1Char('\n'))) {
+        paragraphs += !line.trimmed().isEmpty();
+    }
+
+    Instrumentation::resetGlobalCounters();
+    Instrumentation::setEnabled(true);
+    const auto statistics = doc.textStatistics();
+    Instrumentation::setEnabled(false);
+    QVERIFY(statistics.complete);
+    QCOMPARE(statistics.characters, qint64(plainText.toUcs4().size() - plainText.count(QLatin1Char('\n'))));
+    QCOMPARE(statistics.words, qint64(plainText.simplified().split(QLatin1Char(' '), Qt::SkipEmptyParts).size()));
+    QCOMPARE(statistics.paragraphs, paragraphs);
+    QVERIFY(statistics.words > 0);
+    QCOMPARE(statistics.readingMinutes(1), statistics.words);
+    QCOMPARE(statistics.pages(1000000000), qint64(1));
+    QCOMPARE(Instrumentation::globalCounters().recordsDecompressed, doc.counters().recordsDecompressed);
+
+    const auto counted = TextStatistics::count(plainText);
+    QCOMPARE(counted.characters, statistics.characters);
+    QCOMPARE(counted.words, statistics.words);
+    QCOMPARE(counted.paragraphs, statistics.paragraphs);
+
+    ExtractionControl control;
+    control.progress = [](qint64, qint64) {
+        return false;
+    };
+    QVERIFY(!doc.textStatistics(control).complete);
+
+    OpenOptions open;
+    open.limits.maxTextBytes = 100;
+    QVERIFY(!Mobipocket::Document(&buf, open).textStatistics().complete);
+}
+
+void MobipocketTest::testTextStatistics_data()
+{
+    QTest::addColumn<QByteArray>("data");
+
+    QFile file(testFilePath(QStringLiteral("test.mobi")));
+    QVERIFY(file.open(QFile::ReadOnly));
+    QTest::addRow("test.mobi") << file.readAll();
+
+    for (auto compression : {SyntheticBook::Compression::None, SyntheticBook::Compression::PalmDoc, SyntheticBook::Compression::Huffdic}) {
+        SyntheticBook::Options options;
+        options.compression = compression;
+        QTest::addRow("%s", qPrintable(SyntheticBook::describe(options))) << SyntheticBook::generate(options).data;
+    }
+}
+
+void MobipocketTest::testDocumentPool()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QStringList paths;
+    for (auto compression : {SyntheticBook::Compression::PalmDoc, SyntheticBook::Compression::Huffdic}) {
+        SyntheticBook::Options options;
+        options.compression = compression;
+        paths.append(dir.filePath(SyntheticBook::describe(options) + QLatin1String(".mobi")));
+        QFile file(paths.last());
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QVERIFY(file.write(SyntheticBook::generate(options).data) > 0);
+    }
+
+    DocumentPool pool(1024 * 1024);
+    QVERIFY(!pool.acquire(dir.filePath(QStringLiteral("missing.mobi"))));
+
+    auto first = pool.acquire(paths[0]);
+    QVERIFY(first);
+    QVERIFY(first->isValid());
+    QCOMPARE(pool.acquire(paths[0]), first);
+    auto second = pool.acquire(paths[1]);
+    QVERIFY(second);
+
+    auto statistics = pool.statistics();
+    QCOMPARE(statistics.documents, 2);
+    QCOMPARE(statistics.openFiles, 2);
+    QCOMPARE(statistics.hits, qint64(1));
+    QCOMPARE(statistics.misses, qint64(3));
+    QCOMPARE(statistics.evictions, qint64(0));
+    QCOMPARE(statistics.memoryUsage, first->memoryUsage().total() + second->memoryUsage().total());
+
+    // The least recently used document is released, but remains usable
+    pool.setMemoryBudget(statistics.memoryUsage - 1);
+    statistics = pool.statistics();
+    QCOMPARE(statistics.documents, 1);
+    QCOMPARE(statistics.evictions, qint64(1));
+    QCOMPARE(statistics.openFiles, 2);
+    QVERIFY(!first->text().isEmpty());
+    first.reset();
+    QCOMPARE(pool.statistics().openFiles, 1);
+    QCOMPARE(pool.acquire(paths[1]), second);
+
+    second.reset();
+    pool.clear();
+    statistics = pool.statistics();
+    QCOMPARE(statistics.documents, 0);
+    QCOMPARE(statistics.openFiles, 0);
+    QCOMPARE(statistics.memoryUsage, qint64(0));
+}
+
 QTEST_GUILESS_MAIN(MobipocketTest)
 
 #include "mobipockettest.moc"
@@ -0,0 +1,741 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE contributors
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#include "syntheticbook.h"
+
+#include <QBuffer>
+#include <QImage>
+#include <QList>
+#include <QRandomGenerator>
+#include <QtEndian>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <vector>
+
+namespace SyntheticBook
+{
+namespace
+{
+constexpr qsizetype RecordSize = 4096;
+constexpr quint32 NoIndex = 0xffffffff;
+
+// Sorted by (rough) frequency, so a skewed index distribution gives a natural word distribution
+const char *const vocabulary[] = {
+    "the",     "of",      "and",     "to",       "in",       "a",        "is",      "that",     "for",    "it",     "as",       "was",
+    "with",    "be",      "by",      "on",       "not",      "he",       "this",    "are",      "or",     "his",    "from",     "at",
+    "which",   "but",     "have",    "an",       "had",      "they",     "you",     "were",     "their",  "one",    "all",      "we",
+    "can",     "her",     "has",     "there",    "been",     "if",       "more",    "when",     "will",   "would",  "who",      "so",
+    "no",      "bear",    "honey",   "forest",   "river",    "mountain", "winter",  "morning",  "evening", "journey", "library", "document",
+    "chapter", "whisper", "lantern", "shadow",   "harbour",  "kitchen",  "letter",  "silence",  "garden", "window", "travel",   "promise",
+    "brown",   "ancient", "quietly", "wandered", "remember", "northern", "thunder", "orchard",  "meadow", "candle", "question", "balloon",
+};
+constexpr int vocabularySize = sizeof(vocabulary) / sizeof(vocabulary[0]);
+
+class TextGenerator
+{
+public:
+    TextGenerator(quint32 seed)
+        : rng(seed)
+    {
+    }
+
+    QByteArray word()
+    {
+        // Skewed towards the frequent words at the start of the vocabulary
+        const double u = rng.generateDouble();
+        return vocabulary[std::min(vocabularySize - 1, int(vocabularySize * std::pow(u, 2.5)))];
+    }
+
+    QByteArray sentence()
+    {
+        QByteArray s = word();
+        s[0] = std::toupper(s[0]);
+        const int length = 4 + rng.bounded(14);
+        for (int i = 0; i < length; i++) {
+            s += (rng.bounded(8) == 0) ? ", " : " ";
+            s += word();
+        }
+        return s + ". ";
+    }
+
+    QByteArray paragraph()
+    {
+        QByteArray p = "<p>";
+        const int sentences = 1 + rng.bounded(6);
+        for (int i = 0; i < sentences; i++) {
+            p += sentence();
+        }
+        return p + "</p>\n";
+    }
+
+    QRandomGenerator rng;
+};
+
+QByteArray htmlText(const Options &options, QList<Chapter> *chapters = nullptr)
+{
+    TextGenerator gen(options.seed);
+
+    QByteArray text;
+    text.reserve(options.textSize + 4096);
+    text += "<html><head><guide><reference title=\"Start\" type=\"text\" filepos=0000000000 /></guide></head><body>";
+
+    // Spread the image references evenly over the text
+    const qint64 imageStride = options.imageCount ? options.textSize / (options.imageCount + 1) : options.textSize + 1;
+    int image = 0;
+    int chapter = 0;
+    while (text.size() < options.textSize) {
+        if (chapters) {
+            if (!chapters->isEmpty()) {
+                chapters->last().length = text.size() - chapters->last().position;
+            }
+            chapters->append({"Chapter " + QByteArray::number(chapter + 1), text.size(), 0});
+        }
+        text += "<mbp:pagebreak/><h2>Chapter " + QByteArray::number(++chapter) + "</h2>\n";
+        const int paragraphs = 10 + gen.rng.bounded(40);
+        for (int i = 0; i < paragraphs && text.size() < options.textSize; i++) {
+            text += gen.paragraph();
+            if (image < options.imageCount && text.size() > (image + 1) * imageStride) {
+                text += "<p><img recindex=\"" + QByteArray::number(image + 1).rightJustified(5, '0') + "\" /></p>\n";
+                image++;
+            }
+        }
+    }
+    if (chapters && !chapters->isEmpty()) {
+        chapters->last().length = text.size() - chapters->last().position;
+    }
+    text += "</body></html>";
+    return text;
+}
+
+QByteArray palmDocCompress(QByteArrayView in)
+{
+    QByteArray out;
+    out.reserve(in.size());
+
+    // Most recent position of each 3 byte prefix hash
+    std::array<int, 4096> head;
+    head.fill(-1);
+    auto hash = [&in](qsizetype p) {
+        return ((uchar(in[p]) << 7) ^ (uchar(in[p + 1]) << 3) ^ uchar(in[p + 2])) & 0xfff;
+    };
+
+    const qsizetype n = in.size();
+    qsizetype i = 0;
+    while (i < n) {
+        int matchLength = 0;
+        int distance = 0;
+        if (i + 3 <= n) {
+            const auto h = hash(i);
+            const int candidate = head[h];
+            head[h] = i;
+            if (candidate >= 0 && i - candidate <= 2047) {
+                while (matchLength < 10 && i + matchLength < n && in[candidate + matchLength] == in[i + matchLength]) {
+                    matchLength++;
+                }
+                distance = i - candidate;
+            }
+        }
+
+        if (matchLength >= 3) {
+            const quint16 token = 0x8000 | (distance << 3) | (matchLength - 3);
+            out.append(char(token >> 8));
+            out.append(char(token & 0xff));
+            for (int k = 1; k < matchLength && i + k + 3 <= n; k++) {
+                head[hash(i + k)] = i + k;
+            }
+            i += matchLength;
+            continue;
+        }
+
+        const uchar c = in[i];
+        if (c == ' ' && i + 1 < n && uchar(in[i + 1]) >= 0x40 && uchar(in[i + 1]) <= 0x7f) {
+            // space + character
+            out.append(char(uchar(in[i + 1]) ^ 0x80));
+            i += 2;
+        } else if (c == 0 || (c >= 0x09 && c <= 0x7f)) {
+            out.append(char(c));
+            i++;
+        } else {
+            // literal run for bytes which can not be passed verbatim
+            qsizetype run = 1;
+            while (run < 8 && i + run < n) {
+                const uchar d = in[i + run];
+                if (d == 0 || (d >= 0x09 && d <= 0x7f)) {
+                    break;
+                }
+                run++;
+            }
+            out.append(char(run));
+            out.append(in.mid(i, run));
+            i += run;
+        }
+    }
+    return out;
+}
+
+/**
+ * Huffdic codec with fixed 8 bit codes: symbols 0..127 are the ASCII
+ * characters, 128..239 frequent phrases and 240..255 pairs of phrases,
+ * which are stored as coded data in the dictionary and require one
+ * level of recursion.
+ */
+class HuffdicEncoder
+{
+public:
+    HuffdicEncoder()
+    {
+        for (int i = 0; i < 128; i++) {
+            entries.append(QByteArray(1, char(i)));
+        }
+        const char *const markup[] = {"<p>", "</p>\n", ". ", ", ", "<mbp:pagebreak/>", "<h2>Chapter ", "</h2>\n", "<p><img recindex=\"000"};
+        for (auto m : markup) {
+            entries.append(m);
+        }
+        for (int i = 0; entries.size() < 240 && i < vocabularySize; i++) {
+            entries.append(QByteArray(" ") + vocabulary[i]);
+        }
+        while (entries.size() < 240) {
+            entries.append(QByteArray(1, ' ') + QByteArray::number(entries.size()));
+        }
+        for (int i = 0; i < 16; i++) {
+            const int a = 128 + 8 + i; // " the", " of", ...
+            const int b = 128 + 8 + i + 1;
+            pairs.append({a, b});
+            entries.append(entries[a] + entries[b]);
+        }
+
+        // Candidate symbols per first character, longest first
+        for (int sym = 128; sym < entries.size(); sym++) {
+            byFirstChar[uchar(entries[sym][0])].push_back(sym);
+        }
+        for (auto &candidates : byFirstChar) {
+            std::sort(candidates.begin(), candidates.end(), [this](int a, int b) {
+                return entries[a].size() > entries[b].size();
+            });
+        }
+    }
+
+    QByteArray huffRecord() const
+    {
+        QByteArray huff("HUFF", 4);
+        huff.resize(24, '\0');
+        qToBigEndian<quint32>(huff.size(), huff.data() + 16);
+        // The decompressor reads the code tables in native byte order
+        for (int code = 0; code < 256; code++) {
+            const quint32 r = 2 * code; // entry index + code
+            const char entry[4] = {char(8 | 0x80), char(r & 0xff), char(r >> 8), 0};
+            huff.append(entry, 4);
+        }
+        qToBigEndian<quint32>(huff.size(), huff.data() + 20);
+        huff.append(64 * 4, '\0');
+        return huff;
+    }
+
+    QByteArray cdicRecord() const
+    {
+        QByteArray cdic("CDIC", 4);
+        cdic.resize(16, '\0');
+        qToBigEndian<quint32>(16, cdic.data() + 4);
+        qToBigEndian<quint32>(entries.size(), cdic.data() + 8);
+        qToBigEndian<quint32>(32, cdic.data() + 12);
+
+        QByteArray offsets(2 * entries.size(), '\0');
+        QByteArray data;
+        for (int sym = 0; sym < entries.size(); sym++) {
+            qToBigEndian<quint16>(offsets.size() + data.size(), offsets.data() + 2 * sym);
+            QByteArray payload;
+            quint16 flags = 0x8000;
+            if (sym >= 240) {
+                payload.append(char(pairs[sym - 240].first));
+                payload.append(char(pairs[sym - 240].second));
+                flags = 0;
+            } else {
+                payload = entries[sym];
+            }
+            char blen[2];
+            qToBigEndian<quint16>(flags | payload.size(), blen);
+            data.append(blen, 2);
+            data.append(payload);
+        }
+        return cdic + offsets + data;
+    }
+
+    QByteArray compress(QByteArrayView in) const
+    {
+        QByteArray out;
+        out.reserve(in.size() / 2);
+        qsizetype i = 0;
+        while (i < in.size()) {
+            const uchar c = in[i];
+            int symbol = c & 0x7f;
+            qsizetype length = 1;
+            for (int candidate : byFirstChar[c]) {
+                if (in.sliced(i).startsWith(entries[candidate])) {
+                    symbol = candidate;
+                    length = entries[candidate].size();
+                    break;
+                }
+            }
+            out.append(char(symbol));
+            i += length;
+        }
+        return out;
+    }
+
+private:
+    QList<QByteArray> entries;
+    QList<std::pair<int, int>> pairs;
+    std::array<std::vector<int>, 256> byFirstChar;
+};
+
+QByteArray generateImage(int index, int count, quint32 seed)
+{
+    QSize size(400, 300);
+    if (index == 0) {
+        size = {600, 800}; // cover
+    } else if (index == count - 1) {
+        size = {120, 160}; // thumbnail
+    }
+
+    // Gradient with some noise, so the encoded size is somewhat realistic
+    QImage img(size, QImage::Format_RGB32);
+    QRandomGenerator rng(seed + index);
+    const QRgb base = rng.generate();
+    for (int y = 0; y < size.height(); y++) {
+        auto line = reinterpret_cast<QRgb *>(img.scanLine(y));
+        for (int x = 0; x < size.width(); x++) {
+            const int noise = rng.bounded(16);
+            line[x] = qRgb((qRed(base) + x / 2 + noise) & 0xff, (qGreen(base) + y / 2 + noise) & 0xff, (qBlue(base) + (x + y) / 4) & 0xff);
+        }
+    }
+
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    img.save(&buffer, (index % 4 == 3) ? "PNG" : "JPG", 80);
+    return data;
+}
+
+void appendExthRecord(QByteArray &exth, quint32 type, const QByteArray &data)
+{
+    char header[8];
+    qToBigEndian<quint32>(type, header);
+    qToBigEndian<quint32>(8 + data.size(), header + 4);
+    exth.append(header, 8);
+    exth.append(data);
+}
+
+QByteArray bigEndian32(quint32 value)
+{
+    QByteArray r(4, '\0');
+    qToBigEndian<quint32>(value, r.data());
+    return r;
+}
+
+// Forward encoded variable width integer as used in INDX records, the last byte has the high bit set
+QByteArray forwardVarint(quint32 value)
+{
+    QByteArray r(1, char(0x80 | (value & 0x7f)));
+    while (value >>= 7) {
+        r.prepend(char(value & 0x7f));
+    }
+    return r;
+}
+
+QByteArray indxHeader(quint32 type, quint32 idxtOffset, quint32 count, quint32 recordCount, quint32 totalCount, quint32 cncxCount)
+{
+    QByteArray rec(192, '\0');
+    char *d = rec.data();
+    memcpy(d, "INDX", 4);
+    qToBigEndian<quint32>(192, d + 4);
+    qToBigEndian<quint32>(type, d + 12);
+    qToBigEndian<quint32>(idxtOffset, d + 20);
+    qToBigEndian<quint32>(type == 0 ? recordCount : count, d + 24);
+    qToBigEndian<quint32>(65001, d + 28);
+    qToBigEndian<quint32>(NoIndex, d + 32);
+    qToBigEndian<quint32>(totalCount, d + 36);
+    qToBigEndian<quint32>(cncxCount, d + 52);
+    return rec;
+}
+
+struct IndexEntry {
+    QByteArray name;
+    // Values of each tag of the index, in tag table order
+    QList<QList<quint32>> values;
+};
+
+struct IndexTag {
+    quint8 tag;
+    quint8 valuesPerEntry;
+};
+
+/**
+ * INDX index: header record with the TAGX tag table, and one INDX record with
+ * the entries, i.e. for up to a few thousand entries. Each entry has a value
+ * group for all tags, with one control byte. The @p cncxCount CNCX records
+ * are appended by the caller.
+ */
+QList<QByteArray> indexRecords(const QList<IndexTag> &tags, const QList<IndexEntry> &entries, quint32 cncxCount)
+{
+    QByteArray data;
+    QList<quint16> offsets;
+    for (const auto &entry : entries) {
+        offsets.append(192 + data.size());
+        data.append(char(entry.name.size()));
+        data.append(entry.name);
+        data.append(char((1 << tags.size()) - 1)); // control byte, one value group for each tag
+        for (const auto &values : entry.values) {
+            for (quint32 value : values) {
+                data.append(forwardVarint(value));
+            }
+        }
+    }
+
+    QByteArray record = indxHeader(1, 192 + data.size(), entries.size(), 1, 0, 0) + data;
+    record += "IDXT";
+    for (quint16 offset : std::as_const(offsets)) {
+        char buf[2];
+        qToBigEndian<quint16>(offset, buf);
+        record.append(buf, 2);
+    }
+    record.append((4 - record.size() % 4) % 4, '\0');
+
+    QByteArray tagx("TAGX", 4);
+    tagx += bigEndian32(12 + 4 * (tags.size() + 1));
+    tagx += bigEndian32(1);
+    for (int i = 0; i < tags.size(); i++) {
+        const char definition[] = {char(tags[i].tag), char(tags[i].valuesPerEntry), char(1 << i), 0};
+        tagx.append(definition, 4);
+    }
+    tagx.append(QByteArray("\0\0\0\x01", 4));
+    QByteArray header = indxHeader(0, 192 + tagx.size(), 0, 1, entries.size(), cncxCount) + tagx;
+    // The header record has its own IDXT, with the last entry name of each record
+    header += "IDXT";
+    header.append(4, '\0');
+
+    return {header, record};
+}
+
+/**
+ * NCX index, with one CNCX record holding the titles.
+ * Tags: 1 position, 2 length, 3 title offset in CNCX, 4 level
+ */
+QList<QByteArray> ncxRecords(const QList<Chapter> &chapters)
+{
+    QByteArray cncx;
+    QList<IndexEntry> entries;
+    for (int i = 0; i < chapters.size(); i++) {
+        const QByteArray name = QByteArray::number(i, 16).rightJustified(3, '0');
+        entries.append({name, {{quint32(chapters[i].position)}, {quint32(chapters[i].length)}, {quint32(cncx.size())}, {0}}});
+        cncx.append(forwardVarint(chapters[i].title.size()));
+        cncx.append(chapters[i].title);
+    }
+    cncx.append((4 - cncx.size() % 4) % 4, '\0');
+
+    return indexRecords({{1, 1}, {2, 1}, {3, 1}, {4, 1}}, entries, 1) << cncx;
+}
+
+struct Kf8Text {
+    // Flows as stored, followed by each other
+    QByteArray stored;
+    QList<QByteArray> flows;
+    QList<QByteArray> parts;
+    QList<IndexEntry> skeletons;
+    QList<IndexEntry> fragments;
+};
+
+/**
+ * KF8 text of @p html: one part per chapter, stored as a skeleton followed by
+ * two fragments, which hold the halves of the chapter. A CSS flow follows.
+ */
+Kf8Text kf8Text(const QByteArray &html, const QList<Chapter> &chapters)
+{
+    Kf8Text text;
+    QByteArray partsFlow;
+    for (int i = 0; i < chapters.size(); i++) {
+        const QByteArray body = html.mid(chapters[i].position, chapters[i].length);
+        const QByteArray skeleton = "<html><head><title>" + chapters[i].title + "</title></head><body aid=\"" + QByteArray::number(i) + "\"></body></html>";
+        const QList<QByteArray> fragments{body.left(body.size() / 2), body.mid(body.size() / 2)};
+
+        const qint64 position = partsFlow.size();
+        text.skeletons.append({"SKEL" + QByteArray::number(i).rightJustified(10, '0'), //
+                               {{quint32(fragments.size())}, {quint32(position), quint32(skeleton.size())}}});
+        partsFlow += skeleton;
+        // Insert positions are in the partially assembled part
+        qint64 insert = skeleton.indexOf("</body>");
+        for (int j = 0; j < fragments.size(); j++) {
+            text.fragments.append({QByteArray::number(position + insert).rightJustified(10, '0'),
+                                   {{quint32(i)}, {quint32(j)}, {quint32(partsFlow.size()), quint32(fragments[j].size())}}});
+            partsFlow += fragments[j];
+            insert += fragments[j].size();
+        }
+        text.parts.append(QByteArray(skeleton).insert(skeleton.indexOf("</body>"), fragments[0] + fragments[1]));
+    }
+    text.flows = {partsFlow, "p { text-indent: 1em; margin: 0 }\nh2 { text-align: center }\n"};
+    text.stored = text.flows[0] + text.flows[1];
+    return text;
+}
+
+// Record indices in the header, NoIndex if absent
+struct HeaderFields {
+    quint32 firstImage = NoIndex;
+    quint32 huffRecord = NoIndex;
+    quint32 lastContent = 0;
+    quint32 ncxRecord = NoIndex;
+    // Of the KF8 book in a combination file
+    quint32 kf8Header = NoIndex;
+    // KF8 books only
+    quint32 fdstRecord = NoIndex;
+    quint32 flowCount = 0;
+    quint32 skeletonRecord = NoIndex;
+    quint32 fragmentRecord = NoIndex;
+};
+
+QByteArray headerRecord(const Options &options, qint64 textLength, quint16 textRecordCount, const HeaderFields &fields)
+{
+    const QByteArray title = "The Big Brown Bear";
+
+    // KF8 headers are longer, holding the FDST, SKEL and FRAG indices
+    const quint32 headerLength = options.kf8 ? 264 : 232;
+    const quint32 version = options.kf8 ? 8 : 6;
+    QByteArray rec(16 + headerLength, '\0');
+    char *d = rec.data();
+    // PalmDOC header
+    qToBigEndian<quint16>(quint16(options.compression == Compression::Huffdic ? 0x4448 : int(options.compression)), d);
+    qToBigEndian<quint32>(textLength, d + 4);
+    qToBigEndian<quint16>(textRecordCount, d + 8);
+    qToBigEndian<quint16>(RecordSize, d + 10);
+
+    // MOBI header
+    memcpy(d + 16, "MOBI", 4);
+    qToBigEndian<quint32>(headerLength, d + 20);
+    qToBigEndian<quint32>(2, d + 24); // book
+    qToBigEndian<quint32>(65001, d + 28); // UTF-8
+    qToBigEndian<quint32>(options.seed, d + 32);
+    qToBigEndian<quint32>(version, d + 36);
+    for (int offset = 40; offset < 80; offset += 4) {
+        qToBigEndian<quint32>(NoIndex, d + offset);
+    }
+    qToBigEndian<quint32>(textRecordCount + 1, d + 80); // first non book record
+    qToBigEndian<quint32>(9, d + 92); // locale
+    qToBigEndian<quint32>(version, d + 104); // min version
+    qToBigEndian<quint32>(fields.firstImage, d + 108);
+    qToBigEndian<quint32>(fields.huffRecord, d + 112);
+    qToBigEndian<quint32>(fields.huffRecord == NoIndex ? 0 : 2, d + 116);
+    qToBigEndian<quint32>(options.exth ? 0x50 : 0, d + 128);
+    if (options.kf8) {
+        qToBigEndian<quint32>(fields.fdstRecord, d + 192);
+        qToBigEndian<quint32>(fields.flowCount, d + 196);
+    } else {
+        qToBigEndian<quint16>(1, d + 192); // first content record
+        qToBigEndian<quint16>(fields.lastContent, d + 194);
+    }
+    qToBigEndian<quint32>(fields.ncxRecord, d + 244); // NCX index
+    if (options.kf8) {
+        qToBigEndian<quint32>(fields.fragmentRecord, d + 248);
+        qToBigEndian<quint32>(fields.skeletonRecord, d + 252);
+        qToBigEndian<quint32>(NoIndex, d + 256); // DATP
+        qToBigEndian<quint32>(NoIndex, d + 260); // guide
+    }
+
+    if (options.exth) {
+        QByteArray records;
+        appendExthRecord(records, 100, "Happy Man");
+        appendExthRecord(records, 103, "Synthetic book " + describe(options).toUtf8());
+        appendExthRecord(records, 105, "Benchmark");
+        appendExthRecord(records, 109, "License");
+        int count = 4;
+        if (options.imageCount > 0) {
+            appendExthRecord(records, 201, bigEndian32(0));
+            appendExthRecord(records, 202, bigEndian32(options.imageCount - 1));
+            count += 2;
+        }
+        if (fields.kf8Header != NoIndex) {
+            appendExthRecord(records, 121, bigEndian32(fields.kf8Header));
+            count++;
+        }
+        QByteArray exth = "EXTH" + bigEndian32(12 + records.size()) + bigEndian32(count) + records;
+        exth.append((4 - exth.size() % 4) % 4, '\0');
+        rec += exth;
+    }
+
+    // Appending the EXTH header may have moved the data
+    qToBigEndian<quint32>(rec.size(), rec.data() + 84);
+    qToBigEndian<quint32>(title.size(), rec.data() + 88);
+    rec += title;
+    rec.append(2 + (4 - rec.size() % 4) % 4, '\0');
+    return rec;
+}
+
+QByteArray pdbFile(const QList<QByteArray> &records)
+{
+    QByteArray file(0x4e, '\0');
+    const QByteArray name = "Synthetic_Book";
+    memcpy(file.data(), name.constData(), name.size());
+    memcpy(file.data() + 0x3c, "BOOKMOBI", 8);
+    qToBigEndian<quint16>(records.size(), file.data() + 0x4c);
+
+    quint32 offset = 0x4e + 8 * records.size() + 2;
+    QByteArray table(8 * records.size(), '\0');
+    for (int i = 0; i < records.size(); i++) {
+        qToBigEndian<quint32>(offset, table.data() + 8 * i);
+        qToBigEndian<quint32>(2 * i, table.data() + 8 * i + 4);
+        offset += records[i].size();
+    }
+    file += table;
+    file.append(2, '\0');
+
+    file.reserve(offset);
+    for (const auto &record : records) {
+        file += record;
+    }
+    return file;
+}
+} // namespace
+
+QByteArray generateText(const Options &options)
+{
+    return htmlText(options);
+}
+
+QList<QByteArray> textRecords(QByteArrayView text, Compression compression, int shortRecord)
+{
+    QList<QByteArray> records;
+    records.reserve(text.size() / RecordSize + 2);
+
+    const HuffdicEncoder huffdic;
+    for (qsizetype offset = 0, size = 0; offset < text.size(); offset += size) {
+        size = std::min(records.size() == shortRecord ? RecordSize / 2 : RecordSize, text.size() - offset);
+        const auto chunk = text.sliced(offset, size);
+        switch (compression) {
+        case Compression::None:
+            records.append(chunk.toByteArray());
+            break;
+        case Compression::PalmDoc:
+            records.append(palmDocCompress(chunk));
+            break;
+        case Compression::Huffdic:
+            records.append(huffdic.compress(chunk));
+            break;
+        }
+    }
+    return records;
+}
+
+QList<QByteArray> huffdicTables()
+{
+    const HuffdicEncoder huffdic;
+    return {huffdic.huffRecord(), huffdic.cdicRecord()};
+}
+
+namespace
+{
+// Records of a single book, without the EOF record
+QList<QByteArray> bookRecords(const Options &options, Book &book)
+{
+    const QByteArray html = htmlText(options, &book.chapters);
+    Kf8Text kf8;
+    if (options.kf8) {
+        kf8 = kf8Text(html, book.chapters);
+        book.text = kf8.stored;
+        book.flows = kf8.flows;
+        book.parts = kf8.parts;
+    } else {
+        book.text = html;
+    }
+
+    QList<QByteArray> records;
+    records.append(QByteArray()); // header, filled in below
+    records += textRecords(book.text, options.compression, options.shortRecord);
+    const quint16 textRecordCount = records.size() - 1;
+
+    HeaderFields fields;
+    for (int i = 0; i < options.imageCount; i++) {
+        if (i == 0) {
+            fields.firstImage = records.size();
+        }
+        records.append(generateImage(i, options.imageCount, options.seed));
+    }
+    fields.lastContent = records.size() - 1;
+
+    if (options.compression == Compression::Huffdic) {
+        fields.huffRecord = records.size();
+        records += huffdicTables();
+    }
+
+    // NCX positions are in the HTML text, i.e. not meaningful for KF8 books
+    if (options.ncx) {
+        fields.ncxRecord = records.size();
+        records += ncxRecords(book.chapters);
+    }
+
+    if (options.kf8) {
+        fields.skeletonRecord = records.size();
+        records += indexRecords({{1, 1}, {6, 2}}, kf8.skeletons, 0);
+        fields.fragmentRecord = records.size();
+        records += indexRecords({{3, 1}, {4, 1}, {6, 2}}, kf8.fragments, 0);
+
+        QByteArray fdst = "FDST" + bigEndian32(12) + bigEndian32(kf8.flows.size());
+        quint32 start = 0;
+        for (const auto &flow : std::as_const(kf8.flows)) {
+            fdst += bigEndian32(start) + bigEndian32(start + flow.size());
+            start += flow.size();
+        }
+        fields.fdstRecord = records.size();
+        fields.flowCount = kf8.flows.size();
+        records.append(fdst);
+    }
+
+    QByteArray flis("FLIS\0\0\0\x08\0\x41\0\0\0\0\0\0\xff\xff\xff\xff\0\x01\0\x03\0\0\0\x03\0\0\0\x01\xff\xff\xff\xff", 36);
+    records.append(flis);
+    QByteArray fcis("FCIS\0\0\0\x14\0\0\0\x10\0\0\0\x01\0\0\0\0", 20);
+    fcis += bigEndian32(book.text.size());
+    fcis.append(QByteArray("\0\0\0\0\0\0\0\x20\0\0\0\x08\0\x01\0\x01\0\0\0\0", 20));
+    records.append(fcis);
+
+    if (options.combination) {
+        // The KF8 book follows the BOUNDARY record
+        fields.kf8Header = records.size() + 1;
+    }
+    records[0] = headerRecord(options, book.text.size(), textRecordCount, fields);
+    return records;
+}
+}
+
+Book generate(const Options &options)
+{
+    Book book;
+    QList<QByteArray> records = bookRecords(options, book);
+
+    if (options.combination) {
+        // Indices in the KF8 header are relative to it, images are only in the MOBI 7 book
+        Options kf8 = options;
+        kf8.seed = options.seed + 1;
+        kf8.imageCount = 0;
+        kf8.ncx = false;
+        kf8.kf8 = true;
+        kf8.combination = false;
+        Book kf8Book;
+        records.append(QByteArray("BOUNDARY", 8));
+        records += bookRecords(kf8, kf8Book);
+        book.kf8Text = kf8Book.text;
+    }
+    records.append(QByteArray("\xe9\x8e\x0d\x0a", 4));
+
+    book.data = pdbFile(records);
+    return book;
+}
+
+QString describe(const Options &options)
+{
+    const char *codec = options.compression == Compression::None ? "noop" : options.compression == Compression::PalmDoc ? "palmdoc" : "huffdic";
+    const QString size = options.textSize >= 1024 * 1024 ? QStringLiteral("%1MB").arg(options.textSize / (1024 * 1024))
+                                                         : QStringLiteral("%1KB").arg(options.textSize / 1024);
+    return QStringLiteral("%1-%2-%3img-%4").arg(QLatin1String(codec), size).arg(options.imageCount).arg(options.exth ? QLatin1String("exth") : QLatin1String("noexth"));
+}
+}
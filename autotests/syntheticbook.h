@@ -0,0 +1,77 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE contributors
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#ifndef MOBIPOCKET_SYNTHETICBOOK_H
+#define MOBIPOCKET_SYNTHETICBOOK_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+
+/**
+ * Generator for synthetic, but structurally realistic Mobipocket books,
+ * for tests and benchmarks.
+ */
+namespace SyntheticBook
+{
+enum class Compression {
+    None = 1,
+    PalmDoc = 2,
+    Huffdic = 'H',
+};
+
+struct Options {
+    Compression compression = Compression::PalmDoc;
+    // Approximate size of the uncompressed HTML text
+    qint64 textSize = 100 * 1024;
+    int imageCount = 0;
+    bool exth = true;
+    quint32 seed = 1;
+    // Add an NCX index (table of contents) with one entry per chapter,
+    // stored in a single INDX record, i.e. for up to a few thousand chapters
+    bool ncx = false;
+    // Store the text as KF8 book, with one part per chapter
+    bool kf8 = false;
+    // Append a KF8 book with a different text after a BOUNDARY record, i.e. a
+    // combination file
+    bool combination = false;
+    // Store this text record (counted from 0) with half the usual size, as
+    // some encoders do, -1 for none
+    int shortRecord = -1;
+};
+
+struct Chapter {
+    QByteArray title;
+    // Byte range in the uncompressed text
+    qint64 position = 0;
+    qint64 length = 0;
+};
+
+struct Book {
+    // Complete PDB file
+    QByteArray data;
+    // Uncompressed HTML text, for KF8 books as stored, i.e. all flows
+    QByteArray text;
+    // Positions in the HTML text, which is not stored as such for KF8 books
+    QList<Chapter> chapters;
+    // KF8 books only, the flows of the text and the assembled parts
+    QList<QByteArray> flows;
+    QList<QByteArray> parts;
+    // Stored text of the KF8 book, for combination files
+    QByteArray kf8Text;
+};
+
+Book generate(const Options &options);
+
+// Building blocks of generate(), e.g. for codec benchmarks
+QByteArray generateText(const Options &options);
+QList<QByteArray> textRecords(QByteArrayView text, Compression compression, int shortRecord = -1);
+// HUFF and CDIC record for Huffdic compressed text records
+QList<QByteArray> huffdicTables();
+
+QString describe(const Options &options);
+}
+
+#endif
@@ -0,0 +1,148 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "async.h"
+#include "mobipocket.h"
+
+#include <QBuffer>
+#include <QFile>
+#include <QImageReader>
+#include <QPromise>
+#include <QThreadPool>
+
+#include <atomic>
+
+namespace Mobipocket
+{
+namespace Async
+{
+namespace
+{
+// Runs @p work(promise) on @p pool, unless the future is cancelled before it starts
+template<typename T, typename Work>
+QFuture<T> run(QThreadPool *pool, Work &&work)
+{
+    // QThreadPool requires copyable callables, QPromise is move only
+    auto promise = std::make_shared<QPromise<T>>();
+    QFuture<T> future = promise->future();
+    promise->start();
+    (pool ? pool : QThreadPool::globalInstance())->start([promise, work = std::forward<Work>(work)]() {
+        if (!promise->isCanceled()) {
+            work(*promise);
+        }
+        promise->finish();
+    });
+    return future;
+}
+
+template<typename T>
+ExtractionControl controlFor(QPromise<T> &promise)
+{
+    ExtractionControl control;
+    control.progress = [&promise](qint64 done, qint64 total) {
+        promise.setProgressRange(0, int(total));
+        promise.setProgressValue(int(done));
+        return !promise.isCanceled();
+    };
+    return control;
+}
+
+QImage decodeImage(QByteArray data, const QSize &targetSize)
+{
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer);
+    if (targetSize.isValid()) {
+        const QSize size = reader.size();
+        if (size.width() > targetSize.width() || size.height() > targetSize.height()) {
+            reader.setScaledSize(size.scaled(targetSize, Qt::KeepAspectRatio));
+        }
+    }
+    return reader.read();
+}
+}
+
+QFuture<std::shared_ptr<Document>> open(const QString &fileName, QThreadPool *pool)
+{
+    return run<std::shared_ptr<Document>>(pool, [fileName](QPromise<std::shared_ptr<Document>> &promise) {
+        auto file = std::make_unique<QFile>(fileName);
+        if (!file->open(QIODevice::ReadOnly)) {
+            promise.addResult(std::shared_ptr<Document>());
+            return;
+        }
+        auto document = new Document(file.get());
+        // The document does not own its device, tie their lifetimes
+        promise.addResult(std::shared_ptr<Document>(document, [file = file.release()](Document *document) {
+            delete document;
+            delete file;
+        }));
+    });
+}
+
+QFuture<std::shared_ptr<Document>> open(QIODevice *device, QThreadPool *pool)
+{
+    return run<std::shared_ptr<Document>>(pool, [device](QPromise<std::shared_ptr<Document>> &promise) {
+        promise.addResult(std::make_shared<Document>(device));
+    });
+}
+
+QFuture<QString> text(std::shared_ptr<Document> document, int size, QThreadPool *pool)
+{
+    return run<QString>(pool, [document, size](QPromise<QString> &promise) {
+        if (QString text = document->text(controlFor(promise), size); !promise.isCanceled()) {
+            promise.addResult(std::move(text));
+        }
+    });
+}
+
+QFuture<QImage> image(std::shared_ptr<Document> document, int i, QThreadPool *pool)
+{
+    return run<QImage>(pool, [document, i](QPromise<QImage> &promise) {
+        if (QImage image = document->getImage(i, controlFor(promise)); !promise.isCanceled()) {
+            promise.addResult(std::move(image));
+        }
+    });
+}
+
+QFuture<QImage> thumbnail(std::shared_ptr<Document> document, QThreadPool *pool)
+{
+    return run<QImage>(pool, [document](QPromise<QImage> &promise) {
+        if (QImage image = document->thumbnail(controlFor(promise)); !promise.isCanceled()) {
+            promise.addResult(std::move(image));
+        }
+    });
+}
+
+QFuture<QImage> images(std::shared_ptr<Document> document, int first, int count, const QSize &targetSize, QThreadPool *pool)
+{
+    pool = pool ? pool : QThreadPool::globalInstance();
+    // Finished by the last decoding task, not by run()
+    auto promise = std::make_shared<QPromise<QImage>>();
+    QFuture<QImage> future = promise->future();
+    promise->start();
+    pool->start([document, first, count, targetSize, pool, promise]() {
+        // Decoding needs no document lock, only reading the records does
+        const QList<QByteArray> records = promise->isCanceled() ? QList<QByteArray>() : document->imageData(first, count);
+        if (records.isEmpty()) {
+            promise->finish();
+            return;
+        }
+        promise->setProgressRange(0, int(records.size()));
+        auto remaining = std::make_shared<std::atomic<int>>(int(records.size()));
+        for (qsizetype i = 0; i < records.size(); i++) {
+            pool->start([promise, remaining, total = int(records.size()), record = records[i], i, targetSize]() {
+                if (!promise->isCanceled()) {
+                    promise->addResult(decodeImage(record, targetSize), int(i));
+                }
+                const int left = remaining->fetch_sub(1) - 1;
+                promise->setProgressValue(total - left);
+                if (left == 0) {
+                    promise->finish();
+                }
+            });
+        }
+    });
+    return future;
+}
+}
+}
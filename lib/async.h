@@ -0,0 +1,63 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef MOBIPOCKET_ASYNC_H
+#define MOBIPOCKET_ASYNC_H
+
+#include <QFuture>
+#include <QImage>
+#include <QSize>
+#include <QString>
+
+#include <memory>
+
+#include "qmobipocket_export.h"
+
+class QIODevice;
+class QThreadPool;
+
+namespace Mobipocket
+{
+class Document;
+
+/**
+ * Asynchronous variants of the blocking Document API
+ *
+ * Each call runs on @p pool, or on QThreadPool::globalInstance() if it is
+ * null, and returns immediately. Results can be chained with QFuture::then(),
+ * e.g.
+ * @code
+ * Async::open(fileName).then([](std::shared_ptr<Document> doc) {
+ *     return Async::thumbnail(doc);
+ * }).unwrap().then(qApp, [](const QImage &image) { ... });
+ * @endcode
+ *
+ * Calls on the same document are serialized. Cancelling a future abandons
+ * the work at the next record boundary, and text() reports its progress in
+ * records.
+ */
+namespace Async
+{
+/// The result is null if the file can not be opened, check Document::isValid() otherwise
+QMOBIPOCKET_EXPORT QFuture<std::shared_ptr<Document>> open(const QString &fileName, QThreadPool *pool = nullptr);
+/// @p device must outlive the document, and not be used otherwise meanwhile
+QMOBIPOCKET_EXPORT QFuture<std::shared_ptr<Document>> open(QIODevice *device, QThreadPool *pool = nullptr);
+
+QMOBIPOCKET_EXPORT QFuture<QString> text(std::shared_ptr<Document> document, int size = -1, QThreadPool *pool = nullptr);
+QMOBIPOCKET_EXPORT QFuture<QImage> image(std::shared_ptr<Document> document, int i, QThreadPool *pool = nullptr);
+QMOBIPOCKET_EXPORT QFuture<QImage> thumbnail(std::shared_ptr<Document> document, QThreadPool *pool = nullptr);
+/**
+ * Images @p first to @p first + @p count - 1, as Document::getImage(). The
+ * records are read in one call, then decoded concurrently on @p pool. Each
+ * result is added as soon as it is decoded, at its index relative to
+ * @p first, see QFuture::resultAt() and QFutureWatcher::resultReadyAt().
+ * Progress is reported in images.
+ *
+ * If @p targetSize is valid, larger images are decoded scaled down to fit
+ * into it, keeping the aspect ratio. This is cheaper than scaling the full
+ * image, e.g. JPEG images are decoded at reduced resolution.
+ */
+QMOBIPOCKET_EXPORT QFuture<QImage> images(std::shared_ptr<Document> document, int first, int count, const QSize &targetSize = QSize(), QThreadPool *pool = nullptr);
+}
+}
+#endif
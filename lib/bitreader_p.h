@@ -5,59 +5,113 @@
 #include <QByteArray>
 #include <QtEndian>
 
+#include <algorithm>
+#include <cstring>
+
 namespace Mobipocket
 {
+/**
+ * MSB first bit reader
+ *
+ * The next bits are kept MSB aligned in a 64 bit window, so a peek is a
+ * single shift. The window is refilled by one unaligned 64 bit load when
+ * fewer than 32 bits are left in it. For padded input, i.e. when at least
+ * Padding bytes past the end of the data are readable, this load is used up
+ * to the end. Otherwise only the last Padding bytes of the input are fetched
+ * by a bounded copy. Bits past the end of the input always read as zero.
+ */
 class BitReader
 {
 public:
+    static constexpr qsizetype Padding = 8;
+
+    struct Padded {
+    };
+
     BitReader(QByteArrayView d)
-        : len(d.size() * 8)
-        , data(d)
-    {
-    }
-
-    quint32 read()
-    {
-        while (rEndPos - pos < 32) {
-            // r does not hold sufficient data, fetch some more
-            qint64 bytePos = rEndPos / 8;
-
-            if (len - rEndPos >= 32) {
-                r <<= 32;
-                r |= qFromBigEndian<quint32>(data.constData() + bytePos);
-                rEndPos += 32;
-                break;
-            } else if (len - rEndPos > 0) {
-                r <<= 8;
-                quint8 d = data.at(bytePos);
-                r |= d;
-                rEndPos += 8;
-            } else {
-                r <<= 8;
-                rEndPos += 8;
-            }
+        : data(d.constData())
+        , len(d.size() * 8)
+        , padded(false)
+    {
+        refill();
+    }
+
+    /// @p d must be followed by at least Padding readable bytes, of any value
+    BitReader(QByteArrayView d, Padded)
+        : data(d.constData())
+        , len(d.size() * 8)
+        , padded(true)
+    {
+        refill();
+    }
+
+    /// The next 32 bits, MSB aligned
+    quint32 peek() const
+    {
+        return window >> 32;
+    }
+
+    /// The next @p n bits, right aligned, 1 <= n <= 32
+    quint32 peek(int n) const
+    {
+        return peek() >> (32 - n);
+    }
+
+    /// 0 <= n <= 32
+    void consume(int n)
+    {
+        pos += n;
+        window <<= n;
+        if (Q_UNLIKELY(pos > refillPos)) {
+            refill();
         }
+    }
 
-        quint64 t = r << (64 - (rEndPos - pos));
-        return t >> 32;
+    quint32 read() const
+    {
+        return peek();
     }
 
+    /// Consumes @p n bits, returns false if this passes the end of the input
     bool eat(int n)
     {
-        pos += n;
+        consume(n);
         return pos <= len;
     }
 
-    int left()
+    qint64 left() const
     {
         return len - pos;
     }
 
 private:
-    quint64 r = 0;
-    int pos = 0;
-    int len = 0;
-    int rEndPos = 0; //< position past the LSB of r
-    QByteArrayView data;
+    void refill()
+    {
+        const qint64 bytePos = pos >> 3;
+        // Bytes of the input available at bytePos, up to 8
+        const qint64 n = std::clamp<qint64>(len / 8 - bytePos, 0, 8);
+        quint64 w = 0;
+        if (n == 8) {
+            w = qFromBigEndian<quint64>(data + bytePos);
+        } else if (padded && n > 0) {
+            // Clear the padding bytes
+            w = qFromBigEndian<quint64>(data + bytePos) & (~quint64(0) << (64 - 8 * n));
+        } else if (n > 0) {
+            uchar buf[8] = {};
+            std::memcpy(buf, data + bytePos, n);
+            w = qFromBigEndian<quint64>(buf);
+        }
+        window = w << (pos & 7);
+        // At least 57 bits were loaded, refill before fewer than 32 are left
+        refillPos = bytePos * 8 + 32;
+    }
+
+    const char *data;
+    qint64 pos = 0;
+    qint64 len = 0;
+    quint64 window = 0;
+    // Largest position for which the window holds the next 32 bits
+    qint64 refillPos = 0;
+    bool padded;
 };
 } // namespace Mobipocket
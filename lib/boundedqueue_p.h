@@ -0,0 +1,83 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef MOBIPOCKET_BOUNDEDQUEUE_P_H
+#define MOBIPOCKET_BOUNDEDQUEUE_P_H
+
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <algorithm>
+#include <deque>
+#include <optional>
+
+namespace Mobipocket
+{
+/**
+ * A queue between two threads, holding at most @p capacity items. A full
+ * queue blocks the producer, an empty one the consumer.
+ *
+ * close() ends the queue from either side: the producer when done, the
+ * consumer to abandon it. Items queued before remain available to pop().
+ */
+template<typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(qsizetype capacity)
+        : capacity(std::max<qsizetype>(capacity, 1))
+    {
+    }
+
+    /// Waits for space, returns false if the queue is closed
+    bool push(T item)
+    {
+        QMutexLocker locker(&mutex);
+        while (!closed && qsizetype(items.size()) >= capacity) {
+            notFull.wait(&mutex);
+        }
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        notEmpty.wakeOne();
+        return true;
+    }
+
+    /// Waits for an item, empty if the queue is closed and drained
+    std::optional<T> pop()
+    {
+        QMutexLocker locker(&mutex);
+        while (!closed && items.empty()) {
+            notEmpty.wait(&mutex);
+        }
+        if (items.empty()) {
+            return std::nullopt;
+        }
+        T item = std::move(items.front());
+        items.pop_front();
+        notFull.wakeOne();
+        return item;
+    }
+
+    void close()
+    {
+        QMutexLocker locker(&mutex);
+        closed = true;
+        notFull.wakeAll();
+        notEmpty.wakeAll();
+    }
+
+    Q_DISABLE_COPY(BoundedQueue);
+
+private:
+    const qsizetype capacity;
+    QMutex mutex;
+    QWaitCondition notFull;
+    QWaitCondition notEmpty;
+    std::deque<T> items;
+    bool closed = false;
+};
+}
+
+#endif
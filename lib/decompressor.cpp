@@ -11,7 +11,8 @@
 #include <QVector>
 #include <QtEndian>
 
-#include <vector>
+#include <algorithm>
+#include <cstring>
 
 // clang-format off
 static const unsigned char TOKEN_CODE[256] = {
@@ -44,9 +45,13 @@ public:
     {
         valid = true;
     }
-    QByteArray decompress(const QByteArray &data) override
+    void decompress(QByteArrayView data, QByteArray &out) override
     {
-        return data;
+        if (data.size() > limits.maxOutput) {
+            valid = false;
+            return;
+        }
+        out.append(data);
     }
 };
 
@@ -57,7 +62,7 @@ public:
     {
         valid = true;
     }
-    QByteArray decompress(const QByteArray &data) override;
+    void decompress(QByteArrayView data, QByteArray &out) override;
 };
 
 class HuffdicDecompressor : public Decompressor
@@ -66,71 +71,84 @@ public:
     HuffdicDecompressor() = delete;
     HuffdicDecompressor(const HuffdicDecompressor &) = delete;
     HuffdicDecompressor(const QVector<QByteArray> &huffData);
-    QByteArray decompress(const QByteArray &data) override;
+    void decompress(QByteArrayView data, QByteArray &out) override;
+    qint64 memoryUsage() const override;
 
 private:
-    bool unpack(std::vector<char> &buf, BitReader reader, int depth) const;
-    const QVector<QByteArray> dicts;
+    bool unpack(QByteArray &buf, qsizetype base, BitReader reader, int depth, Stats &work) const;
+    // CDIC records, each followed by BitReader::Padding bytes
+    QVector<QByteArray> dicts;
     quint32 entry_bits;
     quint32 dict1[256];
     quint32 dict2[64];
 };
 
-QByteArray RLEDecompressor::decompress(const QByteArray &data)
+void RLEDecompressor::decompress(QByteArrayView data, QByteArray &out)
 {
-    QByteArray ret;
-    ret.reserve(8192);
+    const qsizetype base = out.size();
+    // Every input byte expands to at most 5 output bytes (case 3: 2 bytes -> 10),
+    // so the output can be written without further bounds checks
+    out.resize(base + data.size() * 5);
+    char *const begin = out.data() + base;
+    char *dst = begin;
 
-    int i = 0;
-    int maxIndex = data.size() - 1;
+    qsizetype i = 0;
+    const qsizetype maxIndex = data.size() - 1;
 
     while (i < data.size()) {
         unsigned char token = data.at(i++);
         switch (TOKEN_CODE[token]) {
         case 0:
-            ret.append(token);
+            *dst++ = token;
             break;
         case 1:
             if ((i + token > maxIndex + 1)) {
-                return ret;
+                i = data.size();
+                break;
             }
-            ret.append(data.mid(i, token));
+            memcpy(dst, data.constData() + i, token);
+            dst += token;
             i += token;
             break;
         case 2:
-            ret.append(' ');
-            ret.append(token ^ 0x80);
+            *dst++ = ' ';
+            *dst++ = token ^ 0x80;
             break;
         case 3:
             {
                 if (i > maxIndex) {
-                    return ret;
+                    i = data.size();
+                    break;
                 }
                 quint16 N = token << 8;
                 N += (unsigned char)data.at(i++);
                 quint16 copyLength = (N & 7) + 3;
                 quint16 shift = (N & 0x3fff) / 8;
-                if ((shift < 1) || (shift > ret.size())) {
-                    return ret;
+                if ((shift < 1) || (shift > dst - begin)) {
+                    i = data.size();
+                    break;
                 }
-                auto shifted = ret.size() - shift;
-                for (auto j = shifted; j < shifted + copyLength; j++) {
-                    ret.append(ret.at(j));
+                // may overlap, copy byte by byte
+                const char *src = dst - shift;
+                for (int j = 0; j < copyLength; j++) {
+                    *dst++ = *src++;
                 }
             }
             break;
         }
     }
-    return ret;
+    out.resize(base + (dst - begin));
+    if (dst - begin > limits.maxOutput) {
+        valid = false;
+    }
 }
 
 HuffdicDecompressor::HuffdicDecompressor(const QVector<QByteArray> &huffData)
-    : dicts(huffData.mid(1))
 {
-    if (dicts.empty())
+    if (huffData.size() < 2)
         return;
 
-    if ((dicts[0].size() < 18) || !dicts[0].startsWith("CDIC"))
+    if ((huffData[1].size() < 18) || !huffData[1].startsWith("CDIC"))
         return;
 
     const QByteArray &huff1 = huffData[0];
@@ -145,39 +163,60 @@ HuffdicDecompressor::HuffdicDecompressor(const QVector<QByteArray> &huffData)
     memcpy(dict1, huff1.data() + off1, 256 * 4);
     memcpy(dict2, huff1.data() + off2, 64 * 4);
 
-    entry_bits = qFromBigEndian<quint32>(dicts[0].constData() + 12);
+    entry_bits = qFromBigEndian<quint32>(huffData[1].constData() + 12);
     if (entry_bits > 32)
         return;
 
+    // Padding allows unconditional 64 bit loads when reading from dictionary entries
+    dicts.reserve(huffData.size() - 1);
+    for (auto it = huffData.begin() + 1; it != huffData.end(); ++it) {
+        QByteArray dict = *it;
+        dict.append(BitReader::Padding, '\0');
+        dicts.append(dict);
+    }
+
     valid = true;
 }
 
-QByteArray HuffdicDecompressor::decompress(const QByteArray &data)
+qint64 HuffdicDecompressor::memoryUsage() const
+{
+    qint64 bytes = sizeof(dict1) + sizeof(dict2);
+    for (const auto &dict : dicts) {
+        bytes += dict.capacity();
+    }
+    return bytes;
+}
+
+void HuffdicDecompressor::decompress(QByteArrayView data, QByteArray &out)
 {
-    std::vector<char> buf;
-    buf.reserve(4096);
-    if (!unpack(buf, BitReader(data), 0)) {
+    stats = {};
+    // Padded, so reads up to the end of the record use the same 64 bit load
+    QByteArray padded;
+    padded.reserve(data.size() + BitReader::Padding);
+    padded.append(data);
+    padded.append(BitReader::Padding, '\0');
+    if (!unpack(out, out.size(), BitReader(QByteArrayView(padded).chopped(BitReader::Padding), BitReader::Padded()), 0, stats)) {
         valid = false;
     }
-    return QByteArray(buf.data(), buf.size());
 }
 
-bool HuffdicDecompressor::unpack(std::vector<char> &buf, BitReader reader, int depth) const
+bool HuffdicDecompressor::unpack(QByteArray &buf, qsizetype base, BitReader reader, int depth, Stats &work) const
 {
-    // These two checks are fairly arbitrary, due to lack of an actual specification
-    // Both exceed typical real world files by far, but are useful to protect against
-    // 'ZIP bomb' style attacks
-    if (depth > 32) {
+    // Lacking an actual specification, the default limits exceed typical real
+    // world files by far, but are useful to protect against 'ZIP bomb' style attacks
+    if (quint32(depth) > limits.maxDepth) {
         return false;
-    } else if (buf.size() > 16 * 1024 * 1024) {
+    } else if (buf.size() - base > limits.maxOutput) {
         return false;
     }
 
+    work.maxDepth = std::max<quint32>(work.maxDepth, depth);
+
     auto dict_count = dicts.size();
     quint32 entry_mask = (quint64(1) << entry_bits) - 1;
 
-    while (reader.left()) {
-        quint32 dw = reader.read();
+    while (reader.left() > 0) {
+        quint32 dw = reader.peek();
         quint32 v = dict1[dw >> 24];
         quint8 codelen = v & 0x1F;
         if (!codelen)
@@ -194,11 +233,14 @@ bool HuffdicDecompressor::unpack(std::vector<char> &buf, BitReader reader, int d
         r -= code;
         if (!reader.eat(codelen))
             return true;
+        if (++work.symbols > limits.maxSymbols) {
+            return false;
+        }
         quint32 dict_no = quint64(r) >> entry_bits;
         if (dict_no >= dict_count) {
             return false;
         }
-        QByteArrayView dict = dicts.at(dict_no);
+        QByteArrayView dict = QByteArrayView(dicts.at(dict_no)).chopped(BitReader::Padding);
         auto dict_size = dict.size();
 
         quint32 off1 = 16 + (r & entry_mask) * 2;
@@ -218,9 +260,12 @@ bool HuffdicDecompressor::unpack(std::vector<char> &buf, BitReader reader, int d
 
         auto slice = dict.mid(off2 + 2, (blen & 0x7fff));
         if (blen & 0x8000) {
-            buf.insert(buf.end(), slice.begin(), slice.end());
+            buf.append(slice);
+            if (buf.size() - base > limits.maxOutput) {
+                return false;
+            }
         } else {
-            if (!unpack(buf, BitReader(slice), depth + 1)) {
+            if (!unpack(buf, base, BitReader(slice, BitReader::Padded()), depth + 1, work)) {
                 return false;
             }
         }
@@ -228,17 +273,23 @@ bool HuffdicDecompressor::unpack(std::vector<char> &buf, BitReader reader, int d
     return true;
 }
 
-std::unique_ptr<Decompressor> Decompressor::create(quint8 type, const QVector<QByteArray> &auxData)
+std::unique_ptr<Decompressor> Decompressor::create(quint8 type, const QVector<QByteArray> &auxData, const Limits &limits)
 {
+    std::unique_ptr<Decompressor> decompressor;
     switch (type) {
     case 1:
-        return std::make_unique<NOOPDecompressor>();
+        decompressor = std::make_unique<NOOPDecompressor>();
+        break;
     case 2:
-        return std::make_unique<RLEDecompressor>();
+        decompressor = std::make_unique<RLEDecompressor>();
+        break;
     case 'H':
-        return std::make_unique<HuffdicDecompressor>(auxData);
+        decompressor = std::make_unique<HuffdicDecompressor>(auxData);
+        break;
     default:
         return nullptr;
     }
+    decompressor->limits = limits;
+    return decompressor;
 }
 }
@@ -5,6 +5,7 @@
 #define MOBI_DECOMPRESSOR_H
 
 #include <QByteArray>
+#include <QByteArrayView>
 #include <memory>
 namespace Mobipocket
 {
@@ -14,16 +15,51 @@ class Decompressor
 public:
     Decompressor() = default;
     virtual ~Decompressor() = default;
-    virtual QByteArray decompress(const QByteArray &data) = 0;
+    QByteArray decompress(const QByteArray &data)
+    {
+        QByteArray out;
+        decompress(data, out);
+        return out;
+    }
+    /// Appends the decompressed @p data to @p out, allows callers to reuse or preallocate the output
+    virtual void decompress(QByteArrayView data, QByteArray &out) = 0;
     bool isValid() const
     {
         return valid;
     }
+    /// Bytes held for tables, e.g. Huffdic dictionaries
+    virtual qint64 memoryUsage() const
+    {
+        return 0;
+    }
+
+    /// Work done by the most recent decompress() call
+    struct Stats {
+        quint64 symbols = 0;
+        quint32 maxDepth = 0;
+    };
+    const Stats &lastStats() const
+    {
+        return stats;
+    }
+
+    /// Bounds against pathological input, exceeding one fails the decompression
+    struct Limits {
+        /// Output of a single decompress() call
+        qint64 maxOutput = 16 * 1024 * 1024;
+        /// Nesting of Huffdic dictionary entries
+        quint32 maxDepth = 32;
+        /// Huffdic symbols of a single decompress() call, including nested ones.
+        /// Entries may expand to nothing, so this is not bound by maxOutput.
+        quint64 maxSymbols = 16 * 1024 * 1024;
+    };
 
-    static std::unique_ptr<Decompressor> create(quint8 type, const QVector<QByteArray> &auxData);
+    static std::unique_ptr<Decompressor> create(quint8 type, const QVector<QByteArray> &auxData, const Limits &limits = {});
 
 protected:
     bool valid = false;
+    Stats stats;
+    Limits limits;
 };
 }
 #endif
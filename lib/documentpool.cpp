@@ -0,0 +1,154 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "documentpool.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+
+#include <atomic>
+#include <list>
+
+namespace Mobipocket
+{
+struct DocumentPoolPrivate {
+    struct Entry {
+        QString key;
+        std::shared_ptr<Document> document;
+        qint64 cost = 0;
+    };
+
+    mutable QMutex mutex;
+    OpenOptions options;
+    qint64 budget;
+    // Most recently used first
+    std::list<Entry> entries;
+    QHash<QString, std::list<Entry>::iterator> index;
+    qint64 used = 0;
+    qint64 hits = 0;
+    qint64 misses = 0;
+    qint64 evictions = 0;
+    // Shared with the handles, which close their file when the last one is gone
+    std::shared_ptr<std::atomic<int>> openFiles = std::make_shared<std::atomic<int>>(0);
+
+    std::shared_ptr<Document> open(const QString &fileName) const;
+    void insert(const QString &key, const std::shared_ptr<Document> &document);
+    void evict();
+};
+
+std::shared_ptr<Document> DocumentPoolPrivate::open(const QString &fileName) const
+{
+    auto file = std::make_unique<QFile>(fileName);
+    if (!file->open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    auto document = new Document(file.get(), options);
+    openFiles->fetch_add(1);
+    // The document does not own its device, tie their lifetimes
+    std::shared_ptr<Document> handle(document, [file = file.release(), openFiles = openFiles](Document *document) {
+        delete document;
+        delete file;
+        openFiles->fetch_sub(1);
+    });
+    if (!handle->isValid()) {
+        return {};
+    }
+    return handle;
+}
+
+void DocumentPoolPrivate::insert(const QString &key, const std::shared_ptr<Document> &document)
+{
+    // Measured once, documents grow only little when parsing e.g. the table of contents
+    const qint64 cost = document->memoryUsage().total();
+    entries.push_front({key, document, cost});
+    index.insert(key, entries.begin());
+    used += cost;
+    evict();
+}
+
+void DocumentPoolPrivate::evict()
+{
+    // The most recently used document is kept, even if it exceeds the budget alone
+    while (used > budget && entries.size() > 1) {
+        const Entry &entry = entries.back();
+        used -= entry.cost;
+        index.remove(entry.key);
+        entries.pop_back();
+        evictions++;
+    }
+}
+
+DocumentPool::DocumentPool(qint64 memoryBudget, const OpenOptions &options)
+    : d(std::make_unique<DocumentPoolPrivate>())
+{
+    d->options = options;
+    d->budget = memoryBudget;
+}
+
+DocumentPool::~DocumentPool() = default;
+
+std::shared_ptr<Document> DocumentPool::acquire(const QString &fileName)
+{
+    const QString key = QFileInfo(fileName).absoluteFilePath();
+    {
+        QMutexLocker locker(&d->mutex);
+        if (const auto it = d->index.constFind(key); it != d->index.cend()) {
+            d->hits++;
+            d->entries.splice(d->entries.begin(), d->entries, *it);
+            return d->entries.front().document;
+        }
+        d->misses++;
+    }
+
+    // Opened unlocked, other documents remain available meanwhile
+    auto document = d->open(key);
+    if (!document) {
+        return {};
+    }
+
+    QMutexLocker locker(&d->mutex);
+    // Opened concurrently by another thread, share its document
+    if (const auto it = d->index.constFind(key); it != d->index.cend()) {
+        d->entries.splice(d->entries.begin(), d->entries, *it);
+        return d->entries.front().document;
+    }
+    d->insert(key, document);
+    return document;
+}
+
+void DocumentPool::clear()
+{
+    QMutexLocker locker(&d->mutex);
+    d->entries.clear();
+    d->index.clear();
+    d->used = 0;
+}
+
+qint64 DocumentPool::memoryBudget() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->budget;
+}
+
+void DocumentPool::setMemoryBudget(qint64 bytes)
+{
+    QMutexLocker locker(&d->mutex);
+    d->budget = bytes;
+    d->evict();
+}
+
+DocumentPool::Statistics DocumentPool::statistics() const
+{
+    QMutexLocker locker(&d->mutex);
+    Statistics statistics;
+    statistics.documents = d->entries.size();
+    statistics.openFiles = d->openFiles->load();
+    statistics.memoryUsage = d->used;
+    statistics.hits = d->hits;
+    statistics.misses = d->misses;
+    statistics.evictions = d->evictions;
+    return statistics;
+}
+}
@@ -0,0 +1,65 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef MOBIPOCKET_DOCUMENTPOOL_H
+#define MOBIPOCKET_DOCUMENTPOOL_H
+
+#include <QString>
+
+#include <memory>
+
+#include "mobipocket.h"
+#include "qmobipocket_export.h"
+
+namespace Mobipocket
+{
+struct DocumentPoolPrivate;
+
+/**
+ * Shared, open documents keyed by file name
+ *
+ * Documents are opened on first use, and kept open while the estimated
+ * memory of all pooled documents stays within the budget. Beyond, the least
+ * recently used documents are released. A released document stays valid for
+ * holders of its handle, and is closed with the last handle.
+ *
+ * All methods may be called from multiple threads. Handles can be used from
+ * multiple threads as well, see Document.
+ */
+class QMOBIPOCKET_EXPORT DocumentPool
+{
+public:
+    struct Statistics {
+        /// Documents in the pool
+        int documents = 0;
+        /// Open files, including those of released documents still in use
+        int openFiles = 0;
+        /// Estimated memory of the documents in the pool, see Document::memoryUsage()
+        qint64 memoryUsage = 0;
+        qint64 hits = 0;
+        qint64 misses = 0;
+        qint64 evictions = 0;
+    };
+
+    /// @p options are used for opening all documents
+    explicit DocumentPool(qint64 memoryBudget = 256 * 1024 * 1024, const OpenOptions &options = {});
+    ~DocumentPool();
+
+    /// Null if the file can not be opened or is not a valid document
+    std::shared_ptr<Document> acquire(const QString &fileName);
+    /// Releases all documents
+    void clear();
+
+    qint64 memoryBudget() const;
+    /// Releases documents as needed
+    void setMemoryBudget(qint64 bytes);
+
+    Statistics statistics() const;
+
+    Q_DISABLE_COPY(DocumentPool);
+
+private:
+    std::unique_ptr<DocumentPoolPrivate> d;
+};
+}
+#endif
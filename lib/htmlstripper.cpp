@@ -0,0 +1,268 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "htmlstripper_p.h"
+
+#include <QStringList>
+
+#include <algorithm>
+
+namespace Mobipocket
+{
+namespace
+{
+// Longest tag name which needs to be classified, longer names are truncated
+constexpr int maxTagName = 16;
+// Longest entity which is decoded, e.g. "&#x10ffff;"
+constexpr int maxEntity = 10;
+
+bool isBlockTag(QStringView name)
+{
+    static const QStringList blockTags = {
+        QStringLiteral("address"), QStringLiteral("article"), QStringLiteral("blockquote"), QStringLiteral("br"),
+        QStringLiteral("dd"), QStringLiteral("div"), QStringLiteral("dl"), QStringLiteral("dt"),
+        QStringLiteral("h1"), QStringLiteral("h2"), QStringLiteral("h3"), QStringLiteral("h4"),
+        QStringLiteral("h5"), QStringLiteral("h6"), QStringLiteral("hr"), QStringLiteral("li"),
+        QStringLiteral("mbp:pagebreak"), QStringLiteral("ol"), QStringLiteral("p"), QStringLiteral("pre"),
+        QStringLiteral("section"), QStringLiteral("table"), QStringLiteral("td"), QStringLiteral("tr"),
+        QStringLiteral("ul"),
+    };
+    return blockTags.contains(name);
+}
+
+bool isSkippedTag(QStringView name)
+{
+    return name == QLatin1String("head") || name == QLatin1String("script") || name == QLatin1String("style");
+}
+
+// Returns 0 for unknown entities, @p name excludes '&' and ';'
+char32_t decodeEntity(QStringView name)
+{
+    if (name.startsWith(QLatin1Char('#'))) {
+        bool ok = false;
+        const bool hex = name.size() > 1 && (name[1] == QLatin1Char('x') || name[1] == QLatin1Char('X'));
+        const uint value = name.mid(hex ? 2 : 1).toUInt(&ok, hex ? 16 : 10);
+        return (ok && value && value <= 0x10ffff) ? value : 0;
+    }
+    static const struct {
+        const char *name;
+        char32_t value;
+    } entities[] = {
+        {"amp", '&'},
+        {"lt", '<'},
+        {"gt", '>'},
+        {"quot", '"'},
+        {"apos", '\''},
+        {"nbsp", 0xa0},
+        {"shy", 0xad},
+        {"ndash", 0x2013},
+        {"mdash", 0x2014},
+        {"lsquo", 0x2018},
+        {"rsquo", 0x2019},
+        {"ldquo", 0x201c},
+        {"rdquo", 0x201d},
+        {"hellip", 0x2026},
+    };
+    for (const auto &entity : entities) {
+        if (name == QLatin1String(entity.name)) {
+            return entity.value;
+        }
+    }
+    return 0;
+}
+}
+
+void HtmlStripper::trackOffsets(QList<qint64> *out, SourceEncoding sourceEncoding)
+{
+    offsets = out;
+    encoding = sourceEncoding;
+}
+
+void HtmlStripper::feed(QStringView html, QString &out)
+{
+    for (qsizetype i = 0; i < html.size(); i++) {
+        const QChar c = html[i];
+        // Whether c is processed again in the new state
+        bool again = false;
+        switch (state) {
+        case Text:
+            if (c == QLatin1Char('<')) {
+                state = TagOpen;
+                markupOffset = offset;
+                tagName.clear();
+                tagNameDone = false;
+                closingTag = false;
+                selfClosingTag = false;
+            } else if (c == QLatin1Char('&')) {
+                state = Entity;
+                markupOffset = offset;
+                entity.clear();
+            } else {
+                text(c, out, offset);
+            }
+            break;
+
+        case TagOpen:
+            if (c.isLetter() || c == QLatin1Char('/') || c == QLatin1Char('!') || c == QLatin1Char('?')) {
+                state = Tag;
+            } else {
+                text(QLatin1Char('<'), out, markupOffset);
+                state = Text;
+            }
+            // Processed again, as part of the tag or as text
+            again = true;
+            break;
+
+        case Tag:
+            if (c == QLatin1Char('>')) {
+                endTag();
+                state = Text;
+            } else if (c == QLatin1Char('"') || c == QLatin1Char('\'')) {
+                tagNameDone = true;
+                quote = c;
+                state = TagQuoted;
+            } else if (c == QLatin1Char('/')) {
+                if (tagName.isEmpty() && !tagNameDone) {
+                    closingTag = true;
+                } else {
+                    tagNameDone = true;
+                    selfClosingTag = true;
+                }
+            } else if (c.isSpace()) {
+                tagNameDone = tagNameDone || !tagName.isEmpty();
+            } else if (!tagNameDone) {
+                selfClosingTag = false;
+                if (tagName.size() < maxTagName) {
+                    tagName.append(c.toLower());
+                }
+                if (tagName == QLatin1String("!--")) {
+                    state = Comment;
+                    dashes = 0;
+                }
+            } else {
+                selfClosingTag = false;
+            }
+            break;
+
+        case TagQuoted:
+            if (c == quote) {
+                state = Tag;
+            }
+            break;
+
+        case Comment:
+            if (c == QLatin1Char('>') && dashes >= 2) {
+                state = Text;
+            }
+            dashes = (c == QLatin1Char('-')) ? dashes + 1 : 0;
+            break;
+
+        case Entity:
+            if (c == QLatin1Char(';')) {
+                endEntity(out);
+                state = Text;
+            } else if ((c.isLetterOrNumber() || (c == QLatin1Char('#') && entity.isEmpty())) && entity.size() < maxEntity) {
+                entity.append(c);
+            } else {
+                // Not an entity, keep it verbatim and process c as text
+                literalEntity(out);
+                state = Text;
+                again = true;
+            }
+            break;
+        }
+        if (again) {
+            i--;
+        } else if (offsets) {
+            offset += sourceSize(c);
+        }
+    }
+}
+
+void HtmlStripper::finish(QString &out)
+{
+    if (state == Entity) {
+        literalEntity(out);
+    } else if (state == TagOpen) {
+        text(QLatin1Char('<'), out, markupOffset);
+    }
+    state = Text;
+}
+
+void HtmlStripper::text(QChar c, QString &out, qint64 source)
+{
+    if (skipDepth > 0 || c.isNull()) {
+        return;
+    }
+    if (c.isSpace()) {
+        pendingSpace = hasOutput;
+        return;
+    }
+    if (pendingBreak || pendingSpace) {
+        out.append(pendingBreak ? QLatin1Char('\n') : QLatin1Char(' '));
+        if (offsets) {
+            offsets->append(source);
+        }
+    }
+    pendingBreak = false;
+    pendingSpace = false;
+    hasOutput = true;
+    out.append(c);
+    if (offsets) {
+        offsets->append(source);
+    }
+}
+
+qint64 HtmlStripper::sourceSize(QChar c) const
+{
+    if (encoding == SingleByte || c.unicode() < 0x80) {
+        return 1;
+    }
+    // Surrogates take two bytes each, four for the pair
+    return c.unicode() < 0x800 || c.isSurrogate() ? 2 : 3;
+}
+
+void HtmlStripper::endTag()
+{
+    if (isSkippedTag(tagName)) {
+        if (closingTag) {
+            skipDepth = std::max(skipDepth - 1, 0);
+        } else if (!selfClosingTag) {
+            skipDepth++;
+        }
+    } else if (isBlockTag(tagName)) {
+        pendingBreak = hasOutput;
+        pendingSpace = false;
+    }
+}
+
+void HtmlStripper::literalEntity(QString &out)
+{
+    qint64 source = markupOffset;
+    text(QLatin1Char('&'), out, source++);
+    for (QChar c : std::as_const(entity)) {
+        text(c, out, source);
+        source += sourceSize(c);
+    }
+}
+
+void HtmlStripper::endEntity(QString &out)
+{
+    const char32_t value = decodeEntity(entity);
+    if (!value) {
+        literalEntity(out);
+        text(QLatin1Char(';'), out, offset);
+        return;
+    }
+
+    if (value == 0xa0) {
+        // no-break space, keep it as a word separator
+        text(QLatin1Char(' '), out, markupOffset);
+    } else if (QChar::requiresSurrogates(value)) {
+        text(QChar(QChar::highSurrogate(value)), out, markupOffset);
+        text(QChar(QChar::lowSurrogate(value)), out, markupOffset);
+    } else {
+        text(QChar(char16_t(value)), out, markupOffset);
+    }
+}
+}
@@ -0,0 +1,82 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef MOBIPOCKET_HTMLSTRIPPER_P_H
+#define MOBIPOCKET_HTMLSTRIPPER_P_H
+
+#include <QList>
+#include <QString>
+
+namespace Mobipocket
+{
+/**
+ * Incremental conversion of MOBI HTML to plain text
+ *
+ * Input may be split at arbitrary positions, e.g. at record boundaries.
+ * Markup is removed, entities are decoded and whitespace runs collapse to
+ * a single space. Block level elements, including <mbp:pagebreak/>, end a
+ * paragraph, which is written as a single newline. The content of <head>,
+ * <script> and <style> is dropped. A '<' not starting a tag, as in "a < b",
+ * is kept as text.
+ */
+class HtmlStripper
+{
+public:
+    enum SourceEncoding {
+        SingleByte,
+        Utf8,
+    };
+
+    /**
+     * Also appends the offset in the source text of each character appended
+     * to the output to @p out, counted in bytes of the HTML as stored in
+     * @p sourceEncoding from the start of the input. Characters decoded from
+     * an entity are at its '&', separators at the following character.
+     */
+    void trackOffsets(QList<qint64> *out, SourceEncoding sourceEncoding);
+    /// Appends the plain text of @p html to @p out
+    void feed(QStringView html, QString &out);
+    /// Flushes an incomplete entity at the end of the input
+    void finish(QString &out);
+
+private:
+    enum State {
+        Text,
+        // after '<', which starts a tag only if followed by a letter, '/', '!' or '?'
+        TagOpen,
+        Tag,
+        TagQuoted,
+        Comment,
+        Entity,
+    };
+
+    void text(QChar c, QString &out, qint64 source);
+    qint64 sourceSize(QChar c) const;
+    void endTag();
+    void endEntity(QString &out);
+    void literalEntity(QString &out);
+
+    State state = Text;
+    // lower case tag name, only as far as needed to classify the tag
+    QString tagName;
+    bool tagNameDone = false;
+    bool closingTag = false;
+    bool selfClosingTag = false;
+    QChar quote;
+    // consecutive '-' seen, for the end of comments
+    int dashes = 0;
+    QString entity;
+    // nesting depth of elements whose content is dropped
+    int skipDepth = 0;
+    bool pendingSpace = false;
+    bool pendingBreak = false;
+    bool hasOutput = false;
+
+    QList<qint64> *offsets = nullptr;
+    SourceEncoding encoding = SingleByte;
+    // source offset of the current character, and of the '<' or '&' starting the current markup
+    qint64 offset = 0;
+    qint64 markupOffset = 0;
+};
+}
+#endif
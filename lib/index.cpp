@@ -0,0 +1,204 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// INDX layout based on KindleUnpack
+
+#include "index_p.h"
+#include "pdb_p.h"
+
+#include <QVarLengthArray>
+#include <QtAlgorithms>
+#include <QtEndian>
+
+namespace Mobipocket
+{
+namespace
+{
+constexpr qsizetype indxHeaderSize = 56;
+
+quint32 readBigEndian32(QByteArrayView data, qsizetype offset)
+{
+    return qFromBigEndian<quint32>(data.constData() + offset);
+}
+
+// Variable width integer, most significant group first, the last byte has the high bit set
+bool readForwardVarint(QByteArrayView data, qsizetype &pos, quint32 &value)
+{
+    value = 0;
+    for (int i = 0; i < 5 && pos < data.size(); i++) {
+        const uchar byte = data[pos++];
+        value = (value << 7) | (byte & 0x7f);
+        if (byte & 0x80) {
+            return true;
+        }
+    }
+    return false;
+}
+}
+
+bool Index::read(const PDB &pdb, quint32 first)
+{
+    if (first >= pdb.recordCount()) {
+        return false;
+    }
+    const QByteArray header = pdb.getRecord(first);
+    if (header.size() < indxHeaderSize || !header.startsWith("INDX")) {
+        return false;
+    }
+
+    const quint32 tagxOffset = readBigEndian32(header, 4);
+    const quint32 recordCount = readBigEndian32(header, 24);
+    const quint32 cncxCount = readBigEndian32(header, 52);
+    if (quint64(first) + recordCount + cncxCount >= pdb.recordCount()) {
+        return false;
+    }
+
+    if (tagxOffset > quint32(header.size()) - 12 || QByteArrayView(header).sliced(tagxOffset, 4) != "TAGX") {
+        return false;
+    }
+    const quint32 tagxLength = readBigEndian32(header, tagxOffset + 4);
+    controlByteCount = readBigEndian32(header, tagxOffset + 8);
+    if (tagxLength < 12 || tagxLength > header.size() - tagxOffset || controlByteCount > 8) {
+        return false;
+    }
+    for (qsizetype pos = tagxOffset + 12; pos + 4 <= tagxOffset + tagxLength; pos += 4) {
+        tagTable.append({quint8(header[pos]), quint8(header[pos + 1]), quint8(header[pos + 2]), quint8(header[pos + 3])});
+    }
+
+    for (quint32 i = 0; i < cncxCount; i++) {
+        cncx.append(pdb.getRecord(first + 1 + recordCount + i));
+    }
+    for (quint32 i = 0; i < recordCount; i++) {
+        if (!readRecord(pdb.getRecord(first + 1 + i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Index::readRecord(QByteArrayView data)
+{
+    if (data.size() < indxHeaderSize || !data.startsWith("INDX")) {
+        return false;
+    }
+
+    // IDXT: offsets of the entries, which end at the start of the next entry, or of the IDXT
+    const quint32 idxt = readBigEndian32(data, 20);
+    const quint32 count = readBigEndian32(data, 24);
+    if (idxt > data.size() - 4 || data.sliced(idxt, 4) != "IDXT" || count > (data.size() - idxt - 4) / 2) {
+        return false;
+    }
+
+    for (quint32 i = 0; i < count; i++) {
+        const quint16 start = qFromBigEndian<quint16>(data.constData() + idxt + 4 + 2 * i);
+        const quint32 end = (i + 1 < count) ? qFromBigEndian<quint16>(data.constData() + idxt + 4 + 2 * (i + 1)) : idxt;
+        if (start < indxHeaderSize || start >= end || end > idxt) {
+            return false;
+        }
+        const auto entryData = data.first(end);
+
+        qsizetype pos = start;
+        const quint8 nameLength = entryData[pos++];
+        if (nameLength > entryData.size() - pos) {
+            return false;
+        }
+        IndexEntry entry;
+        entry.name = entryData.sliced(pos, nameLength).toByteArray();
+        if (!readTags(entryData, pos + nameLength, entry)) {
+            return false;
+        }
+        entries.append(entry);
+    }
+    return true;
+}
+
+bool Index::readTags(QByteArrayView data, qsizetype controlStart, IndexEntry &entry) const
+{
+    // Values follow the control bytes
+    qsizetype pos = controlStart + controlByteCount;
+    if (pos > data.size()) {
+        return false;
+    }
+
+    struct TagValues {
+        quint8 tag;
+        // either the number of value groups, or the size of the values in bytes
+        quint32 valueCount;
+        quint32 valueBytes;
+        quint8 valuesPerEntry;
+    };
+    QVarLengthArray<TagValues, 8> present;
+
+    quint32 controlByteIndex = 0;
+    for (const auto &definition : tagTable) {
+        if (definition.endFlag & 0x01) {
+            controlByteIndex++;
+            continue;
+        }
+        if (controlByteIndex >= controlByteCount) {
+            return false;
+        }
+        quint8 mask = definition.mask;
+        quint8 value = quint8(data[controlStart + controlByteIndex]) & mask;
+        if (!value) {
+            continue;
+        }
+        if (value == mask && qPopulationCount(mask) > 1) {
+            // All bits set: the byte size of the values follows
+            quint32 bytes = 0;
+            if (!readForwardVarint(data, pos, bytes)) {
+                return false;
+            }
+            present.append({definition.tag, 0, bytes, definition.valuesPerEntry});
+        } else {
+            while (!(mask & 0x01)) {
+                mask >>= 1;
+                value >>= 1;
+            }
+            present.append({definition.tag, value, 0, definition.valuesPerEntry});
+        }
+    }
+
+    for (const auto &tag : present) {
+        QList<quint32> values;
+        if (tag.valueCount) {
+            // Each value takes at least one byte, reading stops at the end of the entry
+            for (quint32 i = 0; i < tag.valueCount * tag.valuesPerEntry; i++) {
+                quint32 value = 0;
+                if (!readForwardVarint(data, pos, value)) {
+                    return false;
+                }
+                values.append(value);
+            }
+        } else {
+            if (tag.valueBytes > data.size() - pos) {
+                return false;
+            }
+            const qsizetype end = pos + tag.valueBytes;
+            while (pos < end) {
+                quint32 value = 0;
+                if (!readForwardVarint(data.first(end), pos, value)) {
+                    return false;
+                }
+                values.append(value);
+            }
+        }
+        entry.tags.insert(tag.tag, values);
+    }
+    return true;
+}
+
+QByteArray Index::cncxString(quint32 offset) const
+{
+    const quint32 record = offset >> 16;
+    if (record >= quint32(cncx.size())) {
+        return {};
+    }
+    const QByteArray &data = cncx[record];
+    qsizetype pos = offset & 0xffff;
+    quint32 length = 0;
+    if (!readForwardVarint(data, pos, length) || length > data.size() - pos) {
+        return {};
+    }
+    return data.sliced(pos, length);
+}
+}
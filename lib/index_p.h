@@ -0,0 +1,60 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef MOBIPOCKET_INDEX_P_H
+#define MOBIPOCKET_INDEX_P_H
+
+#include <QByteArray>
+#include <QList>
+#include <QMap>
+
+namespace Mobipocket
+{
+class PDB;
+
+struct IndexEntry {
+    QByteArray name;
+    QMap<quint8, QList<quint32>> tags;
+
+    quint32 value(quint8 tag, int i = 0, quint32 defaultValue = 0) const
+    {
+        const auto values = tags.value(tag);
+        return i < values.size() ? values[i] : defaultValue;
+    }
+};
+
+/**
+ * Reader for INDX indices, e.g. the NCX (table of contents)
+ *
+ * An index starts with a header record, holding the TAGX tag table, followed
+ * by the records with the entries and the CNCX string records. Each entry
+ * has a name and a set of tags, encoded as described by the tag table.
+ */
+class Index
+{
+public:
+    /// Reads the index starting at record @p first, returns false if it is malformed
+    bool read(const PDB &pdb, quint32 first);
+
+    QList<IndexEntry> entries;
+
+    /// The string at @p offset in the CNCX records, null if out of bounds
+    QByteArray cncxString(quint32 offset) const;
+
+private:
+    struct TagDefinition {
+        quint8 tag;
+        quint8 valuesPerEntry;
+        quint8 mask;
+        quint8 endFlag;
+    };
+
+    bool readRecord(QByteArrayView data);
+    bool readTags(QByteArrayView data, qsizetype pos, IndexEntry &entry) const;
+
+    QList<TagDefinition> tagTable;
+    quint32 controlByteCount = 0;
+    QList<QByteArray> cncx;
+};
+}
+#endif
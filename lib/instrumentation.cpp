@@ -0,0 +1,226 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "instrumentation_p.h"
+
+#include <QMutex>
+#include <QThread>
+
+#include <algorithm>
+
+namespace Mobipocket
+{
+namespace Instrumentation
+{
+std::atomic_bool enabledFlag = false;
+
+namespace
+{
+AtomicCounters globalStats;
+
+// Immutable, so trace() sees a handler with its own user data
+struct TraceHook {
+    TraceHandler handler;
+    void *userData;
+};
+std::atomic<const TraceHook *> traceHook = nullptr;
+// trace() calls in progress, by the parity of traceEpoch at their start. A
+// replaced hook is freed once the calls started before the replacement are done.
+std::atomic<int> traceCalls[2] = {};
+std::atomic<quint32> traceEpoch = 0;
+// Serializes setTraceHandler()
+QBasicMutex traceHookMutex;
+
+thread_local PhaseScope *currentScope = nullptr;
+
+template<typename T>
+void addRelaxed(std::atomic<T> &counter, T value)
+{
+    // Most deltas only touch one or two fields
+    if (value) {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+}
+}
+
+Counters &Counters::operator+=(const Counters &other)
+{
+    recordsRead += other.recordsRead;
+    bytesRead += other.bytesRead;
+    recordsDecompressed += other.recordsDecompressed;
+    bytesCompressed += other.bytesCompressed;
+    for (int i = 0; i < CodecCount; i++) {
+        bytesDecompressed[i] += other.bytesDecompressed[i];
+    }
+    huffdicSymbols += other.huffdicSymbols;
+    huffdicMaxDepth = std::max(huffdicMaxDepth, other.huffdicMaxDepth);
+    bytesTranscoded += other.bytesTranscoded;
+    imageProbes += other.imageProbes;
+    for (int i = 0; i < PhaseCount; i++) {
+        phaseNsecs[i] += other.phaseNsecs[i];
+    }
+    return *this;
+}
+
+void setEnabled(bool enabled)
+{
+    enabledFlag.store(enabled, std::memory_order_relaxed);
+}
+
+bool isEnabled()
+{
+    return enabled();
+}
+
+void AtomicCounters::add(const Counters &delta)
+{
+    addRelaxed(recordsRead, delta.recordsRead);
+    addRelaxed(bytesRead, delta.bytesRead);
+    addRelaxed(recordsDecompressed, delta.recordsDecompressed);
+    addRelaxed(bytesCompressed, delta.bytesCompressed);
+    for (int i = 0; i < CodecCount; i++) {
+        addRelaxed(bytesDecompressed[i], delta.bytesDecompressed[i]);
+    }
+    addRelaxed(huffdicSymbols, delta.huffdicSymbols);
+    quint32 depth = huffdicMaxDepth.load(std::memory_order_relaxed);
+    while (delta.huffdicMaxDepth > depth && !huffdicMaxDepth.compare_exchange_weak(depth, delta.huffdicMaxDepth, std::memory_order_relaxed)) { }
+    addRelaxed(bytesTranscoded, delta.bytesTranscoded);
+    addRelaxed(imageProbes, delta.imageProbes);
+    for (int i = 0; i < PhaseCount; i++) {
+        addRelaxed(phaseNsecs[i], delta.phaseNsecs[i]);
+    }
+}
+
+Counters AtomicCounters::load() const
+{
+    Counters result;
+    result.recordsRead = recordsRead.load(std::memory_order_relaxed);
+    result.bytesRead = bytesRead.load(std::memory_order_relaxed);
+    result.recordsDecompressed = recordsDecompressed.load(std::memory_order_relaxed);
+    result.bytesCompressed = bytesCompressed.load(std::memory_order_relaxed);
+    for (int i = 0; i < CodecCount; i++) {
+        result.bytesDecompressed[i] = bytesDecompressed[i].load(std::memory_order_relaxed);
+    }
+    result.huffdicSymbols = huffdicSymbols.load(std::memory_order_relaxed);
+    result.huffdicMaxDepth = huffdicMaxDepth.load(std::memory_order_relaxed);
+    result.bytesTranscoded = bytesTranscoded.load(std::memory_order_relaxed);
+    result.imageProbes = imageProbes.load(std::memory_order_relaxed);
+    for (int i = 0; i < PhaseCount; i++) {
+        result.phaseNsecs[i] = phaseNsecs[i].load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+void AtomicCounters::reset()
+{
+    recordsRead.store(0, std::memory_order_relaxed);
+    bytesRead.store(0, std::memory_order_relaxed);
+    recordsDecompressed.store(0, std::memory_order_relaxed);
+    bytesCompressed.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < CodecCount; i++) {
+        bytesDecompressed[i].store(0, std::memory_order_relaxed);
+    }
+    huffdicSymbols.store(0, std::memory_order_relaxed);
+    huffdicMaxDepth.store(0, std::memory_order_relaxed);
+    bytesTranscoded.store(0, std::memory_order_relaxed);
+    imageProbes.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < PhaseCount; i++) {
+        phaseNsecs[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+Counters globalCounters()
+{
+    return globalStats.load();
+}
+
+void resetGlobalCounters()
+{
+    globalStats.reset();
+}
+
+void setTraceHandler(TraceHandler handler, void *userData)
+{
+    const TraceHook *hook = handler ? new TraceHook{handler, userData} : nullptr;
+    QMutexLocker locker(&traceHookMutex);
+    const TraceHook *previous = traceHook.exchange(hook);
+    // Calls starting from now on count in the other slot, and see the new hook
+    const quint32 epoch = traceEpoch.fetch_add(1);
+    while (traceCalls[epoch & 1].load() > 0) {
+        QThread::yieldCurrentThread();
+    }
+    delete previous;
+}
+
+const char *phaseName(Phase phase)
+{
+    static const char *const names[PhaseCount] = {"open", "read", "header", "dictionary", "decompress", "transcode", "imageprobe", "imagedecode"};
+    return (phase >= 0 && phase < PhaseCount) ? names[phase] : "";
+}
+
+void record(AtomicCounters *counters, const Counters &delta)
+{
+    // Lock free, records are read and decompressed in parallel, see PDB::concurrentReads()
+    if (counters) {
+        counters->add(delta);
+    }
+    globalStats.add(delta);
+}
+
+void trace(Phase phase, bool begin)
+{
+    if (!traceHook.load(std::memory_order_relaxed)) {
+        return;
+    }
+    // Counted in the slot of an epoch which did not change meanwhile, so
+    // setTraceHandler() either waits for this call or it sees the new hook
+    quint32 epoch;
+    for (;;) {
+        epoch = traceEpoch.load();
+        traceCalls[epoch & 1]++;
+        if (traceEpoch.load() == epoch) {
+            break;
+        }
+        traceCalls[epoch & 1]--;
+    }
+    if (const TraceHook *hook = traceHook.load()) {
+        hook->handler(phase, begin, hook->userData);
+    }
+    traceCalls[epoch & 1]--;
+}
+
+void PhaseScope::begin()
+{
+    parent = currentScope;
+    if (parent) {
+        parent->pause();
+    }
+    currentScope = this;
+    trace(phase, true);
+    timer.start();
+}
+
+void PhaseScope::end()
+{
+    Counters delta;
+    delta.phaseNsecs[phase] = nsecs + timer.nsecsElapsed();
+    record(counters, delta);
+    trace(phase, false);
+
+    currentScope = parent;
+    if (parent) {
+        parent->resume();
+    }
+}
+
+void PhaseScope::pause()
+{
+    nsecs += timer.nsecsElapsed();
+}
+
+void PhaseScope::resume()
+{
+    timer.start();
+}
+}
+}
@@ -0,0 +1,87 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef MOBIPOCKET_INSTRUMENTATION_H
+#define MOBIPOCKET_INSTRUMENTATION_H
+
+#include <QtGlobal>
+
+#include "qmobipocket_export.h"
+
+namespace Mobipocket
+{
+/**
+ * Performance counters and trace hooks
+ *
+ * Instrumentation is disabled by default. While disabled, no counters are
+ * updated and no trace events are emitted, the only remaining cost is a
+ * relaxed atomic load at each phase boundary.
+ */
+namespace Instrumentation
+{
+enum Phase {
+    OpenPhase, ///< PDB header and record table
+    ReadPhase, ///< Record I/O
+    HeaderPhase, ///< MOBI and EXTH header parsing
+    DictionaryPhase, ///< HUFF/CDIC table loading
+    DecompressPhase, ///< Text record decompression
+    TranscodePhase, ///< Text conversion to UTF-16
+    ImageProbePhase, ///< Search for the first image record
+    ImageDecodePhase, ///< Image decoding
+    PhaseCount
+};
+
+enum Codec {
+    NoCompression,
+    PalmDocCompression,
+    HuffdicCompression,
+    CodecCount
+};
+
+struct QMOBIPOCKET_EXPORT Counters {
+    quint64 recordsRead = 0;
+    quint64 bytesRead = 0;
+    quint64 recordsDecompressed = 0;
+    /// stored (input) bytes of the decompressed records, including trailing entries
+    quint64 bytesCompressed = 0;
+    /// decompressed (output) bytes, per codec
+    quint64 bytesDecompressed[CodecCount] = {};
+    quint64 huffdicSymbols = 0;
+    /// maximum dictionary recursion depth seen, not summed
+    quint32 huffdicMaxDepth = 0;
+    quint64 bytesTranscoded = 0;
+    quint64 imageProbes = 0;
+    /// exclusive wall time per phase, i.e. nested phases are not accounted to their parent
+    quint64 phaseNsecs[PhaseCount] = {};
+
+    Counters &operator+=(const Counters &other);
+};
+
+/**
+ * Called on the thread doing the work, on entry (@p begin true) and exit of each phase.
+ * Phases may nest, e.g. ReadPhase inside DictionaryPhase.
+ */
+using TraceHandler = void (*)(Phase phase, bool begin, void *userData);
+
+QMOBIPOCKET_EXPORT void setEnabled(bool enabled);
+QMOBIPOCKET_EXPORT bool isEnabled();
+
+/// Counters of all documents in this process, since the last reset
+QMOBIPOCKET_EXPORT Counters globalCounters();
+QMOBIPOCKET_EXPORT void resetGlobalCounters();
+
+/**
+ * Install a trace handler, or remove it with @c nullptr. The handler is only
+ * called while instrumentation is enabled.
+ *
+ * May be called at any time from any thread, but not from within a handler.
+ * @p handler and @p userData are replaced together. Returns once calls of the
+ * previous handler on other threads are done, its user data may be released
+ * then.
+ */
+QMOBIPOCKET_EXPORT void setTraceHandler(TraceHandler handler, void *userData = nullptr);
+
+QMOBIPOCKET_EXPORT const char *phaseName(Phase phase);
+}
+}
+#endif
@@ -0,0 +1,101 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef MOBIPOCKET_INSTRUMENTATION_P_H
+#define MOBIPOCKET_INSTRUMENTATION_P_H
+
+#include "instrumentation.h"
+
+#include <QElapsedTimer>
+
+#include <atomic>
+
+namespace Mobipocket
+{
+namespace Instrumentation
+{
+extern std::atomic_bool enabledFlag;
+
+inline bool enabled()
+{
+    return enabledFlag.load(std::memory_order_relaxed);
+}
+
+/**
+ * Counters updated concurrently by the worker threads of a document, or all
+ * documents. Fields are independent relaxed atomics, so load() during updates
+ * may mix counts from before and after a concurrent add().
+ */
+class AtomicCounters
+{
+public:
+    AtomicCounters() = default;
+
+    void add(const Counters &delta);
+    Counters load() const;
+    void reset();
+
+    Q_DISABLE_COPY(AtomicCounters);
+
+private:
+    std::atomic<quint64> recordsRead = 0;
+    std::atomic<quint64> bytesRead = 0;
+    std::atomic<quint64> recordsDecompressed = 0;
+    std::atomic<quint64> bytesCompressed = 0;
+    std::atomic<quint64> bytesDecompressed[CodecCount] = {};
+    std::atomic<quint64> huffdicSymbols = 0;
+    std::atomic<quint32> huffdicMaxDepth = 0;
+    std::atomic<quint64> bytesTranscoded = 0;
+    std::atomic<quint64> imageProbes = 0;
+    std::atomic<quint64> phaseNsecs[PhaseCount] = {};
+};
+
+// Adds delta to the (optional) per document counters and the global counters
+void record(AtomicCounters *counters, const Counters &delta);
+
+void trace(Phase phase, bool begin);
+
+/**
+ * Accounts the wall time of a scope to a phase. Scopes nest per thread,
+ * a nested scope pauses its parent, so phase times do not overlap.
+ *
+ * Costs a single flag check while instrumentation is disabled.
+ */
+class PhaseScope
+{
+public:
+    PhaseScope(AtomicCounters *counters, Phase phase)
+        : counters(counters)
+        , phase(phase)
+        , active(enabled())
+    {
+        if (active) {
+            begin();
+        }
+    }
+
+    ~PhaseScope()
+    {
+        if (active) {
+            end();
+        }
+    }
+
+    Q_DISABLE_COPY(PhaseScope);
+
+private:
+    void begin();
+    void end();
+    void pause();
+    void resume();
+
+    AtomicCounters *const counters;
+    PhaseScope *parent = nullptr;
+    const Phase phase;
+    const bool active;
+    qint64 nsecs = 0;
+    QElapsedTimer timer;
+};
+}
+}
+#endif
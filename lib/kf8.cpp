@@ -0,0 +1,109 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+// FDST, SKEL and FRAG layout based on KindleUnpack
+
+#include "kf8_p.h"
+#include "index_p.h"
+#include "pdb_p.h"
+
+#include <QtEndian>
+
+namespace Mobipocket
+{
+namespace
+{
+constexpr quint32 noIndex = 0xffffffff;
+}
+
+qint64 Kf8Layout::Part::length() const
+{
+    qint64 length = skeletonLength;
+    for (const auto &fragment : fragments) {
+        length += fragment.length;
+    }
+    return length;
+}
+
+bool Kf8Layout::read(const PDB &pdb, quint32 fdst, quint32 skeleton, quint32 fragment, qint64 textLength)
+{
+    flows.clear();
+    parts.clear();
+
+    // FDST: header length, flow count, then start and end of each flow
+    if (fdst != noIndex) {
+        const QByteArray record = pdb.getRecord(fdst);
+        if (record.size() < 12 || !record.startsWith("FDST")) {
+            return false;
+        }
+        const quint32 offset = qFromBigEndian<quint32>(record.constData() + 4);
+        const quint32 count = qFromBigEndian<quint32>(record.constData() + 8);
+        if (offset > quint32(record.size()) || count > (record.size() - offset) / 8) {
+            return false;
+        }
+        for (quint32 i = 0; i < count; i++) {
+            const qint64 start = qFromBigEndian<quint32>(record.constData() + offset + 8 * i);
+            const qint64 end = qFromBigEndian<quint32>(record.constData() + offset + 8 * i + 4);
+            if (start > end || (i > 0 && start < flows.last().end)) {
+                return false;
+            }
+            flows.append({start, end});
+        }
+    }
+    if (flows.isEmpty()) {
+        flows.append({0, textLength});
+    }
+
+    if (skeleton == noIndex || fragment == noIndex) {
+        return true;
+    }
+
+    // SKEL tags: 1 fragment count, 6 position and length
+    // FRAG tags: 3 part number, 4 sequence number, 6 position and length; named by the insert position
+    Index skeletons;
+    Index fragments;
+    if (!skeletons.read(pdb, skeleton) || !fragments.read(pdb, fragment)) {
+        return false;
+    }
+
+    qsizetype next = 0;
+    for (const auto &entry : std::as_const(skeletons.entries)) {
+        Part part;
+        part.position = entry.value(6, 0);
+        part.skeletonLength = entry.value(6, 1);
+        const quint32 count = entry.value(1);
+        if (count > fragments.entries.size() - next) {
+            return false;
+        }
+        for (quint32 i = 0; i < count; i++) {
+            const IndexEntry &fragmentEntry = fragments.entries[next++];
+            bool ok = false;
+            const qint64 insertPosition = fragmentEntry.name.toLongLong(&ok);
+            if (!ok || insertPosition < part.position) {
+                return false;
+            }
+            part.fragments.append({insertPosition - part.position, fragmentEntry.value(6, 1)});
+        }
+        parts.append(part);
+    }
+    return true;
+}
+
+QByteArray Kf8Layout::assemble(const Part &part, QByteArrayView data)
+{
+    if (data.size() != part.length()) {
+        return {};
+    }
+    QByteArray assembled;
+    assembled.reserve(data.size());
+    assembled.append(data.first(part.skeletonLength));
+    qint64 pos = part.skeletonLength;
+    for (const auto &fragment : part.fragments) {
+        if (fragment.insertPosition > assembled.size()) {
+            return {};
+        }
+        assembled.insert(fragment.insertPosition, data.sliced(pos, fragment.length));
+        pos += fragment.length;
+    }
+    return assembled;
+}
+}
@@ -0,0 +1,58 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef MOBIPOCKET_KF8_P_H
+#define MOBIPOCKET_KF8_P_H
+
+#include <QByteArray>
+#include <QList>
+
+namespace Mobipocket
+{
+class PDB;
+
+/**
+ * Layout of the text of a KF8 book
+ *
+ * The uncompressed text is divided into flows by the FDST record. Flow 0
+ * holds the HTML files (parts), the others e.g. CSS or SVG. Each part is
+ * stored as a skeleton, i.e. the markup outside of the content, directly
+ * followed by its fragments, which are inserted into the skeleton. Skeletons
+ * and fragments are described by the SKEL and FRAG indices.
+ */
+struct Kf8Layout {
+    struct Flow {
+        qint64 start = 0;
+        qint64 end = 0;
+    };
+    struct Fragment {
+        /// Relative to the start of the part, in the partially assembled part
+        qint64 insertPosition = 0;
+        qint64 length = 0;
+    };
+    struct Part {
+        /// Start of the skeleton in the uncompressed text
+        qint64 position = 0;
+        qint64 skeletonLength = 0;
+        /// In storage order, directly following the skeleton
+        QList<Fragment> fragments;
+
+        /// Of the skeleton and its fragments
+        qint64 length() const;
+    };
+
+    QList<Flow> flows;
+    QList<Part> parts;
+
+    /**
+     * Reads the FDST record and the SKEL and FRAG indices, returns false if
+     * one is malformed. Without FDST record, the text is a single flow of
+     * @p textLength bytes.
+     */
+    bool read(const PDB &pdb, quint32 fdst, quint32 skeleton, quint32 fragment, qint64 textLength);
+
+    /// @p data holds the Part::length() bytes starting at Part::position, null if malformed
+    static QByteArray assemble(const Part &part, QByteArrayView data);
+};
+}
+#endif
@@ -2,47 +2,158 @@
 // SPDX-License-Identifier: GPL-2.0-or-later
 
 #include "mobipocket.h"
+#include "boundedqueue_p.h"
 #include "decompressor.h"
+#include "htmlstripper_p.h"
+#include "index_p.h"
+#include "instrumentation_p.h"
+#include "kf8_p.h"
+#include "parallel_p.h"
 #include "pdb_p.h"
 #include "qmobipocket_debug.h"
+#include "structure_p.h"
+#include "trailingdata_p.h"
 
 #include <QBuffer>
+#include <QCryptographicHash>
 #include <QIODevice>
 #include <QImageReader>
+#include <QMutex>
 #include <QRegularExpression>
 #include <QStringConverter>
+#include <QThreadPool>
 #include <QtEndian>
 
+#include <algorithm>
+#include <optional>
+#include <vector>
+
 namespace Mobipocket
 {
 
 struct DocumentPrivate {
-    DocumentPrivate(QIODevice *d)
-        : pdb(d)
+    DocumentPrivate(QIODevice *d, const OpenOptions &options)
+        : pdb(d, &counters, options.readTimeout)
+        , options(options)
+    {
+    }
+    DocumentPrivate(const QByteArray &data, const OpenOptions &options)
+        : data(data)
+        , pdb(QByteArrayView(this->data), &counters)
+        , options(options)
+    {
+    }
+    DocumentPrivate(QByteArrayView data, const OpenOptions &options)
+        : pdb(data, &counters)
+        , options(options)
+    {
+    }
+    DocumentPrivate(const RandomAccessReader *reader, const OpenOptions &options)
+        : pdb(reader, &counters)
+        , options(options)
     {
     }
+    // serializes all calls, for use from multiple threads, see Async
+    QMutex mutex;
+    // declared before pdb, which accounts to it from its constructor
+    Instrumentation::AtomicCounters counters;
+    // for Document(const QByteArray &), records are slices of it
+    const QByteArray data;
     PDB pdb;
+    const OpenOptions options;
     std::unique_ptr<Decompressor> dec;
+    // Huffdic dictionaries not read yet, as a structure file made them unnecessary for opening
+    bool dictionariesDeferred = false;
+    Instrumentation::Codec codec = Instrumentation::NoCompression;
     quint16 ntextrecords = 0;
     quint16 maxRecordSize = 0;
+    // uncompressed text length, as declared in the PalmDOC header
+    quint32 textLength = 0;
     bool valid = false;
 
     // number of first record holding image. Usually it is directly after end of text, but not always
     quint16 firstImageRecord = 0;
+    // first resource record as declared in the header, referenced by recindex attributes
+    quint32 firstResourceRecord = 0xffffffff;
+    // last record before FLIS, FCIS and index records, as declared in MOBI 7 headers
+    quint16 lastContentRecord = 0xffff;
+    // calculated on first use
+    int imageRecords = -1;
     QMap<Document::MetaKey, QString> metadata;
     QStringDecoder toUtf16;
+    // text encoding, Windows-1252 otherwise
+    bool utf8 = false;
     bool drm = false;
     quint32 extraflags = 0;
+    // see OpenOptions::Section
+    bool combination = false;
+    OpenOptions::Section section = OpenOptions::Mobi7Section;
 
     // index of Thumbnail image in image list. May be specified in EXTH.
     int thumbnailIndex = -1;
     // index of Cover image in image list. May be specified in EXTH.
     int coverIndex = -1;
 
+    // first record of the NCX index, if any
+    quint32 ncxIndex = 0xffffffff;
+    // parsed on first use
+    std::optional<QList<TocEntry>> toc;
+
+    // KF8 books only, see Kf8Layout
+    bool kf8 = false;
+    quint32 fdstIndex = 0xffffffff;
+    quint32 skeletonIndex = 0xffffffff;
+    quint32 fragmentIndex = 0xffffffff;
+    // parsed on first use, empty if malformed
+    std::optional<Kf8Layout> kf8Layout;
+    // Uncompressed start offset of each text record and the text length, built
+    // on first use or while reading the whole text, or read from the structure file
+    QList<qint64> recordOffsets;
+    // calculated on first use
+    QByteArray fingerprintHash;
+    // see MemoryUsage::peakBuffers
+    qint64 peakBuffers = 0;
+
     void init();
+    void selectSection(QByteArray &mhead);
+    Decompressor::Limits decompressorLimits() const;
+    void readSequential(const QByteArray &mhead);
     void findFirstImage();
+    int imageCount();
+    quint32 resourceStart() const;
+    void loadDictionaries(const QByteArray &mhead);
+    void loadDeferredDictionaries();
+    QByteArray decompressRecord(quint16 i);
+    void decompressRecord(quint16 i, QByteArray &out);
+    void decompress(const QByteArray &record, QByteArray &out);
+    void decompress(Decompressor &decompressor, const QByteArray &record, QByteArray &out);
+    QString transcode(QByteArrayView data);
+    void transcode(QByteArrayView data, QString &out);
+    qint64 expectedTextLength(int size) const;
+    using TextSink = std::function<void(QStringView chunk)>;
+    bool extractText(int size, const ExtractionControl *control, HtmlStripper *stripper, QString &out, const TextSink &sink = {});
+    QString text(int size, const ExtractionControl *control, HtmlStripper *stripper = nullptr);
+    TextStatistics textStatistics(const ExtractionControl *control);
+    QByteArray imageRecord(int i);
+    QByteArray resourceRecord(int i);
+    QImage getImage(int i, const ExtractionControl *control);
+    QImage thumbnail(const ExtractionControl *control);
     void parseEXTH(QByteArrayView data);
     void parseHtmlHead(const QString &data);
+    QList<TocEntry> tableOfContents();
+    bool buildRecordOffsets(const ExtractionControl *control = nullptr);
+    QByteArray rawRange(qint64 position, qint64 length, const ExtractionControl *control);
+    QString textRange(qint64 position, qint64 length, const ExtractionControl *control);
+    const Kf8Layout &layout();
+    QString flow(int i);
+    QString part(int i);
+    ValidationReport validate(const ExtractionControl *control);
+    void validateHeader(const QByteArray &mhead, ValidationReport &report);
+    QByteArray fingerprint();
+    bool applyStructure(const QString &fileName);
+    bool saveStructure(const QString &fileName);
+    QByteArray recordTypes();
+    MemoryUsage memoryUsage() const;
 };
 
 void DocumentPrivate::parseHtmlHead(const QString &data)
@@ -75,6 +186,19 @@ void DocumentPrivate::parseHtmlHead(const QString &data)
 
 namespace
 {
+    bool interrupted(const ExtractionControl *control)
+    {
+        if (!control) {
+            return false;
+        }
+        return (control->cancel && control->cancel->load(std::memory_order_relaxed)) || control->deadline.hasExpired();
+    }
+
+    bool reportProgress(const ExtractionControl *control, qint64 done, qint64 total)
+    {
+        return !control || !control->progress || control->progress(done, total);
+    }
+
     const QVector<QByteArray> getHuffRecords(const PDB &pdb)
     {
         const QByteArray header = pdb.getRecord(0);
@@ -100,6 +224,46 @@ namespace
         }
         return records;
     };
+
+    // Value of the first EXTH record of @p type in record 0, null if there is none
+    QByteArrayView exthValue(QByteArrayView mhead, quint32 type)
+    {
+        const quint32 size = quint32(mhead.size());
+        if (size < 24) {
+            return {};
+        }
+        const quint32 exthoffs = qFromBigEndian<quint32>(mhead.constData() + 20);
+        if (exthoffs > size - 28 || mhead.mid(exthoffs + 16, 4) != "EXTH") {
+            return {};
+        }
+        const quint32 records = qFromBigEndian<quint32>(mhead.constData() + exthoffs + 24);
+        quint32 offset = exthoffs + 28;
+        for (quint32 i = 0; i < records && offset <= size - 8; i++) {
+            const quint32 len = qFromBigEndian<quint32>(mhead.constData() + offset + 4);
+            if (len < 8 || len > size - offset) {
+                break;
+            }
+            if (qFromBigEndian<quint32>(mhead.constData() + offset) == type) {
+                return mhead.sliced(offset + 8, len - 8);
+            }
+            offset += len;
+        }
+        return {};
+    }
+
+    // Records found between or after the images, which are not images
+    bool isNonImageRecord(QByteArrayView record)
+    {
+        static const char *const signatures[] = {"FLIS", "FCIS", "SRCS", "DATP", "RESC", "FDST", "FONT", "AUDI", "VIDE",
+                                                 "CRES", "CONT", "BOUN", "INDX", "HUFF", "CDIC", "kind", "\xe9\x8e\r\n"};
+        if (record.size() < 4) {
+            // placeholder
+            return true;
+        }
+        return std::any_of(std::begin(signatures), std::end(signatures), [record](const char *signature) {
+            return record.startsWith(QByteArrayView(signature, 4));
+        });
+    }
 }
 
 void DocumentPrivate::init()
@@ -112,17 +276,23 @@ void DocumentPrivate::init()
     if (mhead.isNull() || mhead.size() < 14)
         return;
 
-    dec = Decompressor::create(mhead[1], getHuffRecords(pdb));
+    Instrumentation::PhaseScope scope(&counters, Instrumentation::HeaderPhase);
+    selectSection(mhead);
+    if (mhead[1] == 2) {
+        codec = Instrumentation::PalmDocCompression;
+    } else if (mhead[1] == 'H') {
+        codec = Instrumentation::HuffdicCompression;
+    }
     if ((int)mhead[12] != 0 || (int)mhead[13] != 0)
         drm = true;
-    if (!dec)
-        return;
 
+    textLength = qFromBigEndian<quint32>(mhead.constData() + 4);
     ntextrecords = qFromBigEndian<quint16>(mhead.constData() + 8);
     maxRecordSize = qFromBigEndian<quint16>(mhead.constData() + 10);
     if (mhead.size() > 31)
         encoding = qFromBigEndian<quint32>(mhead.constData() + 28);
-    if (encoding == 65001) {
+    utf8 = encoding == 65001;
+    if (utf8) {
         toUtf16 = QStringDecoder(QStringDecoder::Utf8);
     } else {
         toUtf16 = QStringDecoder("windows-1252");
@@ -140,20 +310,232 @@ void DocumentPrivate::init()
             extraflags = qFromBigEndian<quint32>(mhead.constData() + 240);
         }
     }
+    if (mhead.size() >= 248) {
+        quint32 headerLength = qFromBigEndian<quint32>(mhead.constData() + 20);
+        if ((headerLength + 16) >= 248) {
+            ncxIndex = qFromBigEndian<quint32>(mhead.constData() + 244);
+        }
+    }
+    if (mhead.size() >= 256 && qFromBigEndian<quint32>(mhead.constData() + 36) >= 8) {
+        quint32 headerLength = qFromBigEndian<quint32>(mhead.constData() + 20);
+        kf8 = true;
+        fdstIndex = qFromBigEndian<quint32>(mhead.constData() + 192);
+        if ((headerLength + 16) >= 256) {
+            fragmentIndex = qFromBigEndian<quint32>(mhead.constData() + 248);
+            skeletonIndex = qFromBigEndian<quint32>(mhead.constData() + 252);
+        }
+    } else if (mhead.size() >= 196 && qFromBigEndian<quint32>(mhead.constData() + 36) < 8) {
+        // Where KF8 headers hold the FDST index
+        lastContentRecord = qFromBigEndian<quint16>(mhead.constData() + 194);
+    }
+    if (mhead.size() >= 0x70) {
+        firstResourceRecord = qFromBigEndian<quint32>(mhead.constData() + 0x6c);
+    }
+
+    // All headers are known now, which determine the records needed later
+    if (pdb.isSequential()) {
+        readSequential(mhead);
+    }
+
+    // A matching structure file replaces the parsing below, and later on demand parsing
+    const bool structured = !options.structurePath.isEmpty() && applyStructure(options.structurePath);
+    if (structured && mhead[1] == 'H') {
+        // Known to be within the limit, read on first use of the text
+        dictionariesDeferred = true;
+    } else {
+        loadDictionaries(mhead);
+        if (!dec) {
+            // Text is not accessible
+            ntextrecords = 0;
+            return;
+        }
+    }
+    if (structured) {
+        valid = true;
+        return;
+    }
 
     // try getting metadata from HTML if nothing or only title was recovered from MOBI and EXTH records
     if (metadata.size() < 2 && !drm)
-        parseHtmlHead(toUtf16(dec->decompress(pdb.getRecord(1))));
+        parseHtmlHead(transcode(decompressRecord(1)));
     valid = true;
 }
 
+void DocumentPrivate::selectSection(QByteArray &mhead)
+{
+    // Combination files point to the KF8 header, which follows a BOUNDARY record
+    const QByteArrayView value = exthValue(mhead, 121);
+    if (value.size() < 4) {
+        return;
+    }
+    const quint32 kf8Header = qFromBigEndian<quint32>(value.constData());
+    if (kf8Header < 2 || kf8Header >= pdb.recordCount()) {
+        return;
+    }
+
+    const bool kf8 = options.section == OpenOptions::Kf8Section;
+    bool boundary = false;
+    QByteArray kf8Head;
+    if (pdb.isSequential()) {
+        if (kf8) {
+            // The MOBI 7 book is skipped, and lost if the KF8 header turns out invalid
+            pdb.readSequential(
+                [&](quint16 i, const QByteArray &record) {
+                    if (i == kf8Header - 1) {
+                        boundary = record.startsWith("BOUNDARY");
+                    }
+                    return i == kf8Header && boundary;
+                },
+                kf8Header + 1);
+            kf8Head = pdb.getRecord(kf8Header);
+        } else {
+            // Verifying the boundary would require reading past the MOBI 7 book
+            boundary = true;
+        }
+    } else {
+        boundary = pdb.getRecord(kf8Header - 1).startsWith("BOUNDARY");
+        if (boundary && kf8) {
+            kf8Head = pdb.getRecord(kf8Header);
+        }
+    }
+    if (!boundary) {
+        return;
+    }
+
+    combination = true;
+    if (kf8 && kf8Head.size() >= 24 && kf8Head.mid(16, 4) == "MOBI") {
+        section = OpenOptions::Kf8Section;
+        pdb.setSection(kf8Header, pdb.recordCount() - kf8Header);
+        mhead = kf8Head;
+        return;
+    }
+    if (kf8) {
+        qCWarning(QMOBIPOCKET_LOG) << "Invalid KF8 header at record" << kf8Header << "opening the MOBI 7 book";
+    }
+    // Excludes the BOUNDARY record and the KF8 book
+    pdb.setSection(0, kf8Header - 1);
+}
+
+Decompressor::Limits DocumentPrivate::decompressorLimits() const
+{
+    Decompressor::Limits limits;
+    limits.maxOutput = options.limits.maxRecordBytes;
+    limits.maxDepth = std::max(options.limits.maxRecursionDepth, 0);
+    limits.maxSymbols = std::max<qint64>(options.limits.maxRecordWork, 0);
+    return limits;
+}
+
+void DocumentPrivate::readSequential(const QByteArray &mhead)
+{
+    const auto parts = options.parts;
+
+    // Dictionaries are required for a valid document
+    quint32 huffFirst = 0;
+    quint32 huffCount = 0;
+    if (mhead[1] == 'H' && mhead.size() >= 0x78) {
+        huffFirst = qFromBigEndian<quint32>(mhead.constData() + 0x70);
+        huffCount = qFromBigEndian<quint32>(mhead.constData() + 0x74);
+    }
+
+    // Records can not be probed later, rely on the header
+    const quint32 firstImage = resourceStart();
+    firstImageRecord = firstImage;
+
+    QList<quint32> images;
+    if (parts & OpenOptions::Images) {
+        for (int i : options.images) {
+            images.append(firstImage + i);
+        }
+    }
+    if (parts & OpenOptions::Thumbnail) {
+        for (int i : {thumbnailIndex, coverIndex}) {
+            if (i >= 0) {
+                images.append(firstImage + i);
+            }
+        }
+    }
+    const bool allImages = (parts & OpenOptions::Images) && options.images.isEmpty();
+    // Images are content records, skip trailing FLIS/FCIS and index records
+    const quint16 lastContent = std::min<int>(lastContentRecord, pdb.recordCount() - 1);
+
+    // Records of an index, extended when its header record is read
+    struct IndexRecords {
+        quint32 first;
+        quint64 end = 0;
+
+        bool keep(quint16 i, const QByteArray &record)
+        {
+            if (i == first && record.size() >= 56 && record.startsWith("INDX")) {
+                end = quint64(first) + 1 + qFromBigEndian<quint32>(record.constData() + 24) + qFromBigEndian<quint32>(record.constData() + 52);
+                return true;
+            }
+            return i > first && i < end;
+        }
+    };
+    IndexRecords ncx{ncxIndex};
+    IndexRecords skeletons{skeletonIndex};
+    IndexRecords fragments{fragmentIndex};
+
+    pdb.readSequential([&](quint16 i, const QByteArray &record) {
+        if (i >= 1 && i <= ntextrecords) {
+            // Record 1 may be used for metadata from the HTML head
+            return bool(parts & OpenOptions::Text) || (i == 1 && (parts & OpenOptions::Metadata));
+        }
+        if (i >= huffFirst && i < quint64(huffFirst) + huffCount) {
+            return true;
+        }
+        if ((parts & OpenOptions::TableOfContents) && ncx.keep(i, record)) {
+            return true;
+        }
+        // Flows and parts of KF8 books
+        if ((parts & OpenOptions::Text) && (i == fdstIndex || skeletons.keep(i, record) || fragments.keep(i, record))) {
+            return true;
+        }
+        return (allImages && i >= firstImage && i <= lastContent) || images.contains(i);
+    });
+}
+
+void DocumentPrivate::loadDictionaries(const QByteArray &mhead)
+{
+    Instrumentation::PhaseScope scope(&counters, Instrumentation::DictionaryPhase);
+    const auto huffRecords = getHuffRecords(pdb);
+    qint64 dictionaryBytes = 0;
+    for (const auto &record : huffRecords) {
+        dictionaryBytes += record.size();
+    }
+    if (dictionaryBytes > options.limits.maxDictionaryBytes) {
+        qCWarning(QMOBIPOCKET_LOG) << "Dictionaries of" << dictionaryBytes << "bytes exceed the limit";
+    } else {
+        dec = Decompressor::create(mhead[1], huffRecords, decompressorLimits());
+    }
+}
+
+void DocumentPrivate::loadDeferredDictionaries()
+{
+    if (!dictionariesDeferred) {
+        return;
+    }
+    dictionariesDeferred = false;
+    loadDictionaries(pdb.getRecord(0));
+    if (!dec) {
+        // Changed since the structure file was written, fails as a corrupt record
+        dec = Decompressor::create('H', {});
+    }
+}
+
 void DocumentPrivate::findFirstImage()
 {
+    Instrumentation::PhaseScope scope(&counters, Instrumentation::ImageProbePhase);
     firstImageRecord = ntextrecords + 1;
     while (firstImageRecord < pdb.recordCount()) {
         QByteArray rec = pdb.getRecord(firstImageRecord);
         if (rec.isNull())
             return;
+        if (Instrumentation::enabled()) {
+            Instrumentation::Counters delta;
+            delta.imageProbes = 1;
+            Instrumentation::record(&counters, delta);
+        }
         QBuffer buf(&rec);
         buf.open(QIODevice::ReadOnly);
         QImageReader r(&buf);
@@ -223,10 +605,33 @@ void DocumentPrivate::parseEXTH(QByteArrayView data)
 }
 
 Document::Document(QIODevice *dev)
-    : d(new DocumentPrivate(dev))
+    : Document(dev, OpenOptions())
+{
+}
+
+Document::Document(QIODevice *dev, const OpenOptions &options)
+    : d(new DocumentPrivate(dev, options))
 {
     Q_ASSERT(dev->openMode() & QIODevice::ReadOnly);
-    Q_ASSERT(!dev->isSequential());
+    d->init();
+}
+
+Document::Document(const QByteArray &data, const OpenOptions &options)
+    : d(new DocumentPrivate(data, options))
+{
+    d->init();
+}
+
+Document::Document(QByteArrayView data, const OpenOptions &options)
+    : d(new DocumentPrivate(data, options))
+{
+    d->init();
+}
+
+Document::Document(const RandomAccessReader *reader, const OpenOptions &options)
+    : d(new DocumentPrivate(reader, options))
+{
+    Q_ASSERT(reader);
     d->init();
 }
 
@@ -235,115 +640,1276 @@ Document::~Document()
     delete d;
 }
 
+RandomAccessReader::~RandomAccessReader() = default;
+
+QByteArray DocumentPrivate::decompressRecord(quint16 i)
+{
+    QByteArray decompressed;
+    decompressRecord(i, decompressed);
+    return decompressed;
+}
+
+void DocumentPrivate::decompressRecord(quint16 i, QByteArray &out)
+{
+    decompress(pdb.getRecord(i), out);
+}
+
+void DocumentPrivate::decompress(const QByteArray &record, QByteArray &out)
+{
+    loadDeferredDictionaries();
+    decompress(*dec, record, out);
+}
+
+void DocumentPrivate::decompress(Decompressor &decompressor, const QByteArray &record, QByteArray &out)
+{
+    // Not resized, which would copy records read from memory
+    Instrumentation::PhaseScope scope(&counters, Instrumentation::DecompressPhase);
+    const qsizetype start = out.size();
+    decompressor.decompress(QByteArrayView(record).first(preTrailingDataLength(record, extraflags)), out);
+    if (Instrumentation::enabled()) {
+        Instrumentation::Counters delta;
+        delta.recordsDecompressed = 1;
+        delta.bytesCompressed = record.size();
+        delta.bytesDecompressed[codec] = out.size() - start;
+        delta.huffdicSymbols = decompressor.lastStats().symbols;
+        delta.huffdicMaxDepth = decompressor.lastStats().maxDepth;
+        Instrumentation::record(&counters, delta);
+    }
+}
+
+QString DocumentPrivate::transcode(QByteArrayView data)
+{
+    QString text;
+    transcode(data, text);
+    return text;
+}
+
+void DocumentPrivate::transcode(QByteArrayView data, QString &out)
+{
+    Instrumentation::PhaseScope scope(&counters, Instrumentation::TranscodePhase);
+    if (Instrumentation::enabled()) {
+        Instrumentation::Counters delta;
+        delta.bytesTranscoded = data.size();
+        Instrumentation::record(&counters, delta);
+    }
+
+    const qsizetype start = out.size();
+    const qsizetype required = toUtf16.requiredSpace(data.size());
+    if (out.capacity() < start + required) {
+        out.reserve(std::max(start + required, out.capacity() * 2));
+    }
+    out.resize(start + required);
+    const QChar *end = toUtf16.appendToBuffer(out.data() + start, data);
+    out.resize(end - out.constData());
+}
+
+qint64 DocumentPrivate::expectedTextLength(int size) const
+{
+    // Upper bound for preallocation, larger texts grow as needed
+    constexpr qint64 maxPreallocation = 128 * 1024 * 1024;
+
+    // The declared length is not trusted beyond what the text records can hold
+    qint64 length = std::min<qint64>(textLength, qint64(ntextrecords) * maxRecordSize);
+    if (size != -1) {
+        length = std::min<qint64>(length, qint64(size) + maxRecordSize);
+    }
+    return std::min(length, maxPreallocation);
+}
+
 namespace
 {
-constexpr qsizetype preTrailingDataLength(QByteArrayView data, quint32 flags)
+/**
+ * Reads and decompresses text records ahead of the transcoding thread, see
+ * OpenOptions::pipelineDepth. Reading runs on a thread of the global pool,
+ * decompression as well if a second thread is idle, or on the transcoding
+ * thread otherwise. As parallelFor(), never waits for a busy pool.
+ */
+class TextPipeline
 {
-    if (flags == 0) {
-        return data.size();
+public:
+    TextPipeline(DocumentPrivate &document, int depth)
+        : document(document)
+        , records(depth)
+        , decompressed(depth)
+    {
+    }
+
+    // Abandons the remaining records
+    ~TextPipeline()
+    {
+        records.close();
+        decompressed.close();
+        done.acquire(started);
+    }
+
+    /// Returns false if no thread is idle
+    bool start()
+    {
+        QThreadPool *pool = QThreadPool::globalInstance();
+        if (!pool->tryStart([this]() {
+                read();
+                done.release();
+            })) {
+            return false;
+        }
+        started++;
+        if (pool->tryStart([this]() {
+                decompress();
+                done.release();
+            })) {
+            started++;
+            decompressing = true;
+        }
+        return true;
     }
 
-    for (int i = 31; i > 0; i--) {
-        if ((flags & (1u << i)) == 0) {
-            continue;
+    /// The next decompressed text record, returns false if corrupt
+    bool next(QByteArray &out)
+    {
+        if (decompressing) {
+            auto record = decompressed.pop();
+            if (!record) {
+                return false;
+            }
+            out = std::move(*record);
+            return true;
         }
+        const auto record = records.pop();
+        document.decompress(record.value_or(QByteArray()), out);
+        return document.dec->isValid();
+    }
+
+    Q_DISABLE_COPY(TextPipeline);
 
-        qsizetype chopN = 0;
-        for (int j = 0; j < 4; j++) {
-            if (j + 1 > data.size()) {
-                return 0;
+private:
+    void read()
+    {
+        for (int i = 1; i < document.ntextrecords + 1; i++) {
+            if (!records.push(document.pdb.getRecord(i))) {
+                break;
             }
-            quint8 l = data.at(data.size() - (j + 1));
-            chopN |= (l & 0x7f) << (7 * j);
-            if (l & 0x80) {
+        }
+        records.close();
+    }
+
+    void decompress()
+    {
+        while (auto record = records.pop()) {
+            QByteArray out;
+            document.decompress(*record, out);
+            // Ends the queue early, which the transcoding thread takes as corrupt
+            if (!document.dec->isValid() || !decompressed.push(std::move(out))) {
                 break;
             }
         }
-        data.chop(std::min<qsizetype>(chopN, data.size()));
-    }
-    if ((flags & 0x1) && !data.isEmpty()) {
-        quint8 l = data.back() & 0x3;
-        data.chop(std::min<qsizetype>(l + 1, data.size()));
-    }
-    return data.size();
-}
-static_assert(preTrailingDataLength({"0\x00", 2}, 0x0) == 2);
-static_assert(preTrailingDataLength({"0\x00", 2}, 0x1) == 1);
-static_assert(preTrailingDataLength({"0\x01", 2}, 0x1) == 0);
-static_assert(preTrailingDataLength({"0\x02", 2}, 0x1) == 0);
-static_assert(preTrailingDataLength({"abcd\x03", 5}, 0x1) == 1);
-static_assert(preTrailingDataLength({"abcd\x81", 5}, 0x2) == 4);
-static_assert(preTrailingDataLength({"\x02\x01", 2}, 0x2) == 0);
-static_assert(preTrailingDataLength({"\x80\x02", 2}, 0x2) == 0);
-static_assert(preTrailingDataLength({"abcd\x85", 5}, 0x2) == 0);
-static_assert(preTrailingDataLength({"abc\x01\x7f\x82", 6}, 0x2) == 4);
-static_assert(preTrailingDataLength({"abc\x01\x80\x02", 6}, 0x2) == 4);
-static_assert(preTrailingDataLength({"abc\x01\x7f\x82", 6}, 0x3) == 2);
-static_assert(preTrailingDataLength({"abc\x81\x80\x02", 6}, 0x6) == 3);
-static_assert(preTrailingDataLength({"abc\x00\x81\x81", 6}, 0x7) == 3);
-} // namespace
+        records.close();
+        decompressed.close();
+    }
 
-QString Document::text(int size) const
+    DocumentPrivate &document;
+    BoundedQueue<QByteArray> records;
+    BoundedQueue<QByteArray> decompressed;
+    bool decompressing = false;
+    QSemaphore done;
+    int started = 0;
+};
+}
+
+bool DocumentPrivate::extractText(int size, const ExtractionControl *control, HtmlStripper *stripper, QString &out, const TextSink &sink)
 {
-    QByteArray whole;
-    for (int i = 1; i < d->ntextrecords + 1; i++) {
-        auto record = d->pdb.getRecord(i);
-        record.resize(preTrailingDataLength(record, d->extraflags));
-        QByteArray decompressedRecord = d->dec->decompress(record);
-        whole += decompressedRecord;
-        if (!d->dec->isValid()) {
-            d->valid = false;
-            return QString();
-        }
-        if (size != -1 && whole.size() > size)
+    // Records are decompressed into a reused buffer and transcoded one by
+    // one into the output, the decoder keeps multibyte sequences spanning
+    // records. For plain text, only the current record is kept as HTML.
+    toUtf16.resetState();
+    // Before the pipeline threads use the decompressor
+    loadDeferredDictionaries();
+
+    std::optional<TextPipeline> pipeline;
+    if (options.pipelineDepth > 0 && ntextrecords > 1) {
+        pipeline.emplace(*this, options.pipelineDepth);
+        if (!pipeline->start()) {
+            pipeline.reset();
+        }
+    }
+    // Records queued between the stages, about as large as the current one
+    const int queuedRecords = pipeline ? 2 * options.pipelineDepth : 0;
+
+    QByteArray record;
+    QString html;
+    qint64 decompressed = 0;
+    // Located on the way when reading the whole text
+    const bool locate = recordOffsets.isEmpty() && size == -1;
+    QList<qint64> offsets;
+    if (locate) {
+        offsets.reserve(ntextrecords + 1);
+    }
+    for (int i = 1; i < ntextrecords + 1; i++) {
+        if (interrupted(control)) {
+            return false;
+        }
+        if (locate) {
+            offsets.append(decompressed);
+        }
+        record.resize(0);
+        bool ok;
+        if (pipeline) {
+            ok = pipeline->next(record);
+        } else {
+            decompressRecord(i, record);
+            ok = dec->isValid();
+        }
+        if (!ok) {
+            valid = false;
+            return false;
+        }
+        decompressed += record.size();
+        if (decompressed > options.limits.maxTextBytes) {
+            qCWarning(QMOBIPOCKET_LOG) << "Text exceeds the limit of" << options.limits.maxTextBytes << "bytes";
+            return false;
+        }
+        if (stripper) {
+            html.resize(0);
+            transcode(record, html);
+            stripper->feed(html, out);
+        } else {
+            transcode(record, out);
+        }
+        if (sink) {
+            sink(out);
+            peakBuffers = std::max<qint64>(peakBuffers, out.capacity() * sizeof(QChar));
+            out.resize(0);
+        }
+        peakBuffers = std::max<qint64>(peakBuffers, record.capacity() * (1 + queuedRecords) + html.capacity() * sizeof(QChar));
+        if (!reportProgress(control, i, ntextrecords)) {
+            return false;
+        }
+        if (size != -1 && decompressed > size)
             break;
     }
-    return d->toUtf16(whole);
+    if (locate) {
+        offsets.append(decompressed);
+        recordOffsets = offsets;
+    }
+    if (stripper) {
+        stripper->finish(out);
+        if (sink && !out.isEmpty()) {
+            sink(out);
+        }
+    }
+    return true;
 }
 
-int Document::imageCount() const
+QString DocumentPrivate::text(int size, const ExtractionControl *control, HtmlStripper *stripper)
 {
-    // FIXME: don't count FLIS and FCIS records
-    return d->pdb.recordCount() - d->ntextrecords;
+    QString text;
+    if (!stripper) {
+        text.reserve(toUtf16.requiredSpace(expectedTextLength(size)));
+    }
+    if (!extractText(size, control, stripper, text)) {
+        return QString();
+    }
+    return text;
 }
 
-bool Document::isValid() const
+QString Document::text(int size) const
 {
-    return d->valid;
+    QMutexLocker locker(&d->mutex);
+    return d->text(size, nullptr);
 }
 
-QImage Document::getImage(int i) const
+QString Document::text(const ExtractionControl &control, int size) const
 {
-    if (!d->firstImageRecord)
-        d->findFirstImage();
+    QMutexLocker locker(&d->mutex);
+    return d->text(size, &control);
+}
 
-    if ((i < 0) || (i > std::numeric_limits<quint16>::max()) //
-        || (d->firstImageRecord + i) >= d->pdb.recordCount()) {
-        return {};
+QString Document::plainText(int size) const
+{
+    QMutexLocker locker(&d->mutex);
+    HtmlStripper stripper;
+    return d->text(size, nullptr, &stripper);
+}
+
+QString Document::plainText(const ExtractionControl &control, int size) const
+{
+    QMutexLocker locker(&d->mutex);
+    HtmlStripper stripper;
+    return d->text(size, &control, &stripper);
+}
+
+bool Document::streamPlainText(const std::function<void(QStringView chunk)> &sink, const ExtractionControl &control) const
+{
+    QMutexLocker locker(&d->mutex);
+    HtmlStripper stripper;
+    QString chunk;
+    return d->extractText(-1, &control, &stripper, chunk, sink);
+}
+
+bool Document::streamPlainTextWithPositions(const std::function<void(QStringView chunk, const QList<qint64> &positions)> &sink,
+                                            const ExtractionControl &control) const
+{
+    QMutexLocker locker(&d->mutex);
+    HtmlStripper stripper;
+    QList<qint64> positions;
+    stripper.trackOffsets(&positions, d->utf8 ? HtmlStripper::Utf8 : HtmlStripper::SingleByte);
+    QString chunk;
+    return d->extractText(-1, &control, &stripper, chunk, [&sink, &positions](QStringView text) {
+        sink(text, positions);
+        positions.resize(0);
+    });
+}
+
+bool Document::streamText(const std::function<void(QStringView chunk)> &sink, const ExtractionControl &control) const
+{
+    QMutexLocker locker(&d->mutex);
+    QString chunk;
+    return d->extractText(-1, &control, nullptr, chunk, sink);
+}
+
+namespace
+{
+// Counts plain text fed in consecutive chunks, see TextStatistics
+struct TextCounter {
+    void feed(QStringView text, TextStatistics &statistics)
+    {
+        for (const QChar c : text) {
+            if (c == QLatin1Char('\n')) {
+                inWord = false;
+                inParagraph = false;
+                continue;
+            }
+            if (!c.isLowSurrogate()) {
+                statistics.characters++;
+            }
+            if (c.isSpace()) {
+                inWord = false;
+                continue;
+            }
+            if (!inWord) {
+                statistics.words++;
+                inWord = true;
+            }
+            if (!inParagraph) {
+                statistics.paragraphs++;
+                inParagraph = true;
+            }
+        }
     }
 
-    QByteArray rec = d->pdb.getRecord(d->firstImageRecord + i);
-    return (rec.isNull()) ? QImage() : QImage::fromData(rec);
+    bool inWord = false;
+    bool inParagraph = false;
+};
 }
 
-QMap<Document::MetaKey, QString> Document::metadata() const
+TextStatistics TextStatistics::count(QStringView plainText)
 {
-    return d->metadata;
+    TextStatistics statistics;
+    TextCounter().feed(plainText, statistics);
+    return statistics;
 }
 
-bool Document::hasDRM() const
+TextStatistics DocumentPrivate::textStatistics(const ExtractionControl *control)
 {
-    return d->drm;
+    TextStatistics statistics;
+    if (!valid || drm) {
+        statistics.complete = false;
+        return statistics;
+    }
+
+    // Decompressors of the threads, Huffdic tables are too large to create per batch
+    const QVector<QByteArray> huffRecords = getHuffRecords(pdb);
+    const quint8 type = pdb.getRecord(0)[1];
+    QMutex lock;
+    std::vector<std::unique_ptr<Decompressor>> decompressors;
+    std::atomic_bool corrupt = false;
+
+    // Batches of a few records per thread are decompressed in parallel, then
+    // transcoded and counted in order on this thread, so words spanning records
+    // are counted once
+    const qsizetype batchSize = std::max(1, QThreadPool::globalInstance()->maxThreadCount()) * 4;
+    QList<QByteArray> batch(batchSize);
+    HtmlStripper stripper;
+    TextCounter counter;
+    QString html;
+    QString plain;
+    qint64 decompressed = 0;
+    toUtf16.resetState();
+
+    for (int first = 1; first < ntextrecords + 1; first += batchSize) {
+        if (interrupted(control)) {
+            statistics.complete = false;
+            return statistics;
+        }
+        const qsizetype count = std::min<qsizetype>(batchSize, ntextrecords + 1 - first);
+        parallelFor(count, [&](qsizetype begin, qsizetype end) {
+            std::unique_ptr<Decompressor> decompressor;
+            {
+                QMutexLocker locker(&lock);
+                if (!decompressors.empty()) {
+                    decompressor = std::move(decompressors.back());
+                    decompressors.pop_back();
+                }
+            }
+            if (!decompressor) {
+                decompressor = Decompressor::create(type, huffRecords, decompressorLimits());
+            }
+            if (!decompressor) {
+                corrupt = true;
+                return;
+            }
+            for (qsizetype i = begin; i < end && !corrupt; i++) {
+                QByteArray record;
+                {
+                    QMutexLocker locker(pdb.concurrentReads() ? nullptr : &lock);
+                    record = pdb.getRecord(first + i);
+                }
+                batch[i].resize(0);
+                decompress(*decompressor, record, batch[i]);
+                if (!decompressor->isValid()) {
+                    // Not reused, a corrupt record invalidates the decompressor
+                    corrupt = true;
+                    return;
+                }
+            }
+            QMutexLocker locker(&lock);
+            decompressors.push_back(std::move(decompressor));
+        });
+        if (corrupt) {
+            valid = false;
+            statistics.complete = false;
+            return statistics;
+        }
+
+        qint64 batchBuffers = 0;
+        for (qsizetype i = 0; i < count; i++) {
+            decompressed += batch[i].size();
+            if (decompressed > options.limits.maxTextBytes) {
+                qCWarning(QMOBIPOCKET_LOG) << "Text exceeds the limit of" << options.limits.maxTextBytes << "bytes";
+                statistics.complete = false;
+                return statistics;
+            }
+            html.resize(0);
+            plain.resize(0);
+            transcode(batch[i], html);
+            stripper.feed(html, plain);
+            counter.feed(plain, statistics);
+            batchBuffers += batch[i].capacity();
+        }
+        peakBuffers = std::max<qint64>(peakBuffers, batchBuffers + (html.capacity() + plain.capacity()) * sizeof(QChar));
+        if (!reportProgress(control, first + count - 1, ntextrecords)) {
+            statistics.complete = false;
+            return statistics;
+        }
+    }
+    plain.resize(0);
+    stripper.finish(plain);
+    counter.feed(plain, statistics);
+    return statistics;
 }
 
-QImage Document::thumbnail() const
+TextStatistics Document::textStatistics(const ExtractionControl &control) const
 {
-    if (QImage img = getImage(d->thumbnailIndex); !img.isNull()) {
-        return img;
+    QMutexLocker locker(&d->mutex);
+    return d->textStatistics(&control);
+}
+
+int DocumentPrivate::imageCount()
+{
+    if (imageRecords >= 0) {
+        return imageRecords;
     }
+    if (!firstImageRecord)
+        findFirstImage();
 
-    // Fall back to cover image, or return an empty image
-    return getImage(d->coverIndex);
+    // Images are followed by FLIS, FCIS and index records, as classified by validate()
+    int end = pdb.recordCount();
+    if (lastContentRecord >= firstImageRecord && lastContentRecord < end) {
+        end = lastContentRecord + 1;
+    }
+    while (end > firstImageRecord) {
+        const QByteArray record = pdb.getRecord(end - 1);
+        // Null if not kept from a sequential device, may be an image
+        if (record.isNull() || !isNonImageRecord(record)) {
+            break;
+        }
+        end--;
+    }
+    imageRecords = std::max(end - firstImageRecord, 0);
+    return imageRecords;
+}
+
+int Document::imageCount() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->imageCount();
+}
+
+bool Document::isValid() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->valid;
+}
+
+// The first resource record declared in the header, or the record after the text if invalid
+quint32 DocumentPrivate::resourceStart() const
+{
+    if (firstResourceRecord <= ntextrecords || firstResourceRecord >= quint32(pdb.recordCount())) {
+        return ntextrecords + 1;
+    }
+    return firstResourceRecord;
+}
+
+QByteArray DocumentPrivate::resourceRecord(int i)
+{
+    const quint32 first = resourceStart();
+    if (i < 0 || i > std::numeric_limits<quint16>::max() || first + i >= quint32(pdb.recordCount())) {
+        return {};
+    }
+    return pdb.getRecord(first + i);
+}
+
+QByteArray DocumentPrivate::imageRecord(int i)
+{
+    if (!firstImageRecord)
+        findFirstImage();
+
+    if ((i < 0) || (i > std::numeric_limits<quint16>::max()) //
+        || (firstImageRecord + i) >= pdb.recordCount()) {
+        return {};
+    }
+
+    return pdb.getRecord(firstImageRecord + i);
+}
+
+QImage DocumentPrivate::getImage(int i, const ExtractionControl *control)
+{
+    if (interrupted(control)) {
+        return {};
+    }
+
+    QByteArray rec = imageRecord(i);
+    if (rec.isNull() || interrupted(control)) {
+        return {};
+    }
+    Instrumentation::PhaseScope scope(&counters, Instrumentation::ImageDecodePhase);
+    QImage image = QImage::fromData(rec);
+    if (!reportProgress(control, 1, 1)) {
+        return {};
+    }
+    return image;
+}
+
+QImage Document::getImage(int i) const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->getImage(i, nullptr);
+}
+
+QImage Document::getImage(int i, const ExtractionControl &control) const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->getImage(i, &control);
+}
+
+QByteArray Document::imageData(int i) const
+{
+    QMutexLocker locker(&d->mutex);
+    QByteArray data = d->imageRecord(i);
+    // Records read from memory must not outlive the document
+    data.detach();
+    return data;
+}
+
+QByteArray Document::resourceData(int i) const
+{
+    QMutexLocker locker(&d->mutex);
+    QByteArray data = d->resourceRecord(i);
+    data.detach();
+    return data;
+}
+
+int Document::resourceCount() const
+{
+    QMutexLocker locker(&d->mutex);
+    const int images = d->imageCount();
+    return images ? std::max<int>(d->firstImageRecord + images - d->resourceStart(), 0) : 0;
+}
+
+QList<QByteArray> Document::imageData(int first, int count) const
+{
+    QMutexLocker locker(&d->mutex);
+    const int images = d->imageCount();
+    if (first < 0 || first >= images) {
+        return {};
+    }
+    count = std::min(count, images - first);
+    QList<QByteArray> records;
+    records.reserve(std::max(count, 0));
+    for (int i = first; i < first + count; i++) {
+        QByteArray data = d->imageRecord(i);
+        data.detach();
+        records.append(data);
+    }
+    return records;
+}
+
+QList<TocEntry> DocumentPrivate::tableOfContents()
+{
+    if (toc) {
+        return *toc;
+    }
+    toc.emplace();
+
+    Index ncx;
+    if (ncxIndex == 0xffffffff || !ncx.read(pdb, ncxIndex)) {
+        return {};
+    }
+
+    // NCX tags: 1 position, 2 length, 3 title offset in CNCX, 4 level, 21 parent
+    toc->reserve(ncx.entries.size());
+    for (const auto &entry : std::as_const(ncx.entries)) {
+        TocEntry tocEntry;
+        if (entry.tags.contains(3)) {
+            toUtf16.resetState();
+            tocEntry.title = toUtf16(ncx.cncxString(entry.value(3)));
+        }
+        tocEntry.position = entry.value(1);
+        tocEntry.length = entry.value(2);
+        tocEntry.level = entry.value(4);
+        const quint32 parent = entry.value(21, 0, 0xffffffff);
+        tocEntry.parent = parent < quint32(ncx.entries.size()) ? int(parent) : -1;
+        toc->append(tocEntry);
+    }
+    return *toc;
+}
+
+bool DocumentPrivate::buildRecordOffsets(const ExtractionControl *control)
+{
+    QList<qint64> offsets;
+    offsets.reserve(ntextrecords + 1);
+    QByteArray record;
+    qint64 offset = 0;
+    for (int i = 1; i < ntextrecords + 1; i++) {
+        if (interrupted(control)) {
+            return false;
+        }
+        offsets.append(offset);
+        record.resize(0);
+        decompressRecord(i, record);
+        if (!dec->isValid()) {
+            valid = false;
+            return false;
+        }
+        offset += record.size();
+    }
+    offsets.append(offset);
+    recordOffsets = offsets;
+    return true;
+}
+
+QByteArray DocumentPrivate::rawRange(qint64 position, qint64 length, const ExtractionControl *control)
+{
+    loadDeferredDictionaries();
+    if (!dec || position < 0 || length <= 0 || length > options.limits.maxTextBytes) {
+        return {};
+    }
+    // Text records do not necessarily decompress to maxRecordSize, locate them once
+    if (recordOffsets.isEmpty() && !buildRecordOffsets(control)) {
+        return {};
+    }
+
+    auto recordAt = [this](qint64 offset) -> qint64 {
+        return std::upper_bound(recordOffsets.cbegin(), recordOffsets.cend(), offset) - recordOffsets.cbegin();
+    };
+    const qint64 first = recordAt(position);
+    const qint64 last = std::min<qint64>(recordAt(position + length - 1), ntextrecords);
+    if (first > last) {
+        return {};
+    }
+
+    QByteArray bytes;
+    for (qint64 i = first; i <= last; i++) {
+        if (interrupted(control)) {
+            return {};
+        }
+        decompressRecord(i, bytes);
+        if (!dec->isValid()) {
+            valid = false;
+            return {};
+        }
+        if (!reportProgress(control, i - first + 1, last - first + 1)) {
+            return {};
+        }
+    }
+
+    peakBuffers = std::max<qint64>(peakBuffers, bytes.capacity());
+    const qint64 offset = position - recordOffsets[first - 1];
+    if (offset >= bytes.size()) {
+        return {};
+    }
+    bytes.truncate(offset + std::min<qint64>(length, bytes.size() - offset));
+    return bytes.sliced(offset);
+}
+
+QString DocumentPrivate::textRange(qint64 position, qint64 length, const ExtractionControl *control)
+{
+    const QByteArray bytes = rawRange(position, length, control);
+    if (bytes.isNull()) {
+        return {};
+    }
+    toUtf16.resetState();
+    return transcode(bytes);
+}
+
+const Kf8Layout &DocumentPrivate::layout()
+{
+    if (!kf8Layout) {
+        kf8Layout.emplace();
+        const qint64 length = std::min<qint64>(textLength, qint64(ntextrecords) * maxRecordSize);
+        if (!kf8) {
+            kf8Layout->flows.append({0, length});
+        } else if (!kf8Layout->read(pdb, fdstIndex, skeletonIndex, fragmentIndex, length)) {
+            qCWarning(QMOBIPOCKET_LOG) << "Malformed FDST, SKEL or FRAG records";
+            kf8Layout.emplace();
+        }
+    }
+    return *kf8Layout;
+}
+
+QString DocumentPrivate::flow(int i)
+{
+    const auto &flows = layout().flows;
+    if (i < 0 || i >= flows.size()) {
+        return {};
+    }
+    return textRange(flows[i].start, flows[i].end - flows[i].start, nullptr);
+}
+
+QString DocumentPrivate::part(int i)
+{
+    const auto &parts = layout().parts;
+    if (i < 0 || i >= parts.size()) {
+        return {};
+    }
+    // The skeleton and its fragments are stored consecutively
+    const Kf8Layout::Part &part = parts[i];
+    const QByteArray assembled = Kf8Layout::assemble(part, rawRange(part.position, part.length(), nullptr));
+    if (assembled.isNull()) {
+        return {};
+    }
+    toUtf16.resetState();
+    return transcode(assembled);
+}
+
+QList<TocEntry> Document::tableOfContents() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->tableOfContents();
+}
+
+QString Document::textRange(qint64 position, qint64 length) const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->textRange(position, length, nullptr);
+}
+
+QString Document::textRange(qint64 position, qint64 length, const ExtractionControl &control) const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->textRange(position, length, &control);
+}
+
+bool Document::isKf8() const
+{
+    return d->kf8;
+}
+
+int Document::flowCount() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->layout().flows.size();
+}
+
+QString Document::flow(int i) const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->flow(i);
+}
+
+int Document::partCount() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->layout().parts.size();
+}
+
+QString Document::part(int i) const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->part(i);
+}
+
+QMap<Document::MetaKey, QString> Document::metadata() const
+{
+    return d->metadata;
+}
+
+Instrumentation::Counters Document::counters() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->counters.load();
+}
+
+bool Document::hasDRM() const
+{
+    return d->drm;
+}
+
+bool Document::isCombination() const
+{
+    return d->combination;
+}
+
+OpenOptions::Section Document::section() const
+{
+    return d->section;
+}
+
+QImage DocumentPrivate::thumbnail(const ExtractionControl *control)
+{
+    if (QImage img = getImage(thumbnailIndex, control); !img.isNull() || interrupted(control)) {
+        return img;
+    }
+
+    // Fall back to cover image, or return an empty image
+    return getImage(coverIndex, control);
+}
+
+QImage Document::thumbnail() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->thumbnail(nullptr);
+}
+
+QImage Document::thumbnail(const ExtractionControl &control) const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->thumbnail(&control);
+}
+
+void DocumentPrivate::validateHeader(const QByteArray &mhead, ValidationReport &report)
+{
+    auto issue = [&report](ValidationReport::Check check, const QString &message) {
+        report.issues.append({check, 0, message});
+    };
+
+    const quint16 compression = qFromBigEndian<quint16>(mhead.constData());
+    if (compression != 1 && compression != 2 && compression != 'D' * 256 + 'H') {
+        issue(ValidationReport::Header, QStringLiteral("Unknown compression %1").arg(compression));
+    }
+    const quint32 length = qFromBigEndian<quint32>(mhead.constData() + 4);
+    const quint16 textRecords = qFromBigEndian<quint16>(mhead.constData() + 8);
+    const quint16 recordSize = qFromBigEndian<quint16>(mhead.constData() + 10);
+    if (textRecords == 0 || textRecords >= pdb.recordCount()) {
+        issue(ValidationReport::Header, QStringLiteral("Invalid text record count %1 of %2 records").arg(textRecords).arg(pdb.recordCount()));
+    }
+    if (recordSize == 0) {
+        issue(ValidationReport::Header, QStringLiteral("Invalid maximum record size 0"));
+    } else if (length > quint64(textRecords) * recordSize) {
+        issue(ValidationReport::Header, QStringLiteral("Text length %1 exceeds %2 records of %3 bytes").arg(length).arg(textRecords).arg(recordSize));
+    }
+
+    if (mhead.size() < 24 || mhead.mid(16, 4) != "MOBI") {
+        // PalmDOC book
+        return;
+    }
+    const quint64 size = mhead.size();
+    const quint32 headerLength = qFromBigEndian<quint32>(mhead.constData() + 20);
+    if (headerLength + quint64(16) > size) {
+        issue(ValidationReport::Header, QStringLiteral("MOBI header length %1 exceeds record 0").arg(headerLength));
+    }
+    if (size >= 32) {
+        const quint32 encoding = qFromBigEndian<quint32>(mhead.constData() + 28);
+        if (encoding != 1252 && encoding != 65001) {
+            issue(ValidationReport::Header, QStringLiteral("Unknown text encoding %1").arg(encoding));
+        }
+    }
+    if (size >= 92) {
+        const quint32 nameOffset = qFromBigEndian<quint32>(mhead.constData() + 84);
+        const quint32 nameLength = qFromBigEndian<quint32>(mhead.constData() + 88);
+        if (quint64(nameOffset) + nameLength > size) {
+            issue(ValidationReport::Header, QStringLiteral("Full name exceeds record 0"));
+        }
+    }
+
+    const quint64 exthOffset = headerLength + quint64(16);
+    const bool hasExth = exthOffset + 12 <= size && mhead.mid(exthOffset, 4) == "EXTH";
+    if (size >= 132 && (qFromBigEndian<quint32>(mhead.constData() + 128) & 0x40) && !hasExth) {
+        issue(ValidationReport::Exth, QStringLiteral("EXTH flag set, but no EXTH header"));
+    }
+    if (!hasExth) {
+        return;
+    }
+    const quint32 exthLength = qFromBigEndian<quint32>(mhead.constData() + exthOffset + 4);
+    const quint32 count = qFromBigEndian<quint32>(mhead.constData() + exthOffset + 8);
+    if (exthOffset + exthLength > size) {
+        issue(ValidationReport::Exth, QStringLiteral("EXTH length %1 exceeds record 0").arg(exthLength));
+    }
+    const quint64 end = std::min(exthOffset + exthLength, size);
+    quint64 offset = exthOffset + 12;
+    for (quint32 i = 0; i < count; i++) {
+        if (offset + 8 > end) {
+            issue(ValidationReport::Exth, QStringLiteral("EXTH record %1 of %2 exceeds the EXTH header").arg(i).arg(count));
+            break;
+        }
+        const quint32 len = qFromBigEndian<quint32>(mhead.constData() + offset + 4);
+        if (len < 8 || len > end - offset) {
+            issue(ValidationReport::Exth, QStringLiteral("EXTH record %1 has invalid length %2").arg(i).arg(len));
+            break;
+        }
+        offset += len;
+    }
+}
+
+ValidationReport DocumentPrivate::validate(const ExtractionControl *control)
+{
+    // Values are taken from the headers again, as the document state is
+    // reset for invalid documents
+    ValidationReport report;
+    auto issue = [&report](ValidationReport::Check check, int record, const QString &message) {
+        report.issues.append({check, record, message});
+    };
+
+    if (!pdb.isValid()) {
+        issue(ValidationReport::RecordTable, -1, QStringLiteral("Truncated PDB header or decreasing record offsets"));
+        return report;
+    }
+    if (pdb.declaredRecordCount() > pdb.recordCount()) {
+        issue(ValidationReport::RecordTable,
+              pdb.recordCount(),
+              QStringLiteral("%1 records start past the end of the file").arg(pdb.declaredRecordCount() - pdb.recordCount()));
+    }
+    if (pdb.recordCount() > 0 && pdb.recordOffset(0) < 0x4e + 8 * quint32(pdb.declaredRecordCount())) {
+        issue(ValidationReport::RecordTable, 0, QStringLiteral("Records overlap the record table"));
+    }
+    if (pdb.fileType() != "BOOKMOBI" && pdb.fileType() != "TEXtREAd") {
+        issue(ValidationReport::Header, -1, QStringLiteral("Unknown file type %1").arg(QString::fromLatin1(pdb.fileType())));
+    }
+
+    const QByteArray mhead = pdb.getRecord(0);
+    if (mhead.size() < 16) {
+        issue(ValidationReport::Header, 0, QStringLiteral("Record 0 too short"));
+        return report;
+    }
+    validateHeader(mhead, report);
+    report.drm = drm;
+
+    // Dictionaries, checked again independent of the state of dec
+    const QVector<QByteArray> huffRecords = getHuffRecords(pdb);
+    if (mhead[1] == 'H') {
+        const quint32 huffOffset = mhead.size() >= 0x78 ? qFromBigEndian<quint32>(mhead.constData() + 0x70) : 0;
+        if (huffRecords.size() < 2) {
+            issue(ValidationReport::Dictionary, -1, QStringLiteral("HUFF and CDIC records missing or out of range"));
+        } else {
+            for (qsizetype i = 0; i < huffRecords.size(); i++) {
+                if (!huffRecords[i].startsWith(i == 0 ? "HUFF" : "CDIC")) {
+                    issue(ValidationReport::Dictionary, huffOffset + i, QStringLiteral("Missing %1 signature").arg(QLatin1String(i == 0 ? "HUFF" : "CDIC")));
+                }
+            }
+        }
+    }
+    const auto probe = Decompressor::create(mhead[1], huffRecords, decompressorLimits());
+    const bool decodable = probe && probe->isValid();
+    if (probe && !decodable) {
+        issue(ValidationReport::Dictionary, -1, QStringLiteral("Invalid Huffman tables"));
+    }
+
+    // For sequential devices, only records of requested parts were kept
+    const bool checkText = decodable && !drm && (!pdb.isSequential() || (options.parts & OpenOptions::Text));
+    const bool checkImages = !pdb.isSequential() || ((options.parts & OpenOptions::Images) && options.images.isEmpty());
+
+    const quint16 textRecords = std::min<quint16>(qFromBigEndian<quint16>(mhead.constData() + 8), std::max(pdb.recordCount() - 1, 0));
+    const qsizetype textCount = checkText ? textRecords : 0;
+    const qint64 recordLimit = qFromBigEndian<quint16>(mhead.constData() + 10);
+    report.textRecords = textRecords;
+
+    if (checkImages && !firstImageRecord) {
+        findFirstImage();
+    }
+    const quint16 firstImage = std::max<quint16>(firstImageRecord, textRecords + 1);
+    quint32 lastContent = pdb.recordCount() - 1;
+    if (lastContentRecord >= firstImage && lastContentRecord < pdb.recordCount()) {
+        lastContent = lastContentRecord;
+    }
+    const qsizetype imageCount = (checkImages && firstImage <= lastContent) ? lastContent - firstImage + 1 : 0;
+
+    // Records are read serialized, decompressed or decoded in parallel into
+    // discard buffers. The document mutex is held by the caller throughout.
+    QMutex lock;
+    std::atomic<qint64> textLength = 0;
+    std::atomic<int> images = 0;
+    std::atomic<qint64> done = 0;
+    std::atomic_bool stop = false;
+    const qsizetype total = textCount + imageCount;
+    const quint8 type = mhead[1];
+    // Decompressors of the threads, reused by later slices, Huffdic tables are too large to create per slice
+    std::vector<std::unique_ptr<Decompressor>> decompressors;
+
+    parallelFor(total, [&](qsizetype begin, qsizetype end) {
+        std::unique_ptr<Decompressor> decompressor;
+        if (begin < textCount) {
+            QMutexLocker locker(&lock);
+            if (!decompressors.empty()) {
+                decompressor = std::move(decompressors.back());
+                decompressors.pop_back();
+            }
+        }
+        QByteArray discard;
+        QList<ValidationReport::Issue> issues;
+
+        for (qsizetype i = begin; i < end && !stop; i++) {
+            if (interrupted(control)) {
+                stop = true;
+                break;
+            }
+            const quint16 record = i < textCount ? i + 1 : firstImage + (i - textCount);
+            QByteArray data;
+            {
+                QMutexLocker locker(pdb.concurrentReads() ? nullptr : &lock);
+                data = pdb.getRecord(record);
+            }
+
+            if (i < textCount) {
+                if (data.isNull()) {
+                    issues.append({ValidationReport::TextRecord, record, QStringLiteral("Missing text record")});
+                    continue;
+                }
+                // A corrupt record invalidates the decompressor
+                if (!decompressor || !decompressor->isValid()) {
+                    decompressor = Decompressor::create(type, huffRecords, decompressorLimits());
+                }
+                discard.resize(0);
+                decompressor->decompress(QByteArrayView(data).first(preTrailingDataLength(data, extraflags)), discard);
+                if (!decompressor->isValid()) {
+                    issues.append({ValidationReport::TextRecord, record, QStringLiteral("Corrupt compressed data")});
+                } else if (discard.size() > recordLimit) {
+                    issues.append({ValidationReport::TextRecord,
+                                   record,
+                                   QStringLiteral("Decompresses to %1 bytes, more than the maximum record size %2").arg(discard.size()).arg(recordLimit)});
+                }
+                textLength += discard.size();
+            } else if (!isNonImageRecord(data)) {
+                // Only the image header is read, no pixels are decoded
+                QBuffer buffer(&data);
+                buffer.open(QIODevice::ReadOnly);
+                QImageReader reader(&buffer);
+                if (reader.canRead() && reader.size().isValid()) {
+                    images++;
+                } else {
+                    issues.append({ValidationReport::ImageRecord, record, QStringLiteral("Not a readable image")});
+                }
+            }
+
+            if (control && control->progress) {
+                QMutexLocker locker(&lock);
+                if (!reportProgress(control, ++done, total)) {
+                    stop = true;
+                }
+            }
+        }
+
+        QMutexLocker locker(&lock);
+        report.issues += issues;
+        if (decompressor && decompressor->isValid()) {
+            decompressors.push_back(std::move(decompressor));
+        }
+    });
+
+    report.complete = !stop;
+    report.textLength = textLength;
+    report.imageRecords = images;
+
+    if (report.complete && checkText) {
+        const quint32 declared = qFromBigEndian<quint32>(mhead.constData() + 4);
+        if (report.textLength != declared) {
+            issue(ValidationReport::TextRecord, -1, QStringLiteral("Text records decompress to %1 bytes, the header declares %2").arg(report.textLength).arg(declared));
+        }
+    }
+    if (checkImages) {
+        for (int index : {coverIndex, thumbnailIndex}) {
+            if (index >= 0 && firstImage + qint64(index) > lastContent) {
+                issue(ValidationReport::Exth, 0, QStringLiteral("Image index %1 out of range").arg(index));
+            }
+        }
+    }
+
+    // Records are numbered within the opened book of a combination file so far
+    for (auto &issue : report.issues) {
+        if (issue.record >= 0) {
+            issue.record += pdb.sectionStart();
+        }
+    }
+    std::stable_sort(report.issues.begin(), report.issues.end(), [](const ValidationReport::Issue &a, const ValidationReport::Issue &b) {
+        return a.record < b.record;
+    });
+    return report;
+}
+
+ValidationReport Document::validate(const ExtractionControl &control) const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->validate(&control);
+}
+
+QByteArray DocumentPrivate::fingerprint()
+{
+    if (!fingerprintHash.isEmpty() || !pdb.isValid()) {
+        return fingerprintHash;
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    auto addValue = [&hash](quint64 value) {
+        char buf[sizeof(value)];
+        qToLittleEndian(value, buf);
+        hash.addData(QByteArrayView(buf, sizeof(buf)));
+    };
+    addValue(pdb.size());
+    addValue(pdb.declaredRecordCount());
+    for (quint16 i = 0; i < pdb.recordCount(); i++) {
+        addValue(pdb.recordOffset(i));
+    }
+    hash.addData(pdb.getRecord(0));
+    fingerprintHash = hash.result();
+    return fingerprintHash;
+}
+
+bool DocumentPrivate::applyStructure(const QString &fileName)
+{
+    Structure structure;
+    if (!structure.load(fileName) || structure.fingerprint != fingerprint()) {
+        return false;
+    }
+    // The fingerprint only covers the book, not the structure file
+    const auto &offsets = structure.recordOffsets;
+    const auto &types = structure.recordTypes;
+    if (structure.firstImageRecord > pdb.recordCount() || types.size() != pdb.recordCount() //
+        || (!offsets.isEmpty() && (offsets.size() != ntextrecords + 1 || !std::is_sorted(offsets.cbegin(), offsets.cend())))) {
+        return false;
+    }
+    // Checked as when reading the dictionaries, which is deferred
+    if (structure.dictionaryBytes > quint64(std::max<qint64>(options.limits.maxDictionaryBytes, 0))) {
+        return false;
+    }
+
+    metadata = structure.metadata;
+    firstImageRecord = structure.firstImageRecord;
+    const qsizetype lastImage = types.lastIndexOf(char(Structure::ImageRecord));
+    imageRecords = std::max<qsizetype>(lastImage + 1 - firstImageRecord, 0);
+    recordOffsets = structure.recordOffsets;
+    toc = structure.toc;
+    return true;
+}
+
+// See Structure::RecordType. Images are classified as by imageCount().
+QByteArray DocumentPrivate::recordTypes()
+{
+    QByteArray types(pdb.recordCount(), char(Structure::OtherRecord));
+    if (types.isEmpty()) {
+        return types;
+    }
+    types[0] = char(Structure::HeaderRecord);
+    for (int i = 1; i < std::min<int>(ntextrecords + 1, types.size()); i++) {
+        types[i] = char(Structure::TextRecord);
+    }
+
+    const QByteArray header = pdb.getRecord(0);
+    if (header.size() >= 0x78 && header[1] == 'H') {
+        const quint32 first = qFromBigEndian<quint32>(header.constData() + 0x70);
+        const quint32 count = qFromBigEndian<quint32>(header.constData() + 0x74);
+        for (quint64 i = first; i < quint64(first) + count && i < quint64(types.size()); i++) {
+            types[i] = char(Structure::DictionaryRecord);
+        }
+    }
+
+    const int images = imageCount();
+    for (int i = firstImageRecord; i < firstImageRecord + images; i++) {
+        const QByteArray record = pdb.getRecord(i);
+        if (record.isNull() || !isNonImageRecord(record)) {
+            types[i] = char(Structure::ImageRecord);
+        }
+    }
+    return types;
+}
+
+bool DocumentPrivate::saveStructure(const QString &fileName)
+{
+    if (!valid) {
+        return false;
+    }
+    if (!firstImageRecord) {
+        findFirstImage();
+    }
+    tableOfContents();
+    // Text records of encrypted books can not be decompressed
+    if (recordOffsets.isEmpty() && !drm && !buildRecordOffsets()) {
+        return false;
+    }
+
+    Structure structure;
+    structure.fingerprint = fingerprint();
+    structure.firstImageRecord = firstImageRecord;
+    structure.recordTypes = recordTypes();
+    for (const auto &record : getHuffRecords(pdb)) {
+        structure.dictionaryBytes += record.size();
+    }
+    structure.metadata = metadata;
+    structure.recordOffsets = recordOffsets;
+    structure.toc = toc;
+    return structure.save(fileName);
+}
+
+QByteArray Document::fingerprint() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->fingerprint();
+}
+
+bool Document::saveStructure(const QString &fileName) const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->saveStructure(fileName);
+}
+
+MemoryUsage DocumentPrivate::memoryUsage() const
+{
+    MemoryUsage usage;
+    usage.dictionaries = dec ? dec->memoryUsage() : 0;
+    usage.records = pdb.retainedBytes();
+    usage.peakBuffers = peakBuffers;
+
+    qint64 structure = recordOffsets.capacity() * sizeof(qint64) + fingerprintHash.capacity();
+    for (const auto &value : metadata) {
+        structure += sizeof(value) + value.capacity() * sizeof(QChar);
+    }
+    if (toc) {
+        structure += toc->capacity() * sizeof(TocEntry);
+        for (const auto &entry : std::as_const(*toc)) {
+            structure += entry.title.capacity() * sizeof(QChar);
+        }
+    }
+    if (kf8Layout) {
+        structure += kf8Layout->flows.capacity() * sizeof(Kf8Layout::Flow) + kf8Layout->parts.capacity() * sizeof(Kf8Layout::Part);
+        for (const auto &part : std::as_const(kf8Layout->parts)) {
+            structure += part.fragments.capacity() * sizeof(Kf8Layout::Fragment);
+        }
+    }
+    usage.structure = structure;
+    return usage;
+}
+
+MemoryUsage Document::memoryUsage() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->memoryUsage();
 }
 
 }
@@ -4,17 +4,232 @@
 #ifndef MOBIPOCKET_H
 #define MOBIPOCKET_H
 
+#include <QDeadlineTimer>
 #include <QImage>
+#include <QList>
 #include <QMap>
 #include <QString>
 
+#include <atomic>
+#include <functional>
+#include <limits>
+
+#include "instrumentation.h"
 #include "qmobipocket_export.h"
 
 class QIODevice;
 
 namespace Mobipocket
 {
+/**
+ * Limits for a single text or image extraction
+ *
+ * All conditions are checked before each record is processed, i.e. a single
+ * record decompression or image decoding is never interrupted. An interrupted
+ * extraction returns a null result.
+ */
+struct ExtractionControl {
+    /// Set from any thread to abandon the extraction
+    const std::atomic_bool *cancel = nullptr;
+    QDeadlineTimer deadline = QDeadlineTimer(QDeadlineTimer::Forever);
+    /**
+     * Called after each record with the number of processed and total records,
+     * on the extracting thread. Return false to abandon the extraction.
+     */
+    std::function<bool(qint64 done, qint64 total)> progress;
+};
+
+/// An entry of the table of contents, i.e. the NCX index
+struct TocEntry {
+    QString title;
+    /// Start in the uncompressed HTML text, in bytes, as the filepos attribute of links
+    qint64 position = 0;
+    /// Length in the uncompressed HTML text, in bytes
+    qint64 length = 0;
+    /// Nesting level, 0 for top level entries
+    int level = 0;
+    /// Index of the parent entry, or -1 for top level entries
+    int parent = -1;
+};
+
+/**
+ * Bounds against pathological books, see OpenOptions::limits
+ *
+ * Exceeding a record limit makes the text corrupt, i.e. extraction returns a
+ * null result and the document becomes invalid. The defaults exceed real
+ * world books by far.
+ */
+struct Limits {
+    /// Decompressed size of a single text record
+    qint64 maxRecordBytes = 16 * 1024 * 1024;
+    /// Work units per text record, i.e. Huffdic symbols including nested ones
+    qint64 maxRecordWork = 16 * 1024 * 1024;
+    /// Nesting of Huffdic dictionary entries
+    int maxRecursionDepth = 32;
+    /// Size of all HUFF and CDIC records, a book with larger ones is invalid
+    qint64 maxDictionaryBytes = 64 * 1024 * 1024;
+    /// Decompressed size of the whole text or a range of it. Extraction beyond
+    /// returns a null result, but the document remains valid.
+    qint64 maxTextBytes = std::numeric_limits<qint64>::max();
+};
+
+/**
+ * Options for opening a document
+ *
+ * Parts are only relevant for sequential devices, e.g. pipes or sockets.
+ * These are read in a single pass while constructing the document, and only
+ * the records of the requested parts are kept in memory. Other parts are
+ * empty afterwards.
+ */
+struct OpenOptions {
+    enum Part {
+        Metadata = 0x1,
+        Text = 0x2,
+        Images = 0x4,
+        TableOfContents = 0x8,
+        Thumbnail = 0x10,
+        AllParts = 0xff
+    };
+    Q_DECLARE_FLAGS(Parts, Part)
+
+    /**
+     * The book to open from a combination file, which holds a MOBI 7 book
+     * followed by a KF8 book of the same content. All text, image and index
+     * operations are restricted to the records of that book.
+     */
+    enum Section {
+        Mobi7Section,
+        /// Opens the file as a whole if it holds no KF8 book
+        Kf8Section,
+    };
+
+    Parts parts = AllParts;
+    /// Indices of the images to keep with Images, all images if empty
+    QList<int> images;
+    /// Maximum wait for more data from a sequential device, in milliseconds
+    int readTimeout = 30000;
+    /**
+     * Structure file written by Document::saveStructure() for this book. If
+     * it matches the book, reopening skips image probing, locating the text
+     * records and parsing the table of contents. Huffdic dictionaries are
+     * then only read on first use of the text. Ignored otherwise.
+     */
+    QString structurePath;
+    Limits limits;
+    Section section = Mobi7Section;
+    /**
+     * Text records queued between reading, decompressing and transcoding the
+     * text, e.g. for text() or streamText(). The stages then overlap, on idle
+     * threads of the global thread pool, e.g. to hide the latency of slow
+     * storage. 0 runs all stages on the calling thread.
+     */
+    int pipelineDepth = 0;
+};
+
+/// Result of Document::validate()
+struct ValidationReport {
+    enum Check {
+        /// PDB header and record table
+        RecordTable,
+        /// PalmDOC and MOBI header in record 0
+        Header,
+        Exth,
+        /// HUFF and CDIC records of Huffdic compressed books
+        Dictionary,
+        TextRecord,
+        ImageRecord,
+    };
+    struct Issue {
+        Check check;
+        /// The affected record in the file, or -1
+        int record = -1;
+        QString message;
+    };
+
+    /// Sorted by record
+    QList<Issue> issues;
+    /// False if interrupted, not all records were checked then
+    bool complete = true;
+    /// Text records are not checked for encrypted books
+    bool drm = false;
+    int textRecords = 0;
+    /// Records holding a readable image
+    int imageRecords = 0;
+    /// Sum of the decompressed text record sizes
+    qint64 textLength = 0;
+
+    bool isValid() const
+    {
+        return complete && issues.isEmpty();
+    }
+};
+
+/// Result of Document::textStatistics(), counted in the text returned by Document::plainText()
+struct QMOBIPOCKET_EXPORT TextStatistics {
+    /// Unicode code points, excluding line breaks
+    qint64 characters = 0;
+    /// Runs of non-whitespace characters
+    qint64 words = 0;
+    /// Non-empty lines
+    qint64 paragraphs = 0;
+    /// False if interrupted or the text is corrupt, the counts are partial then
+    bool complete = true;
+
+    /// Counts of @p plainText already extracted, e.g. by plainText() or TextCache
+    static TextStatistics count(QStringView plainText);
+
+    /// Estimated reading time at @p wordsPerMinute, rounded up
+    qint64 readingMinutes(int wordsPerMinute = 250) const
+    {
+        return wordsPerMinute > 0 ? (words + wordsPerMinute - 1) / wordsPerMinute : 0;
+    }
+    /// Estimated number of printed pages of @p charactersPerPage, rounded up
+    qint64 pages(int charactersPerPage = 1500) const
+    {
+        return charactersPerPage > 0 ? (characters + charactersPerPage - 1) / charactersPerPage : 0;
+    }
+};
+
+/// Estimated memory held by a Document, in bytes
+struct MemoryUsage {
+    /// Tables of the decompressor, i.e. HUFF and CDIC records
+    qint64 dictionaries = 0;
+    /// Records kept from sequential devices
+    qint64 records = 0;
+    /// Metadata, table of contents, text record offsets and KF8 layout
+    qint64 structure = 0;
+    /// Largest temporary buffers of a single call so far, excluding the result. Not part of total().
+    qint64 peakBuffers = 0;
+
+    qint64 total() const
+    {
+        return dictionaries + records + structure;
+    }
+};
+
+/**
+ * Positional access to a book in custom storage, see Document
+ *
+ * Unlike a QIODevice, a reader has no current position. readAt() is called
+ * from multiple threads at once and must be thread-safe.
+ */
+class QMOBIPOCKET_EXPORT RandomAccessReader
+{
+public:
+    virtual ~RandomAccessReader();
+    /// Size of the book in bytes
+    virtual qint64 size() const = 0;
+    /// @p length bytes starting at @p offset, fewer only at the end of the book or on errors
+    virtual QByteArray readAt(qint64 offset, qint64 length) const = 0;
+};
+
 struct DocumentPrivate;
+/**
+ * A Mobipocket document
+ *
+ * All methods may be called from multiple threads, calls are serialized.
+ * See Async for non-blocking variants.
+ */
 class QMOBIPOCKET_EXPORT Document
 {
 public:
@@ -30,25 +245,172 @@ public:
      * Mobipocket::Document constructor
      *
      * @params device The IO device corresponding to the mobipocket document. The device must
-     * be open for read operations, not sequential and the document does not take ownership of
-     * the device.
+     * be open for read operations and the document does not take ownership of the device.
+     * Sequential devices are read completely here, see OpenOptions.
      */
     explicit Document(QIODevice *device);
+    Document(QIODevice *device, const OpenOptions &options);
+    /**
+     * Opens a book held in memory. Records are read as slices of @p data,
+     * without copying, and shared with @p data.
+     */
+    explicit Document(const QByteArray &data, const OpenOptions &options = OpenOptions());
+    /// @overload, @p data must remain valid while the document exists
+    explicit Document(QByteArrayView data, const OpenOptions &options = OpenOptions());
+    /**
+     * Opens a book from custom storage. Records are read with
+     * RandomAccessReader::readAt(), not serialized with other calls where
+     * possible, e.g. by validate(). The document does not take ownership of
+     * @p reader, which must remain valid while the document exists.
+     */
+    explicit Document(const RandomAccessReader *reader, const OpenOptions &options = OpenOptions());
     virtual ~Document();
 
     QMap<MetaKey, QString> metadata() const;
     QString text(int size=-1) const;
+    /// @overload, returns a null string if interrupted by @p control
+    QString text(const ExtractionControl &control, int size = -1) const;
+    /**
+     * The text without markup, with one line per paragraph. Converted while
+     * decompressing, without creating the HTML text first.
+     * @p size limits the text as for text().
+     */
+    QString plainText(int size = -1) const;
+    /// @overload, returns a null string if interrupted by @p control
+    QString plainText(const ExtractionControl &control, int size = -1) const;
+    /**
+     * Passes the text returned by plainText() to @p sink in consecutive chunks,
+     * about one record each, without keeping the complete text. @p sink must not
+     * call back into the document.
+     * @return false if interrupted by @p control or the text is corrupt
+     */
+    bool streamPlainText(const std::function<void(QStringView chunk)> &sink, const ExtractionControl &control = {}) const;
+    /**
+     * As streamPlainText(), also passing the position of each character of
+     * @p chunk in the uncompressed text, as used by textRange() and TocEntry.
+     * Characters decoded from an entity are at the position of its '&'.
+     */
+    bool streamPlainTextWithPositions(const std::function<void(QStringView chunk, const QList<qint64> &positions)> &sink,
+                                      const ExtractionControl &control = {}) const;
+    /// As streamPlainText(), for the HTML text returned by text()
+    bool streamText(const std::function<void(QStringView chunk)> &sink, const ExtractionControl &control = {}) const;
+    /**
+     * Counts of the text returned by plainText(), without creating it. Text
+     * records are decompressed in parallel on the global thread pool, a few
+     * at a time, and counted in order. Progress of @p control is reported
+     * from the calling thread. Empty and not complete for invalid books and
+     * books protected by DRM.
+     */
+    TextStatistics textStatistics(const ExtractionControl &control = {}) const;
+    /// Empty if the book has no (valid) NCX index. Parsed on first use.
+    QList<TocEntry> tableOfContents() const;
+    /**
+     * Part of the HTML text, @p length bytes starting at @p position, e.g. of a
+     * TocEntry. Only the text records spanned by the range are decompressed.
+     */
+    QString textRange(qint64 position, qint64 length) const;
+    /// @overload, returns a null string if interrupted by @p control
+    QString textRange(qint64 position, qint64 length, const ExtractionControl &control) const;
+
+    /**
+     * Whether the text is a KF8 (AZW3) book, i.e. divided into flows and parts.
+     * text() returns the stored text then, with the parts not assembled.
+     */
+    bool isKf8() const;
+    /**
+     * Flows of the text, located by the FDST record of KF8 books. Flow 0 holds
+     * the parts, the others e.g. CSS or SVG. Other books have a single flow.
+     * Only the text records spanned by a flow are decompressed.
+     */
+    int flowCount() const;
+    QString flow(int i) const;
+    /**
+     * HTML files of a KF8 book, each assembled from a skeleton and its
+     * fragments, as described by the SKEL and FRAG indices. None for other
+     * books. Only the text records spanned by a part are decompressed.
+     */
+    int partCount() const;
+    QString part(int i) const;
+
+    /**
+     * Number of image records, excluding the FLIS, FCIS, index and other
+     * records following the images. Records between images are counted.
+     */
     int imageCount() const;
     QImage getImage(int i) const;
+    /**
+     * The undecoded record of image @p i, e.g. to store it without re-encoding.
+     * Null if out of range, not checked to be an image.
+     */
+    QByteArray imageData(int i) const;
+    /**
+     * The undecoded records of images @p first to @p first + @p count - 1, read
+     * in one call, e.g. to decode them concurrently. Ends at imageCount(),
+     * records are not checked to be images.
+     */
+    QList<QByteArray> imageData(int first, int count) const;
+    /**
+     * The undecoded resource record @p i, e.g. an image or a font. Resources
+     * are counted from the first resource record declared in the header, as by
+     * the recindex attributes of the HTML text, which start at 1 though. Unlike
+     * imageData(), not relative to the first record detected as image.
+     * Null if out of range.
+     */
+    QByteArray resourceData(int i) const;
+    /// Number of resource records up to the last image
+    int resourceCount() const;
+    /// @overload, returns a null image if interrupted by @p control
+    QImage getImage(int i, const ExtractionControl &control) const;
     QImage thumbnail() const;
+    /// @overload, returns a null image if interrupted by @p control
+    QImage thumbnail(const ExtractionControl &control) const;
     bool isValid() const;
+    /**
+     * Checks the structure of the book, i.e. whether all records can be
+     * decompressed or decoded, without keeping the text or image pixels.
+     * Records are checked in parallel on the global thread pool, progress
+     * of @p control is reported from the checking threads, serialized.
+     * Works for invalid documents as well, reporting why they are invalid.
+     * Of a combination file, only the opened book is checked.
+     */
+    ValidationReport validate(const ExtractionControl &control = {}) const;
 
     // if true then it is impossible to get text of book. Images should still be readable
     bool hasDRM() const;
 
+    /// Whether the file holds a MOBI 7 and a KF8 book, see OpenOptions::Section
+    bool isCombination() const;
+    /// The opened book of a combination file, Mobi7Section for other files
+    OpenOptions::Section section() const;
+
+    /**
+     * Identifies the book, a SHA-1 hash of the file size, the record table
+     * and the headers in record 0. Suitable as a cache key.
+     */
+    QByteArray fingerprint() const;
+    /**
+     * Writes the parsed structure of the book to @p fileName, for
+     * OpenOptions::structurePath. Probes the images, locates all text records
+     * and parses the table of contents first, where not yet done.
+     * @return false if the document is invalid or the file can not be written
+     */
+    bool saveStructure(const QString &fileName) const;
+
+    /// Memory held between calls, excluding what is allocated during calls, e.g. for text()
+    MemoryUsage memoryUsage() const;
+
+    /**
+     * Counters of the work done for this document, including construction.
+     * Only updated while instrumentation is enabled, see Instrumentation::setEnabled().
+     */
+    Instrumentation::Counters counters() const;
+
     Q_DISABLE_COPY(Document);
 private:
     DocumentPrivate *const d;
 };
 }
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(Mobipocket::OpenOptions::Parts)
+
 #endif
@@ -0,0 +1,57 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef MOBIPOCKET_PARALLEL_P_H
+#define MOBIPOCKET_PARALLEL_P_H
+
+#include <QSemaphore>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <atomic>
+
+namespace Mobipocket
+{
+/**
+ * Calls @p work(begin, end) for consecutive slices of [0, @p count), in
+ * parallel on idle threads of @p pool, and waits for all slices.
+ *
+ * The calling thread processes slices as well, and only threads available
+ * immediately are used. This never waits for a busy pool, and can not
+ * deadlock when called from a pool thread.
+ */
+template<typename Work>
+void parallelFor(qsizetype count, const Work &work, QThreadPool *pool = nullptr)
+{
+    if (count <= 0) {
+        return;
+    }
+    pool = pool ? pool : QThreadPool::globalInstance();
+
+    // A few slices per thread, for balance between slices of unequal cost
+    const qsizetype threads = std::max(1, pool->maxThreadCount());
+    const qsizetype slices = std::min(count, threads * 4);
+    std::atomic<qsizetype> next = 0;
+    auto run = [&]() {
+        for (qsizetype slice = next++; slice < slices; slice = next++) {
+            work(slice * count / slices, (slice + 1) * count / slices);
+        }
+    };
+
+    QSemaphore done;
+    int started = 0;
+    for (qsizetype i = 1; i < std::min(slices, threads); i++) {
+        if (!pool->tryStart([&run, &done]() {
+                run();
+                done.release();
+            })) {
+            break;
+        }
+        started++;
+    }
+    run();
+    done.acquire(started);
+}
+}
+
+#endif
@@ -2,71 +2,215 @@
 // SPDX-License-Identifier: GPL-2.0-or-later
 
 #include "pdb_p.h"
+#include "instrumentation_p.h"
+#include "mobipocket.h"
 
+#include <QHash>
 #include <QIODevice>
 #include <QtEndian>
 
+#include <algorithm>
+
 namespace Mobipocket
 {
 
 struct PDBPrivate {
-    PDBPrivate(QIODevice *dev);
+    PDBPrivate(QIODevice *dev, QByteArrayView data, const RandomAccessReader *reader, Instrumentation::AtomicCounters *counters, int readTimeout);
 
+    // Exactly one of device, data or reader is used
     QIODevice *device;
+    QByteArrayView data;
+    const RandomAccessReader *reader;
+    Instrumentation::AtomicCounters *counters;
     QByteArray fileType;
     QList<quint32> recordOffsets;
+    quint16 declaredRecords = 0;
     bool valid = false;
+    // see PDB::setSection(), absolute indices
+    quint16 first = 0;
+    quint16 end = 0xffff;
+
+    // Sequential devices only
+    bool sequential = false;
+    int readTimeout;
+    // device position, also used while reading the header from other sources
+    qint64 position = 0;
+    // next record to read
+    int nextRecord = 0;
+    QHash<quint16, QByteArray> retained;
+
+    qint64 size() const;
+    // Random access sources only
+    QByteArray readAt(qint64 offset, qint64 size) const;
+    QByteArray read(qint64 size);
+    QByteArray readNextRecord();
 };
 
-PDBPrivate::PDBPrivate(QIODevice *dev)
+PDBPrivate::PDBPrivate(QIODevice *dev, QByteArrayView data, const RandomAccessReader *reader, Instrumentation::AtomicCounters *counters, int readTimeout)
     : device(dev)
+    , data(data)
+    , reader(reader)
+    , counters(counters)
+    , sequential(dev && dev->isSequential())
+    , readTimeout(readTimeout)
 {
-    const auto pdbHead = device->read(0x4e);
+    Instrumentation::PhaseScope scope(counters, Instrumentation::OpenPhase);
+
+    // The device may be shared, e.g. by a previous Document
+    if (device && !sequential && !device->seek(0))
+        return;
+    const auto pdbHead = read(0x4e);
     if (pdbHead.size() < 0x4e)
         return;
 
     fileType = pdbHead.mid(0x3c, 8);
 
     const auto nrecords = qFromBigEndian<quint16>(pdbHead.constData() + 0x4c);
-    const auto recordData = device->read(8 * nrecords);
+    declaredRecords = nrecords;
+    const auto recordData = read(8 * nrecords);
     if (recordData.size() < 8 * nrecords)
         return;
 
+    const qint64 fileSize = size();
+
     quint32 lastOffset = 0x4d + 8 * nrecords;
     for (int i = 0; i < nrecords; i++) {
         const quint32 offset = qFromBigEndian<quint32>(recordData.constData() + 8 * i);
         if (offset < lastOffset) {
             return;
         }
-        if (offset > dev->size()) {
+        // The size of sequential devices is unknown, truncation shows when reading
+        if (!sequential && offset > fileSize) {
             break;
         }
         recordOffsets.append(offset);
         lastOffset = offset;
     }
+
+    if (sequential && !recordOffsets.isEmpty()) {
+        // Record 0 holds the headers, which determine the records to retain
+        retained.insert(0, readNextRecord());
+    }
     valid = true;
 }
 
+qint64 PDBPrivate::size() const
+{
+    if (device) {
+        return sequential ? position : device->size();
+    }
+    return reader ? reader->size() : data.size();
+}
+
+QByteArray PDBPrivate::readAt(qint64 offset, qint64 size) const
+{
+    if (reader) {
+        return reader->readAt(offset, size);
+    }
+    if (offset > data.size()) {
+        return {};
+    }
+    const QByteArrayView slice = data.sliced(offset, std::min(size, data.size() - offset));
+    return QByteArray::fromRawData(slice.data(), slice.size());
+}
+
+QByteArray PDBPrivate::read(qint64 size)
+{
+    if (!device) {
+        QByteArray data = readAt(position, size);
+        position += data.size();
+        return data;
+    }
+    if (!sequential) {
+        return device->read(size);
+    }
+
+    // Chunks, so a corrupt record table can not cause huge allocations
+    constexpr qint64 chunkSize = 64 * 1024;
+    QByteArray data;
+    // Negative size: until the end of the device
+    while (size < 0 || data.size() < size) {
+        const QByteArray chunk = device->read(size < 0 ? chunkSize : std::min(chunkSize, size - data.size()));
+        if (!chunk.isEmpty()) {
+            data += chunk;
+        } else if (!device->waitForReadyRead(readTimeout)) {
+            break;
+        }
+    }
+    position += data.size();
+    return data;
+}
+
+QByteArray PDBPrivate::readNextRecord()
+{
+    const int i = nextRecord++;
+    const qint64 offset = recordOffsets[i];
+    if (position > offset) {
+        return {};
+    }
+    // Skip the gap, usually 2 bytes after the record table
+    if (offset > position && read(offset - position).size() < offset - position) {
+        return {};
+    }
+
+    Instrumentation::PhaseScope scope(counters, Instrumentation::ReadPhase);
+    const qint64 size = (i + 1 < recordOffsets.size()) ? recordOffsets[i + 1] - offset : -1;
+    QByteArray record = read(size);
+    if (Instrumentation::enabled()) {
+        Instrumentation::Counters delta;
+        delta.recordsRead = 1;
+        delta.bytesRead = record.size();
+        Instrumentation::record(counters, delta);
+    }
+    return record;
+}
+
 PDB::~PDB() = default;
 
-PDB::PDB(QIODevice *device)
-    : d(new PDBPrivate(device))
+PDB::PDB(QIODevice *device, Instrumentation::AtomicCounters *counters, int readTimeout)
+    : d(new PDBPrivate(device, {}, nullptr, counters, readTimeout))
+{
+}
+
+PDB::PDB(QByteArrayView data, Instrumentation::AtomicCounters *counters)
+    : d(new PDBPrivate(nullptr, data, nullptr, counters, 0))
+{
+}
+
+PDB::PDB(const RandomAccessReader *reader, Instrumentation::AtomicCounters *counters)
+    : d(new PDBPrivate(nullptr, {}, reader, counters, 0))
 {
 }
 
 QByteArray PDB::getRecord(quint16 i) const
 {
-    if (i >= d->recordOffsets.size()) {
+    if (i >= recordCount()) {
         return QByteArray();
     }
+    i += d->first;
+    if (d->sequential) {
+        return d->retained.value(i);
+    }
 
-    quint32 offset = d->recordOffsets[i];
-    quint32 end = (i + 1 < d->recordOffsets.size()) ? d->recordOffsets[i + 1] : d->device->size();
+    const qint64 offset = d->recordOffsets[i];
+    const qint64 end = (i + 1 < d->recordOffsets.size()) ? d->recordOffsets[i + 1] : d->size();
 
-    if (!d->device->seek(offset))
+    Instrumentation::PhaseScope scope(d->counters, Instrumentation::ReadPhase);
+    QByteArray record;
+    if (!d->device) {
+        record = d->readAt(offset, end - offset);
+    } else if (d->device->seek(offset)) {
+        record = d->device->read(end - offset);
+    } else {
         return QByteArray();
-
-    return d->device->read(end - offset);
+    }
+    if (Instrumentation::enabled()) {
+        Instrumentation::Counters delta;
+        delta.recordsRead = 1;
+        delta.bytesRead = record.size();
+        Instrumentation::record(d->counters, delta);
+    }
+    return record;
 }
 
 QByteArray PDB::fileType() const
@@ -79,10 +223,75 @@ bool PDB::isValid() const
     return d->valid;
 }
 
+bool PDB::isSequential() const
+{
+    return d->sequential;
+}
+
+bool PDB::concurrentReads() const
+{
+    return !d->device;
+}
+
+void PDB::readSequential(const std::function<bool(quint16 i, const QByteArray &record)> &keep, quint16 end)
+{
+    if (!d->sequential) {
+        return;
+    }
+    // Records past the section are not read at all
+    const int last = std::min<int>({d->recordOffsets.size(), d->end, d->first + end});
+    while (d->nextRecord < last) {
+        const quint16 i = d->nextRecord;
+        QByteArray record = d->readNextRecord();
+        if (record.isEmpty() && d->device->atEnd()) {
+            // truncated
+            break;
+        }
+        if (i >= d->first && keep(i - d->first, record)) {
+            d->retained.insert(i, record);
+        }
+    }
+}
+
+void PDB::setSection(quint16 first, quint16 count)
+{
+    d->first = first;
+    d->end = std::min(first + count, 0xffff);
+}
+
+quint16 PDB::sectionStart() const
+{
+    return d->first;
+}
+
 quint16 PDB::recordCount() const
 {
     // Range guaranteed by constructor/PDB field size
-    return d->recordOffsets.size();
+    return std::max(std::min<int>(d->recordOffsets.size(), d->end) - d->first, 0);
+}
+
+quint16 PDB::declaredRecordCount() const
+{
+    return std::max(std::min<int>(d->declaredRecords, d->end) - d->first, 0);
+}
+
+quint32 PDB::recordOffset(quint16 i) const
+{
+    return i < recordCount() ? d->recordOffsets.value(d->first + i) : 0;
+}
+
+qint64 PDB::size() const
+{
+    return d->size();
+}
+
+qint64 PDB::retainedBytes() const
+{
+    qint64 bytes = 0;
+    for (const auto &record : std::as_const(d->retained)) {
+        bytes += record.capacity();
+    }
+    return bytes;
 }
 
 }
@@ -5,25 +5,74 @@
 #define MOBIPOCKET_PDB_P_H
 
 #include <QByteArray>
+#include <QByteArrayView>
 
+#include <functional>
 #include <memory>
 
 class QIODevice;
 
 namespace Mobipocket
 {
+class RandomAccessReader;
+
+namespace Instrumentation
+{
+class AtomicCounters;
+}
+
 struct PDBPrivate;
 class PDB
 {
 public:
-    explicit PDB(QIODevice *device);
+    /**
+     * @param counters if not null, record reads are accounted to it while
+     * instrumentation is enabled. Must outlive the PDB.
+     * @param readTimeout maximum wait for data from sequential devices, in milliseconds
+     *
+     * For sequential devices, only the header, the record table and record 0
+     * are read, see readSequential().
+     */
+    explicit PDB(QIODevice *device, Instrumentation::AtomicCounters *counters = nullptr, int readTimeout = 30000);
+    /// Records are slices of @p data, without copying. @p data must outlive the PDB and its records.
+    explicit PDB(QByteArrayView data, Instrumentation::AtomicCounters *counters = nullptr);
+    /// @p reader must outlive the PDB
+    explicit PDB(const RandomAccessReader *reader, Instrumentation::AtomicCounters *counters = nullptr);
     ~PDB();
 
     QByteArray fileType() const;
+    /**
+     * Restricts the records to the @p count records starting at @p first, e.g.
+     * to one book of a combination file. All record indices are relative to
+     * @p first afterwards.
+     */
+    void setSection(quint16 first, quint16 count);
+    /// Index of record 0 in the file
+    quint16 sectionStart() const;
     quint16 recordCount() const;
+    /// Number of records in the record table, including those starting past the end of the file
+    quint16 declaredRecordCount() const;
+    /// Start of record @p i in the file, @p i < recordCount()
+    quint32 recordOffset(quint16 i) const;
+    /// Size of the file, for sequential devices the number of bytes read so far
+    qint64 size() const;
+    /// Bytes held by records retained from a sequential device
+    qint64 retainedBytes() const;
+    /// For sequential devices, only returns records retained by readSequential()
     QByteArray getRecord(quint16 i) const;
     bool isValid() const;
 
+    bool isSequential() const;
+    /// Whether getRecord() may be called from multiple threads at once, i.e. the PDB is not read from a device
+    bool concurrentReads() const;
+    /**
+     * Reads the remaining records of a sequential device in file order, up to
+     * the end of the section or record @p end, and retains those for which
+     * @p keep returns true. Records before the section are skipped. A later
+     * call continues after the last record read.
+     */
+    void readSequential(const std::function<bool(quint16 i, const QByteArray &record)> &keep, quint16 end = 0xffff);
+
     Q_DISABLE_COPY(PDB);
 
 private:
@@ -0,0 +1,310 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "searchindex.h"
+#include "qmobipocket_debug.h"
+
+#include <QFile>
+#include <QHash>
+#include <QSaveFile>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+/*
+ * Index file layout, all integers little endian:
+ *
+ *   header    magic "MOBIIDX1", quint32 version, quint32 term count,
+ *             quint64 plain text length, quint64 terms offset, quint64 postings offset
+ *   entries   per term, sorted by term: quint32 term start, quint32 term length,
+ *             quint32 postings start, quint32 posting count
+ *   terms     case folded UTF-8 words, starts relative to the terms offset
+ *   postings  per term, LEB128 encoded deltas of ascending positions in the
+ *             uncompressed text, starts relative to the postings offset
+ */
+
+namespace Mobipocket
+{
+namespace
+{
+constexpr char magic[8] = {'M', 'O', 'B', 'I', 'I', 'D', 'X', '1'};
+constexpr quint32 version = 2;
+constexpr qsizetype headerSize = 40;
+constexpr qsizetype entrySize = 16;
+// Longer runs of letters are not words, but e.g. encoded data
+constexpr qsizetype maxTermLength = 64;
+
+template<typename T>
+void appendLittleEndian(QByteArray &out, T value)
+{
+    char buf[sizeof(T)];
+    qToLittleEndian(value, buf);
+    out.append(buf, sizeof(T));
+}
+
+void appendVarint(QByteArray &out, quint64 value)
+{
+    while (value >= 0x80) {
+        out.append(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(char(value));
+}
+
+int compareTerms(QByteArrayView a, QByteArrayView b)
+{
+    if (const auto n = std::min(a.size(), b.size()); n > 0) {
+        if (int r = std::memcmp(a.data(), b.data(), n)) {
+            return r;
+        }
+    }
+    return a.size() < b.size() ? -1 : (a.size() > b.size() ? 1 : 0);
+}
+
+QByteArray termKey(QStringView word)
+{
+    return word.toString().toCaseFolded().toUtf8();
+}
+}
+
+struct SearchIndexPrivate {
+    // Either owns the serialized index, or maps a file
+    QByteArray buffer;
+    std::unique_ptr<QFile> file;
+
+    QByteArrayView data;
+    quint32 termCount = 0;
+    qint64 textLength = 0;
+    QByteArrayView terms;
+    QByteArrayView postings;
+
+    bool setData(QByteArrayView data);
+    QByteArrayView entry(quint32 i) const
+    {
+        return data.sliced(headerSize + qsizetype(i) * entrySize, entrySize);
+    }
+    QByteArrayView term(QByteArrayView entry) const;
+};
+
+bool SearchIndexPrivate::setData(QByteArrayView view)
+{
+    if (view.size() < headerSize || std::memcmp(view.data(), magic, sizeof(magic)) != 0) {
+        return false;
+    }
+    if (qFromLittleEndian<quint32>(view.data() + 8) != version) {
+        return false;
+    }
+
+    const quint32 count = qFromLittleEndian<quint32>(view.data() + 12);
+    const qint64 length = qFromLittleEndian<qint64>(view.data() + 16);
+    const quint64 termsOffset = qFromLittleEndian<quint64>(view.data() + 24);
+    const quint64 postingsOffset = qFromLittleEndian<quint64>(view.data() + 32);
+    const quint64 size = view.size();
+    if (length < 0 || (size - headerSize) / entrySize < count //
+        || termsOffset < headerSize + quint64(count) * entrySize //
+        || postingsOffset < termsOffset || postingsOffset > size) {
+        return false;
+    }
+
+    data = view;
+    termCount = count;
+    textLength = length;
+    terms = view.sliced(termsOffset, postingsOffset - termsOffset);
+    postings = view.sliced(postingsOffset);
+    return true;
+}
+
+QByteArrayView SearchIndexPrivate::term(QByteArrayView entry) const
+{
+    const quint32 start = qFromLittleEndian<quint32>(entry.data());
+    const quint32 length = qFromLittleEndian<quint32>(entry.data() + 4);
+    if (start > terms.size() || length > terms.size() - start) {
+        return {};
+    }
+    return terms.sliced(start, length);
+}
+
+SearchIndex::SearchIndex() = default;
+SearchIndex::~SearchIndex() = default;
+SearchIndex::SearchIndex(SearchIndex &&other) noexcept = default;
+SearchIndex &SearchIndex::operator=(SearchIndex &&other) noexcept = default;
+
+SearchIndex SearchIndex::build(const Document &document, const ExtractionControl &control)
+{
+    QHash<QByteArray, QList<qint64>> occurrences;
+
+    // Words may span chunks. Positions are in the uncompressed text, the
+    // plain text is only counted.
+    QString word;
+    qint64 wordStart = 0;
+    qint64 plainLength = 0;
+    auto addWord = [&]() {
+        if (word.size() <= maxTermLength) {
+            occurrences[termKey(word)].append(wordStart);
+        }
+        word.clear();
+    };
+
+    const bool complete = document.streamPlainTextWithPositions(
+        [&](QStringView chunk, const QList<qint64> &positions) {
+            for (qsizetype i = 0; i < chunk.size(); i++) {
+                const QChar c = chunk[i];
+                if (c.isLetterOrNumber() || c.isSurrogate()) {
+                    if (word.isEmpty()) {
+                        wordStart = positions[i];
+                    }
+                    word.append(c);
+                } else if (!word.isEmpty()) {
+                    addWord();
+                }
+                plainLength++;
+            }
+        },
+        control);
+    if (!complete) {
+        return {};
+    }
+    if (!word.isEmpty()) {
+        addWord();
+    }
+
+    QList<QByteArray> keys = occurrences.keys();
+    std::sort(keys.begin(), keys.end(), [](const QByteArray &a, const QByteArray &b) {
+        return compareTerms(a, b) < 0;
+    });
+
+    QByteArray entries;
+    QByteArray terms;
+    QByteArray postings;
+    entries.reserve(keys.size() * entrySize);
+    for (const auto &key : std::as_const(keys)) {
+        const auto &positions = occurrences[key];
+        appendLittleEndian<quint32>(entries, terms.size());
+        appendLittleEndian<quint32>(entries, key.size());
+        appendLittleEndian<quint32>(entries, postings.size());
+        appendLittleEndian<quint32>(entries, positions.size());
+        terms.append(key);
+        qint64 previous = 0;
+        for (qint64 position : positions) {
+            appendVarint(postings, position - previous);
+            previous = position;
+        }
+    }
+    if (postings.size() > std::numeric_limits<quint32>::max()) {
+        qCWarning(QMOBIPOCKET_LOG) << "Search index exceeds 4 GB";
+        return {};
+    }
+
+    QByteArray buffer;
+    buffer.reserve(headerSize + entries.size() + terms.size() + postings.size());
+    buffer.append(magic, sizeof(magic));
+    appendLittleEndian<quint32>(buffer, version);
+    appendLittleEndian<quint32>(buffer, keys.size());
+    appendLittleEndian<qint64>(buffer, plainLength);
+    appendLittleEndian<quint64>(buffer, headerSize + entries.size());
+    appendLittleEndian<quint64>(buffer, headerSize + entries.size() + terms.size());
+    buffer.append(entries);
+    buffer.append(terms);
+    buffer.append(postings);
+
+    SearchIndex index;
+    index.d = std::make_unique<SearchIndexPrivate>();
+    index.d->buffer = buffer;
+    index.d->setData(index.d->buffer);
+    return index;
+}
+
+SearchIndex SearchIndex::load(const QString &fileName)
+{
+    auto d = std::make_unique<SearchIndexPrivate>();
+    d->file = std::make_unique<QFile>(fileName);
+    if (!d->file->open(QIODevice::ReadOnly) || d->file->size() < headerSize) {
+        return {};
+    }
+    const uchar *mapped = d->file->map(0, d->file->size());
+    if (!mapped || !d->setData(QByteArrayView(mapped, d->file->size()))) {
+        return {};
+    }
+
+    SearchIndex index;
+    index.d = std::move(d);
+    return index;
+}
+
+bool SearchIndex::save(const QString &fileName) const
+{
+    if (!d) {
+        return false;
+    }
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(d->data.data(), d->data.size()) != d->data.size()) {
+        return false;
+    }
+    return file.commit();
+}
+
+bool SearchIndex::isValid() const
+{
+    return d != nullptr;
+}
+
+qint64 SearchIndex::termCount() const
+{
+    return d ? d->termCount : 0;
+}
+
+qint64 SearchIndex::textLength() const
+{
+    return d ? d->textLength : 0;
+}
+
+QList<qint64> SearchIndex::find(QStringView word) const
+{
+    if (!d) {
+        return {};
+    }
+
+    const QByteArray key = termKey(word);
+    quint32 lo = 0;
+    quint32 hi = d->termCount;
+    while (lo < hi) {
+        const quint32 mid = lo + (hi - lo) / 2;
+        const auto entry = d->entry(mid);
+        const int r = compareTerms(d->term(entry), key);
+        if (r < 0) {
+            lo = mid + 1;
+        } else if (r > 0) {
+            hi = mid;
+        } else {
+            const quint32 start = qFromLittleEndian<quint32>(entry.data() + 8);
+            const quint32 count = qFromLittleEndian<quint32>(entry.data() + 12);
+            if (start > d->postings.size()) {
+                return {};
+            }
+            // Each position takes at least one byte, which bounds the allocation
+            QList<qint64> positions;
+            positions.reserve(std::min<qint64>(count, d->postings.size() - start));
+            const auto *p = reinterpret_cast<const uchar *>(d->postings.data()) + start;
+            const auto *end = reinterpret_cast<const uchar *>(d->postings.data()) + d->postings.size();
+            qint64 position = 0;
+            for (quint32 i = 0; i < count; i++) {
+                quint64 delta = 0;
+                int shift = 0;
+                do {
+                    if (p == end || shift > 56) {
+                        return {};
+                    }
+                    delta |= quint64(*p & 0x7f) << shift;
+                    shift += 7;
+                } while (*p++ & 0x80);
+                position += delta;
+                positions.append(position);
+            }
+            return positions;
+        }
+    }
+    return {};
+}
+}
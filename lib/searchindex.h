@@ -0,0 +1,64 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef MOBIPOCKET_SEARCHINDEX_H
+#define MOBIPOCKET_SEARCHINDEX_H
+
+#include <QList>
+#include <QString>
+
+#include <memory>
+
+#include "mobipocket.h"
+#include "qmobipocket_export.h"
+
+namespace Mobipocket
+{
+struct SearchIndexPrivate;
+
+/**
+ * Inverted index of the words in a book
+ *
+ * Maps each word to its positions in the uncompressed text, as used by
+ * Document::textRange() and TocEntry::position, e.g. for the chapter of a
+ * match. Words are runs of letters and digits of Document::plainText(), and
+ * are matched case insensitively.
+ *
+ * The index is built in a single pass over the text records, and can be
+ * stored in a sidecar file. Loading maps the file into memory, so lookups
+ * neither parse the whole file nor touch the book.
+ */
+class QMOBIPOCKET_EXPORT SearchIndex
+{
+public:
+    /// Creates an invalid index
+    SearchIndex();
+    ~SearchIndex();
+    SearchIndex(SearchIndex &&other) noexcept;
+    SearchIndex &operator=(SearchIndex &&other) noexcept;
+
+    /// Returns an invalid index if interrupted by @p control, or if the text is corrupt
+    static SearchIndex build(const Document &document, const ExtractionControl &control = {});
+    /// Returns an invalid index if @p fileName can not be read, or is not a valid index
+    static SearchIndex load(const QString &fileName);
+    bool save(const QString &fileName) const;
+
+    bool isValid() const;
+    /// Number of distinct words
+    qint64 termCount() const;
+    /// Length of the indexed Document::plainText()
+    qint64 textLength() const;
+
+    /**
+     * Ascending positions of @p word in the uncompressed text. The word starts
+     * there, its markup may be longer than @p word, e.g. for entities.
+     */
+    QList<qint64> find(QStringView word) const;
+
+    Q_DISABLE_COPY(SearchIndex);
+
+private:
+    std::unique_ptr<SearchIndexPrivate> d;
+};
+}
+#endif
@@ -0,0 +1,231 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "structure_p.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+/*
+ * Structure file layout, all integers little endian:
+ *
+ *   header    magic "MOBISTR1", quint32 version, quint32 flags (1: toc present),
+ *             20 bytes fingerprint, quint16 first image record, quint16 reserved,
+ *             quint32 metadata count, quint32 record offset count, quint32 toc count,
+ *             quint32 record type count, quint64 dictionary bytes
+ *   types     quint8 Structure::RecordType per record
+ *   metadata  per entry: quint32 key, quint32 length, UTF-8 value
+ *   offsets   qint64 each
+ *   toc       per entry: qint64 position, qint64 length, qint32 level,
+ *             qint32 parent, quint32 title length, UTF-8 title
+ */
+
+namespace Mobipocket
+{
+namespace
+{
+constexpr char magic[8] = {'M', 'O', 'B', 'I', 'S', 'T', 'R', '1'};
+constexpr quint32 version = 2;
+constexpr quint32 tocFlag = 0x1;
+constexpr qsizetype fingerprintSize = 20;
+constexpr qsizetype headerSize = 64;
+
+template<typename T>
+void appendLittleEndian(QByteArray &out, T value)
+{
+    char buf[sizeof(T)];
+    qToLittleEndian(value, buf);
+    out.append(buf, sizeof(T));
+}
+
+void appendString(QByteArray &out, const QString &s)
+{
+    const QByteArray utf8 = s.toUtf8();
+    appendLittleEndian<quint32>(out, utf8.size());
+    out.append(utf8);
+}
+
+// Bounds checked sequential reads, any read past the end fails all following ones
+class Reader
+{
+public:
+    explicit Reader(QByteArrayView data)
+        : data(data)
+    {
+    }
+
+    template<typename T>
+    T read()
+    {
+        if (!ok || data.size() - pos < qsizetype(sizeof(T))) {
+            ok = false;
+            return T();
+        }
+        const T value = qFromLittleEndian<T>(data.data() + pos);
+        pos += sizeof(T);
+        return value;
+    }
+
+    QByteArrayView bytes(quint64 size)
+    {
+        if (!ok || quint64(data.size() - pos) < size) {
+            ok = false;
+            return {};
+        }
+        const auto view = data.sliced(pos, size);
+        pos += size;
+        return view;
+    }
+
+    QString string()
+    {
+        const quint32 size = read<quint32>();
+        return QString::fromUtf8(bytes(size));
+    }
+
+    // Whether @p count items of at least @p itemSize bytes can follow
+    bool fits(quint64 count, quint64 itemSize) const
+    {
+        return ok && count <= quint64(data.size() - pos) / itemSize;
+    }
+
+    bool ok = true;
+
+private:
+    QByteArrayView data;
+    qsizetype pos = 0;
+};
+}
+
+QByteArray Structure::serialize() const
+{
+    QByteArray out;
+    out.append(magic, sizeof(magic));
+    appendLittleEndian<quint32>(out, version);
+    appendLittleEndian<quint32>(out, toc ? tocFlag : 0);
+    out.append(fingerprint.leftJustified(fingerprintSize, '\0', true));
+    appendLittleEndian<quint16>(out, firstImageRecord);
+    appendLittleEndian<quint16>(out, 0);
+    appendLittleEndian<quint32>(out, metadata.size());
+    appendLittleEndian<quint32>(out, recordOffsets.size());
+    appendLittleEndian<quint32>(out, toc ? toc->size() : 0);
+    appendLittleEndian<quint32>(out, recordTypes.size());
+    appendLittleEndian<quint64>(out, dictionaryBytes);
+
+    out.append(recordTypes);
+    for (const auto &[key, value] : metadata.asKeyValueRange()) {
+        appendLittleEndian<quint32>(out, key);
+        appendString(out, value);
+    }
+    for (qint64 offset : recordOffsets) {
+        appendLittleEndian<qint64>(out, offset);
+    }
+    if (toc) {
+        for (const auto &entry : std::as_const(*toc)) {
+            appendLittleEndian<qint64>(out, entry.position);
+            appendLittleEndian<qint64>(out, entry.length);
+            appendLittleEndian<qint32>(out, entry.level);
+            appendLittleEndian<qint32>(out, entry.parent);
+            appendString(out, entry.title);
+        }
+    }
+    return out;
+}
+
+bool Structure::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly) || file.size() < headerSize) {
+        return false;
+    }
+    const uchar *mapped = file.map(0, file.size());
+    if (!mapped) {
+        return false;
+    }
+    Reader reader(QByteArrayView(mapped, file.size()));
+
+    if (std::memcmp(reader.bytes(sizeof(magic)).data(), magic, sizeof(magic)) != 0 || reader.read<quint32>() != version) {
+        return false;
+    }
+    const quint32 flags = reader.read<quint32>();
+    const QByteArray storedFingerprint = reader.bytes(fingerprintSize).toByteArray();
+    const quint16 firstImage = reader.read<quint16>();
+    reader.read<quint16>();
+    const quint32 metadataCount = reader.read<quint32>();
+    const quint32 offsetCount = reader.read<quint32>();
+    const quint32 tocCount = reader.read<quint32>();
+    const quint32 typeCount = reader.read<quint32>();
+    const quint64 storedDictionaryBytes = reader.read<quint64>();
+
+    const QByteArray types = reader.bytes(typeCount).toByteArray();
+    if (std::any_of(types.cbegin(), types.cend(), [](char type) {
+            return quint8(type) > OtherRecord;
+        })) {
+        return false;
+    }
+
+    // Counts are checked against the remaining size before reserving
+    QMap<Document::MetaKey, QString> storedMetadata;
+    for (quint32 i = 0; i < metadataCount && reader.ok; i++) {
+        const quint32 key = reader.read<quint32>();
+        const QString value = reader.string();
+        if (key > Document::Subject) {
+            return false;
+        }
+        storedMetadata.insert(Document::MetaKey(key), value);
+    }
+
+    if (!reader.fits(offsetCount, sizeof(qint64))) {
+        return false;
+    }
+    QList<qint64> offsets;
+    offsets.reserve(offsetCount);
+    for (quint32 i = 0; i < offsetCount; i++) {
+        offsets.append(reader.read<qint64>());
+    }
+
+    std::optional<QList<TocEntry>> storedToc;
+    if (flags & tocFlag) {
+        if (!reader.fits(tocCount, 28)) {
+            return false;
+        }
+        storedToc.emplace();
+        storedToc->reserve(tocCount);
+        for (quint32 i = 0; i < tocCount; i++) {
+            TocEntry entry;
+            entry.position = reader.read<qint64>();
+            entry.length = reader.read<qint64>();
+            entry.level = reader.read<qint32>();
+            entry.parent = reader.read<qint32>();
+            entry.title = reader.string();
+            storedToc->append(entry);
+        }
+    }
+
+    if (!reader.ok) {
+        return false;
+    }
+    fingerprint = storedFingerprint;
+    firstImageRecord = firstImage;
+    recordTypes = types;
+    dictionaryBytes = storedDictionaryBytes;
+    metadata = storedMetadata;
+    recordOffsets = offsets;
+    toc = storedToc;
+    return true;
+}
+
+bool Structure::save(const QString &fileName) const
+{
+    const QByteArray data = serialize();
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size()) {
+        return false;
+    }
+    return file.commit();
+}
+}
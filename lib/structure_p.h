@@ -0,0 +1,57 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef MOBIPOCKET_STRUCTURE_P_H
+#define MOBIPOCKET_STRUCTURE_P_H
+
+#include <QByteArray>
+#include <QList>
+#include <QMap>
+
+#include <optional>
+
+#include "mobipocket.h"
+
+namespace Mobipocket
+{
+/**
+ * State of a Document which is expensive to recreate, as stored in a
+ * structure file (see OpenOptions::structurePath)
+ *
+ * Everything else is parsed from the book on each open, as it is cheap or
+ * is needed to verify the fingerprint anyway. HUFF and CDIC dictionaries are
+ * not copied, a copy would cost the same I/O. With a structure file they are
+ * only read on first use of the text instead.
+ */
+struct Structure {
+    enum RecordType : quint8 {
+        HeaderRecord,
+        TextRecord,
+        DictionaryRecord,
+        ImageRecord,
+        /// FLIS, FCIS, index and other records
+        OtherRecord,
+    };
+
+    /// Of the book, see DocumentPrivate::fingerprint()
+    QByteArray fingerprint;
+    /// Saves probing the records following the text
+    quint16 firstImageRecord = 0;
+    /// One RecordType per record, saves reading the records following the images
+    QByteArray recordTypes;
+    /// Size of the HUFF and CDIC records, checked against the limit without reading them
+    quint64 dictionaryBytes = 0;
+    /// Including the metadata from the HTML head, which needs record 1 decompressed
+    QMap<Document::MetaKey, QString> metadata;
+    /// Saves decompressing all text records for books with irregular records
+    QList<qint64> recordOffsets;
+    std::optional<QList<TocEntry>> toc;
+
+    QByteArray serialize() const;
+    /// Maps and parses @p fileName, returns false if it can not be read or is corrupt
+    bool load(const QString &fileName);
+    bool save(const QString &fileName) const;
+};
+}
+
+#endif
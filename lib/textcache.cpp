@@ -0,0 +1,224 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "textcache.h"
+#include "qmobipocket_debug.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QMutex>
+#include <QSaveFile>
+
+#include <cstring>
+
+/*
+ * Cache file layout, integers in host byte order, as the text:
+ *
+ *   header    magic "MOBITXT1", quint16 byte order mark 0xfeff, quint16 format,
+ *             20 bytes fingerprint, quint32 reserved, qint64 text length in
+ *             UTF-16 code units
+ *   text      UTF-16
+ */
+
+namespace Mobipocket
+{
+namespace
+{
+constexpr char magic[8] = {'M', 'O', 'B', 'I', 'T', 'X', 'T', '1'};
+constexpr quint16 byteOrderMark = 0xfeff;
+constexpr qsizetype fingerprintSize = 20;
+constexpr qsizetype lengthOffset = 36;
+constexpr qsizetype headerSize = 44;
+
+// Oldest first with QDir::Time | QDir::Reversed
+QFileInfoList cacheFiles(const QString &directory, QDir::SortFlags sort = QDir::NoSort)
+{
+    return QDir(directory).entryInfoList({QStringLiteral("*.cache")}, QDir::Files, sort);
+}
+
+QByteArray header(const QByteArray &fingerprint, TextCache::Format format, qint64 length)
+{
+    QByteArray out(headerSize, '\0');
+    char *d = out.data();
+    std::memcpy(d, magic, sizeof(magic));
+    const quint16 values[] = {byteOrderMark, quint16(format)};
+    std::memcpy(d + 8, values, sizeof(values));
+    std::memcpy(d + 12, fingerprint.constData(), std::min(fingerprint.size(), fingerprintSize));
+    std::memcpy(d + lengthOffset, &length, sizeof(length));
+    return out;
+}
+}
+
+struct TextCachePrivate {
+    QString directory;
+    // guards all members below, and eviction
+    mutable QMutex mutex;
+    qint64 maxSize;
+    TextCache::Statistics statistics;
+
+    QString fileName(const QByteArray &fingerprint, TextCache::Format format) const;
+    TextCache::Text map(const QString &fileName, const QByteArray &fingerprint, TextCache::Format format) const;
+    bool write(const QString &fileName, const Document &document, TextCache::Format format, const ExtractionControl &control) const;
+    void evict(const QString &keep);
+};
+
+QString TextCachePrivate::fileName(const QByteArray &fingerprint, TextCache::Format format) const
+{
+    const QString name = QString::fromLatin1(fingerprint.toHex()) + (format == TextCache::Html ? QLatin1String(".html") : QLatin1String(".txt"));
+    return directory + QLatin1Char('/') + name + QLatin1String(".cache");
+}
+
+TextCache::Text TextCachePrivate::map(const QString &fileName, const QByteArray &fingerprint, TextCache::Format format) const
+{
+    auto file = std::make_shared<QFile>(fileName);
+    if (!file->open(QIODevice::ReadOnly) || file->size() < headerSize) {
+        return {};
+    }
+    const uchar *mapped = file->map(0, file->size());
+    const QByteArray expected = header(fingerprint, format, 0);
+    if (!mapped || std::memcmp(mapped, expected.constData(), lengthOffset) != 0) {
+        return {};
+    }
+    qint64 length;
+    std::memcpy(&length, mapped + lengthOffset, sizeof(length));
+    if (length < 0 || length != (file->size() - headerSize) / 2) {
+        return {};
+    }
+
+    // Marks the file as recently used for eviction, for all processes sharing the directory
+    file->setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+
+    TextCache::Text text;
+    text.data = QStringView(reinterpret_cast<const QChar *>(mapped + headerSize), length);
+    text.file = std::move(file);
+    return text;
+}
+
+bool TextCachePrivate::write(const QString &fileName, const Document &document, TextCache::Format format, const ExtractionControl &control) const
+{
+    // The text is written as extracted, without holding all of it
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(header({}, format, 0)) != headerSize) {
+        return false;
+    }
+    qint64 length = 0;
+    bool written = true;
+    auto sink = [&](QStringView chunk) {
+        const qint64 bytes = chunk.size() * sizeof(QChar);
+        written = written && file.write(reinterpret_cast<const char *>(chunk.data()), bytes) == bytes;
+        length += chunk.size();
+    };
+    const bool complete = format == TextCache::Html ? document.streamText(sink, control) : document.streamPlainText(sink, control);
+    if (!complete || !written) {
+        file.cancelWriting();
+        return false;
+    }
+
+    const QByteArray completeHeader = header(document.fingerprint(), format, length);
+    if (!file.seek(0) || file.write(completeHeader) != headerSize) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+void TextCachePrivate::evict(const QString &keep)
+{
+    const QFileInfoList files = cacheFiles(directory, QDir::Time | QDir::Reversed);
+    qint64 size = 0;
+    for (const auto &info : files) {
+        size += info.size();
+    }
+    for (const auto &info : files) {
+        if (size <= maxSize) {
+            break;
+        }
+        if (info.filePath() == keep || !QFile::remove(info.filePath())) {
+            continue;
+        }
+        size -= info.size();
+        statistics.evictions++;
+    }
+}
+
+TextCache::TextCache(const QString &directory, qint64 maxSize)
+    : d(std::make_unique<TextCachePrivate>())
+{
+    d->directory = QDir(directory).absolutePath();
+    d->maxSize = maxSize;
+    if (!QDir().mkpath(d->directory)) {
+        qCWarning(QMOBIPOCKET_LOG) << "Can not create text cache directory" << d->directory;
+    }
+}
+
+TextCache::~TextCache() = default;
+
+TextCache::Text TextCache::text(const Document &document, Format format, const ExtractionControl &control)
+{
+    const QByteArray fingerprint = document.fingerprint();
+    if (fingerprint.isEmpty()) {
+        return {};
+    }
+    const QString fileName = d->fileName(fingerprint, format);
+    if (Text text = d->map(fileName, fingerprint, format); !text.isNull()) {
+        QMutexLocker locker(&d->mutex);
+        d->statistics.hits++;
+        return text;
+    }
+
+    {
+        QMutexLocker locker(&d->mutex);
+        d->statistics.misses++;
+    }
+    if (!document.isValid() || document.hasDRM() || !d->write(fileName, document, format, control)) {
+        return {};
+    }
+    {
+        QMutexLocker locker(&d->mutex);
+        d->evict(fileName);
+    }
+    return d->map(fileName, fingerprint, format);
+}
+
+QString TextCache::directory() const
+{
+    return d->directory;
+}
+
+qint64 TextCache::size() const
+{
+    qint64 size = 0;
+    for (const auto &info : cacheFiles(d->directory)) {
+        size += info.size();
+    }
+    return size;
+}
+
+qint64 TextCache::maxSize() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->maxSize;
+}
+
+void TextCache::setMaxSize(qint64 bytes)
+{
+    QMutexLocker locker(&d->mutex);
+    d->maxSize = bytes;
+    d->evict({});
+}
+
+void TextCache::clear()
+{
+    QMutexLocker locker(&d->mutex);
+    for (const auto &info : cacheFiles(d->directory)) {
+        QFile::remove(info.filePath());
+    }
+}
+
+TextCache::Statistics TextCache::statistics() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->statistics;
+}
+}
@@ -0,0 +1,100 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef MOBIPOCKET_TEXTCACHE_H
+#define MOBIPOCKET_TEXTCACHE_H
+
+#include <QString>
+#include <QStringView>
+
+#include <memory>
+
+#include "mobipocket.h"
+#include "qmobipocket_export.h"
+
+class QFile;
+
+namespace Mobipocket
+{
+struct TextCachePrivate;
+
+/**
+ * Extracted text of books, cached in the files of a directory
+ *
+ * Files are keyed by Document::fingerprint(), and hold the text as UTF-16 in
+ * the byte order of the host. A cached text is mapped into memory, instead
+ * of decompressing and transcoding the book again. Beyond the size limit,
+ * the least recently used files are removed.
+ *
+ * The directory may be shared by multiple processes, files are written
+ * atomically. All methods may be called from multiple threads.
+ */
+class QMOBIPOCKET_EXPORT TextCache
+{
+public:
+    enum Format {
+        /// As Document::text()
+        Html,
+        /// As Document::plainText()
+        PlainText,
+    };
+
+    /// A text mapped from a cache file, which stays mapped while a copy exists
+    class QMOBIPOCKET_EXPORT Text
+    {
+    public:
+        bool isNull() const
+        {
+            return !file;
+        }
+        QStringView view() const
+        {
+            return data;
+        }
+        QString toString() const
+        {
+            return isNull() ? QString() : data.toString();
+        }
+
+    private:
+        friend struct TextCachePrivate;
+        std::shared_ptr<QFile> file;
+        QStringView data;
+    };
+
+    struct Statistics {
+        qint64 hits = 0;
+        qint64 misses = 0;
+        /// Files removed for the size limit
+        qint64 evictions = 0;
+    };
+
+    /// Creates @p directory if needed
+    explicit TextCache(const QString &directory, qint64 maxSize = 1024 * 1024 * 1024);
+    ~TextCache();
+
+    /**
+     * The text of @p document in @p format, extracted into the cache first if
+     * not cached yet. Null if the document is invalid or protected by DRM, if
+     * interrupted by @p control, or if the cache file can not be written.
+     */
+    Text text(const Document &document, Format format = Html, const ExtractionControl &control = {});
+
+    QString directory() const;
+    /// Size of all cache files, in bytes
+    qint64 size() const;
+    qint64 maxSize() const;
+    /// Removes files as needed
+    void setMaxSize(qint64 bytes);
+    /// Removes all cache files
+    void clear();
+
+    Statistics statistics() const;
+
+    Q_DISABLE_COPY(TextCache);
+
+private:
+    std::unique_ptr<TextCachePrivate> d;
+};
+}
+#endif
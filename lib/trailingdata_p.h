@@ -0,0 +1,63 @@
+// SPDX-FileCopyrightText: 2008 by Jakub Stachowski <qbast@go2.pl>
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef MOBIPOCKET_TRAILINGDATA_P_H
+#define MOBIPOCKET_TRAILINGDATA_P_H
+
+#include <QByteArrayView>
+
+#include <algorithm>
+
+namespace Mobipocket
+{
+/**
+ * Length of a text record without the trailing entries announced by the
+ * extra data flags of the MOBI header.
+ */
+constexpr qsizetype preTrailingDataLength(QByteArrayView data, quint32 flags)
+{
+    if (flags == 0) {
+        return data.size();
+    }
+
+    for (int i = 31; i > 0; i--) {
+        if ((flags & (1u << i)) == 0) {
+            continue;
+        }
+
+        qsizetype chopN = 0;
+        for (int j = 0; j < 4; j++) {
+            if (j + 1 > data.size()) {
+                return 0;
+            }
+            quint8 l = data.at(data.size() - (j + 1));
+            chopN |= (l & 0x7f) << (7 * j);
+            if (l & 0x80) {
+                break;
+            }
+        }
+        data.chop(std::min<qsizetype>(chopN, data.size()));
+    }
+    if ((flags & 0x1) && !data.isEmpty()) {
+        quint8 l = data.back() & 0x3;
+        data.chop(std::min<qsizetype>(l + 1, data.size()));
+    }
+    return data.size();
+}
+static_assert(preTrailingDataLength({"0\x00", 2}, 0x0) == 2);
+static_assert(preTrailingDataLength({"0\x00", 2}, 0x1) == 1);
+static_assert(preTrailingDataLength({"0\x01", 2}, 0x1) == 0);
+static_assert(preTrailingDataLength({"0\x02", 2}, 0x1) == 0);
+static_assert(preTrailingDataLength({"abcd\x03", 5}, 0x1) == 1);
+static_assert(preTrailingDataLength({"abcd\x81", 5}, 0x2) == 4);
+static_assert(preTrailingDataLength({"\x02\x01", 2}, 0x2) == 0);
+static_assert(preTrailingDataLength({"\x80\x02", 2}, 0x2) == 0);
+static_assert(preTrailingDataLength({"abcd\x85", 5}, 0x2) == 0);
+static_assert(preTrailingDataLength({"abc\x01\x7f\x82", 6}, 0x2) == 4);
+static_assert(preTrailingDataLength({"abc\x01\x80\x02", 6}, 0x2) == 4);
+static_assert(preTrailingDataLength({"abc\x01\x7f\x82", 6}, 0x3) == 2);
+static_assert(preTrailingDataLength({"abc\x81\x80\x02", 6}, 0x6) == 3);
+static_assert(preTrailingDataLength({"abc\x00\x81\x81", 6}, 0x7) == 3);
+} // namespace Mobipocket
+
+#endif
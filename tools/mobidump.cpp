@@ -1,57 +1,503 @@
 #include <QCommandLineParser>
 #include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
 #include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QRegularExpression>
+#include <QSet>
+#include <QStringEncoder>
 #include <QTextStream>
+#include <QThreadPool>
+
+#include <atomic>
 
 #include "mobipocket.h"
 
+namespace
+{
+using namespace Mobipocket::Instrumentation;
+
+struct FileStats {
+    QString fileName;
+    int files = 0;
+    int images = 0;
+    qint64 fileSize = 0;
+    // opening the file, before the library gets involved
+    qint64 fileOpenNsecs = 0;
+    qint64 imageBytes = 0;
+    Counters counters;
+
+    FileStats &operator+=(const FileStats &other)
+    {
+        files += other.files;
+        images += other.images;
+        fileSize += other.fileSize;
+        fileOpenNsecs += other.fileOpenNsecs;
+        imageBytes += other.imageBytes;
+        counters += other.counters;
+        return *this;
+    }
+
+    qint64 totalNsecs() const
+    {
+        qint64 t = fileOpenNsecs;
+        for (auto n : counters.phaseNsecs) {
+            t += n;
+        }
+        return t;
+    }
+
+    qint64 decompressedBytes() const
+    {
+        qint64 t = 0;
+        for (auto n : counters.bytesDecompressed) {
+            t += n;
+        }
+        return t;
+    }
+
+    qint64 phaseBytes(Phase phase) const
+    {
+        switch (phase) {
+        case OpenPhase:
+            return fileSize;
+        case ReadPhase:
+            return counters.bytesRead;
+        case DecompressPhase:
+            return decompressedBytes();
+        case TranscodePhase:
+            return counters.bytesTranscoded;
+        case ImageDecodePhase:
+            return imageBytes;
+        default:
+            return 0;
+        }
+    }
+
+    qint64 phaseNsecs(Phase phase) const
+    {
+        return counters.phaseNsecs[phase] + (phase == OpenPhase ? fileOpenNsecs : 0);
+    }
+
+    // Of the text records only, the file also holds images, dictionaries and indices
+    double compressionRatio() const
+    {
+        return counters.bytesCompressed ? double(decompressedBytes()) / counters.bytesCompressed : 0.0;
+    }
+
+    double recordsPerSecond() const
+    {
+        const auto nsecs = counters.phaseNsecs[DecompressPhase];
+        return nsecs ? counters.recordsDecompressed * 1e9 / nsecs : 0.0;
+    }
+};
+
+bool collectStats(const QString &url, FileStats &stats)
+{
+    QElapsedTimer timer;
+    stats.fileName = url;
+    stats.files = 1;
+
+    timer.start();
+    QFile file(url);
+    if (!file.open(QFile::ReadOnly)) {
+        return false;
+    }
+    stats.fileSize = file.size();
+    stats.fileOpenNsecs = timer.nsecsElapsed();
+
+    Mobipocket::Document doc(&file);
+    if (!doc.isValid()) {
+        return false;
+    }
+
+    if (!doc.hasDRM()) {
+        doc.text();
+    }
+
+    for (int i = 0; i < doc.imageCount(); i++) {
+        if (const QImage img = doc.getImage(i); !img.isNull()) {
+            stats.images++;
+            stats.imageBytes += img.sizeInBytes();
+        }
+    }
+    stats.counters = doc.counters();
+    return true;
+}
+
+QJsonObject statsToJson(const FileStats &stats)
+{
+    QJsonObject phases;
+    for (int i = 0; i < PhaseCount; i++) {
+        const auto phase = static_cast<Phase>(i);
+        phases[QLatin1String(phaseName(phase))] = QJsonObject{
+            {QStringLiteral("ms"), stats.phaseNsecs(phase) / 1e6},
+            {QStringLiteral("bytes"), stats.phaseBytes(phase)},
+        };
+    }
+
+    QJsonObject obj{
+        {QStringLiteral("fileSize"), stats.fileSize},
+        {QStringLiteral("images"), stats.images},
+        {QStringLiteral("imageProbes"), qint64(stats.counters.imageProbes)},
+        {QStringLiteral("recordsRead"), qint64(stats.counters.recordsRead)},
+        {QStringLiteral("recordsDecompressed"), qint64(stats.counters.recordsDecompressed)},
+        {QStringLiteral("compressedBytes"), qint64(stats.counters.bytesCompressed)},
+        {QStringLiteral("recordsPerSecond"), stats.recordsPerSecond()},
+        {QStringLiteral("huffdicSymbols"), qint64(stats.counters.huffdicSymbols)},
+        {QStringLiteral("huffdicMaxDepth"), qint64(stats.counters.huffdicMaxDepth)},
+        {QStringLiteral("totalMs"), stats.totalNsecs() / 1e6},
+        {QStringLiteral("compressionRatio"), stats.compressionRatio()},
+        {QStringLiteral("phases"), phases},
+    };
+    if (stats.fileName.isEmpty()) {
+        obj[QStringLiteral("files")] = stats.files;
+    } else {
+        obj[QStringLiteral("file")] = stats.fileName;
+    }
+    return obj;
+}
+
+void printStats(QTextStream &out, const FileStats &stats)
+{
+    out << "===\nStatistics: " << (stats.fileName.isEmpty() ? QStringLiteral("total (%1 files)").arg(stats.files) : stats.fileName) << Qt::endl;
+    for (int i = 0; i < PhaseCount; i++) {
+        const auto phase = static_cast<Phase>(i);
+        out << qSetFieldWidth(12) << Qt::left << phaseName(phase) << qSetFieldWidth(12) << Qt::right //
+            << QString::number(stats.phaseNsecs(phase) / 1e6, 'f', 3) << qSetFieldWidth(0) << " ms" //
+            << qSetFieldWidth(14) << stats.phaseBytes(phase) << qSetFieldWidth(0) << " bytes" << Qt::endl;
+    }
+    out << "total: " << QString::number(stats.totalNsecs() / 1e6, 'f', 3) << " ms" << Qt::endl;
+    out << "records read: " << stats.counters.recordsRead << ", decompressed: " << stats.counters.recordsDecompressed //
+        << " (" << QString::number(stats.recordsPerSecond(), 'f', 0) << " records/s)" << Qt::endl;
+    out << "huffdic symbols: " << stats.counters.huffdicSymbols << ", max depth: " << stats.counters.huffdicMaxDepth << Qt::endl;
+    out << "images: " << stats.images << ", probes: " << stats.counters.imageProbes << Qt::endl;
+    out << "compression ratio: " << QString::number(stats.compressionRatio(), 'f', 3) << " (" << stats.counters.bytesCompressed << " bytes of text records)"
+        << Qt::endl;
+}
+
+// Suffix for an image file, from the signature of the image record
+QString imageSuffix(const QByteArray &data)
+{
+    if (data.startsWith("\xff\xd8\xff")) {
+        return QStringLiteral("jpg");
+    } else if (data.startsWith("\x89PNG")) {
+        return QStringLiteral("png");
+    } else if (data.startsWith("GIF8")) {
+        return QStringLiteral("gif");
+    } else if (data.startsWith("BM")) {
+        return QStringLiteral("bmp");
+    }
+    return {};
+}
+
+/**
+ * Replaces the recindex attributes of image tags by src attributes, in
+ * consecutive chunks of HTML. Text after an incomplete tag is held back
+ * until the tag is complete. @p files maps resource indexes, i.e. recindex - 1,
+ * to the exported files.
+ */
+class RecindexRewriter
+{
+public:
+    explicit RecindexRewriter(const QHash<int, QString> &files)
+        : files(files)
+    {
+    }
+
+    void feed(QStringView chunk, QString &out)
+    {
+        pending += chunk;
+        const qsizetype tagStart = pending.lastIndexOf(QLatin1Char('<'));
+        // Not waiting forever for a stray '<'
+        if (tagStart < 0 || pending.indexOf(QLatin1Char('>'), tagStart) >= 0 || pending.size() - tagStart > 64 * 1024) {
+            rewrite(pending, out);
+            pending.clear();
+        } else {
+            rewrite(QStringView(pending).first(tagStart), out);
+            pending.remove(0, tagStart);
+        }
+    }
+
+    void finish(QString &out)
+    {
+        rewrite(pending, out);
+        pending.clear();
+    }
+
+private:
+    void rewrite(QStringView html, QString &out) const
+    {
+        static const QRegularExpression imgTag(QStringLiteral("<img\\s[^>]*>"), QRegularExpression::CaseInsensitiveOption);
+        static const QRegularExpression recindex(QStringLiteral("(?<=\\s)recindex\\s*=\\s*[\"']?(\\d+)[\"']?"), QRegularExpression::CaseInsensitiveOption);
+        qsizetype done = 0;
+        for (const auto &tag : imgTag.globalMatchView(html)) {
+            const auto match = recindex.matchView(tag.capturedView());
+            if (!match.hasMatch()) {
+                continue;
+            }
+            // recindex counts resources from 1
+            const QString file = files.value(match.capturedView(1).toInt() - 1);
+            if (file.isEmpty()) {
+                continue;
+            }
+            out += html.sliced(done, tag.capturedStart() + match.capturedStart() - done);
+            out += QLatin1String("src=\"") + file + QLatin1Char('"');
+            done = tag.capturedStart() + match.capturedEnd();
+        }
+        out += html.sliced(done);
+    }
+
+    const QHash<int, QString> files;
+    QString pending;
+};
+
+/**
+ * Subdirectory names for exporting @p urls, after the books. Books of the same
+ * name, e.g. a/book.mobi and b/book.azw3, get a numeric suffix, so exports
+ * running in parallel never share a directory. Compared case insensitively,
+ * for case insensitive file systems.
+ */
+QStringList exportNames(const QList<QString> &urls)
+{
+    QStringList names;
+    QSet<QString> used;
+    for (const auto &url : urls) {
+        const QString base = QFileInfo(url).completeBaseName();
+        QString name = base;
+        for (int i = 2; used.contains(name.toCaseFolded()); i++) {
+            name = QStringLiteral("%1-%2").arg(base).arg(i);
+        }
+        used.insert(name.toCaseFolded());
+        names.append(name);
+    }
+    return names;
+}
+
+/**
+ * Writes the HTML text of @p url with rewritten image references and the
+ * image records to the subdirectory @p name of @p outDir. Only one record
+ * and one chunk of text are held in memory at a time.
+ */
+bool exportBook(const QString &url, const QDir &outDir, const QString &name, QString &summary)
+{
+    QFile file(url);
+    if (!file.open(QFile::ReadOnly)) {
+        summary = QStringLiteral("can not be opened");
+        return false;
+    }
+    Mobipocket::Document doc(&file);
+    if (!doc.isValid()) {
+        summary = QStringLiteral("is not a valid MobiPocket file");
+        return false;
+    }
+    if (doc.hasDRM()) {
+        summary = QStringLiteral("is DRM protected");
+        return false;
+    }
+
+    if (!outDir.mkpath(name + QLatin1String("/images"))) {
+        summary = QStringLiteral("can not create %1").arg(outDir.filePath(name));
+        return false;
+    }
+    const QDir bookDir(outDir.filePath(name));
+
+    // Images are written as is, other resources are skipped. Named by recindex.
+    QHash<int, QString> files;
+    for (int i = 0; i < doc.resourceCount(); i++) {
+        const QByteArray data = doc.resourceData(i);
+        const QString suffix = imageSuffix(data);
+        if (suffix.isEmpty()) {
+            continue;
+        }
+        const QString fileName = QStringLiteral("images/%1.%2").arg(i + 1, 5, 10, QLatin1Char('0')).arg(suffix);
+        QFile image(bookDir.filePath(fileName));
+        if (!image.open(QIODevice::WriteOnly) || image.write(data) != data.size()) {
+            summary = QStringLiteral("can not write %1").arg(image.fileName());
+            return false;
+        }
+        files.insert(i, fileName);
+    }
+
+    QFile html(bookDir.filePath(QStringLiteral("book.html")));
+    if (!html.open(QIODevice::WriteOnly)) {
+        summary = QStringLiteral("can not write %1").arg(html.fileName());
+        return false;
+    }
+    RecindexRewriter rewriter(files);
+    QStringEncoder toUtf8(QStringEncoder::Utf8);
+    QString out;
+    qint64 textBytes = 0;
+    auto write = [&]() {
+        const QByteArray bytes = toUtf8(out);
+        textBytes += bytes.size();
+        html.write(bytes);
+        out.clear();
+    };
+    const bool complete = doc.streamText([&](QStringView chunk) {
+        rewriter.feed(chunk, out);
+        write();
+    });
+    rewriter.finish(out);
+    write();
+    if (!complete || html.error() != QFileDevice::NoError) {
+        summary = QStringLiteral("text export failed");
+        return false;
+    }
+
+    summary = QStringLiteral("%1 images, %2 bytes of text in %3").arg(files.size()).arg(textBytes).arg(name);
+    return true;
+}
+} // namespace
+
 int main(int argc, char **argv)
 {
     QCoreApplication app(argc, argv);
 
     QCommandLineParser parser;
     parser.addOption({{QStringLiteral("f"), QStringLiteral("fulltext")}, QStringLiteral("Show full text")});
-    parser.addPositionalArgument(QStringLiteral("filename"), QStringLiteral("File to process"));
+    parser.addOption({{QStringLiteral("p"), QStringLiteral("plaintext")}, QStringLiteral("Show full text without markup")});
+    parser.addOption({{QStringLiteral("s"), QStringLiteral("stats")}, QStringLiteral("Show per phase timing and size statistics")});
+    parser.addOption({QStringLiteral("json"), QStringLiteral("Print statistics as JSON")});
+    parser.addOption({QStringLiteral("kf8"), QStringLiteral("Open the KF8 book of combination files")});
+    parser.addOption({{QStringLiteral("e"), QStringLiteral("export")},
+                      QStringLiteral("Write the HTML text and the images of each file to a subdirectory of <dir>"),
+                      QStringLiteral("dir")});
+    parser.addPositionalArgument(QStringLiteral("filename"), QStringLiteral("File to process, - for standard input"));
     parser.process(app);
 
-    if (parser.positionalArguments().size() != 1) {
-        QTextStream(stderr) << "Exactly one argument is accepted" << Qt::endl;
+    bool showStats = parser.isSet(QStringLiteral("stats")) || parser.isSet(QStringLiteral("json"));
+    bool exportBooks = parser.isSet(QStringLiteral("export"));
+    const auto args = parser.positionalArguments();
+    if (args.isEmpty() || (!showStats && !exportBooks && args.size() != 1)) {
+        QTextStream(stderr) << "Exactly one argument is accepted, or one or more with --stats or --export" << Qt::endl;
         parser.showHelp(1);
     }
     bool showFulltext = parser.isSet(QStringLiteral("fulltext"));
+    bool showPlaintext = parser.isSet(QStringLiteral("plaintext"));
 
-    auto fi = QFileInfo(parser.positionalArguments().at(0));
-    QString url = fi.absoluteFilePath();
+    QList<QString> urls;
+    for (const auto &arg : args) {
+        if (arg == QLatin1String("-") && !showStats && !exportBooks) {
+            // Standard input, possibly a pipe
+            urls.append(arg);
+            continue;
+        }
+        auto fi = QFileInfo(arg);
+        QString url = fi.absoluteFilePath();
 
-    if (!fi.exists()) {
-        QTextStream(stderr) << "File " << url << " not found" << Qt::endl;
-        return 1;
+        if (!fi.exists()) {
+            QTextStream(stderr) << "File " << url << " not found" << Qt::endl;
+            return 1;
+        }
+
+        if (!fi.isFile() || !fi.isReadable()) {
+            QTextStream(stderr) << "File " << url << " is not a readable file" << Qt::endl;
+            return 1;
+        }
+        urls.append(url);
     }
 
-    if (!fi.isFile() || !fi.isReadable()) {
-        QTextStream(stderr) << "File " << url << " is not a readable file" << Qt::endl;
-        return 1;
+    QTextStream out(stdout);
+
+    if (exportBooks) {
+        const QDir outDir(parser.value(QStringLiteral("export")));
+        QMutex outputMutex;
+        std::atomic<int> failures = 0;
+        // Books are exported in parallel, each one sequentially
+        QThreadPool pool;
+        const QStringList names = exportNames(urls);
+        for (qsizetype i = 0; i < urls.size(); i++) {
+            pool.start([&, url = urls[i], name = names[i]]() {
+                QString summary;
+                const bool exported = exportBook(url, outDir, name, summary);
+                QMutexLocker locker(&outputMutex);
+                if (exported) {
+                    out << url << ": " << summary << Qt::endl;
+                } else {
+                    QTextStream(stderr) << "File " << url << " " << summary << Qt::endl;
+                    failures++;
+                }
+            });
+        }
+        pool.waitForDone();
+        return failures ? 1 : 0;
     }
 
+    if (showStats) {
+        Mobipocket::Instrumentation::setEnabled(true);
+        FileStats total;
+        QJsonArray jsonFiles;
+        for (const auto &url : std::as_const(urls)) {
+            FileStats stats;
+            if (!collectStats(url, stats)) {
+                QTextStream(stderr) << "File " << url << " is not a valid MobiPocket file" << Qt::endl;
+                return 1;
+            }
+            total += stats;
+            if (parser.isSet(QStringLiteral("json"))) {
+                jsonFiles.append(statsToJson(stats));
+            } else {
+                printStats(out, stats);
+            }
+        }
+        if (parser.isSet(QStringLiteral("json"))) {
+            QJsonObject root{
+                {QStringLiteral("files"), jsonFiles},
+                {QStringLiteral("total"), statsToJson(total)},
+            };
+            out << QJsonDocument(root).toJson();
+        } else {
+            printStats(out, total);
+            out << "===" << Qt::endl << Qt::endl;
+        }
+        return 0;
+    }
+
+    const QString &url = urls.first();
     QFile file(url);
-    file.open(QFile::ReadOnly);
-    Mobipocket::Document doc(&file);
+    Mobipocket::OpenOptions options;
+    if (parser.isSet(QStringLiteral("kf8"))) {
+        options.section = Mobipocket::OpenOptions::Kf8Section;
+    }
+    if (url == QLatin1String("-")) {
+        file.open(stdin, QFile::ReadOnly);
+        // Pipes are read once, keep only what is shown
+        options.parts = Mobipocket::OpenOptions::Metadata;
+        if (showFulltext || showPlaintext) {
+            options.parts |= Mobipocket::OpenOptions::Text;
+        }
+    } else {
+        file.open(QFile::ReadOnly);
+    }
+    Mobipocket::Document doc(&file, options);
 
     if (!doc.isValid()) {
         QTextStream(stderr) << "File " << url << " is not a valid MobiPocket file" << Qt::endl;
         return 1;
     }
 
-    QTextStream out(stdout);
     out << "===\nFile metadata:" << Qt::endl;
     for (const auto &meta : doc.metadata().asKeyValueRange()) {
         out << meta.first << " \"" << meta.second << "\"" << Qt::endl;
     }
     out << "DRM protected:" << (doc.hasDRM() ? " yes" : " no") << Qt::endl;
+    if (doc.isCombination()) {
+        out << "Combination file, opened:" << (doc.section() == Mobipocket::OpenOptions::Kf8Section ? " KF8" : " MOBI 7") << Qt::endl;
+    }
     if (showFulltext && !doc.hasDRM()) {
         out << "===\nRaw text:" << Qt::endl;
         out << "\"" << doc.text() << "\"" << Qt::endl;
     }
+    if (showPlaintext && !doc.hasDRM()) {
+        out << "===\nPlain text:" << Qt::endl;
+        out << doc.plainText() << Qt::endl;
+    }
     out << "===" << Qt::endl << Qt::endl;
     return 0;
 }
@@ -0,0 +1,448 @@
+// SPDX-FileCopyrightText: 2026 KDE contributors
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QSet>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <functional>
+#include <utility>
+
+#include "mobipocket.h"
+#include "textcache.h"
+
+/*
+ * Keeps metadata, thumbnails and plain text of the books in library
+ * directories up to date. Directories are watched with QFileSystemWatcher,
+ * i.e. inotify on Linux, changes are collected for a short while and then
+ * processed as one batch.
+ *
+ * Output directory layout, files are named by Document::fingerprint(), so
+ * copies and moved books are not extracted again:
+ *
+ *   state                       size, modification time and fingerprint of each book
+ *   metadata/<fingerprint>.json written last, i.e. the book is complete if it exists
+ *   thumbnails/<fingerprint>.png
+ *   text/                       a Mobipocket::TextCache of the plain text
+ */
+
+namespace
+{
+const QStringList bookFilters = {
+    QStringLiteral("*.mobi"),
+    QStringLiteral("*.azw"),
+    QStringLiteral("*.azw3"),
+    QStringLiteral("*.prc"),
+};
+constexpr quint32 stateMagic = 0x4d4f4249; // "MOBI"
+constexpr quint32 stateVersion = 1;
+
+struct FileState {
+    qint64 size = -1;
+    // msecs since the epoch
+    qint64 modified = 0;
+    // empty for invalid books
+    QByteArray fingerprint;
+};
+
+QDataStream &operator<<(QDataStream &stream, const FileState &state)
+{
+    return stream << state.size << state.modified << state.fingerprint;
+}
+
+QDataStream &operator>>(QDataStream &stream, FileState &state)
+{
+    return stream >> state.size >> state.modified >> state.fingerprint;
+}
+
+struct Result {
+    QString path;
+    FileState state;
+    bool indexed = false;
+    QString error;
+};
+
+QString metadataKey(Mobipocket::Document::MetaKey key)
+{
+    switch (key) {
+    case Mobipocket::Document::Title:
+        return QStringLiteral("title");
+    case Mobipocket::Document::Author:
+        return QStringLiteral("author");
+    case Mobipocket::Document::Copyright:
+        return QStringLiteral("copyright");
+    case Mobipocket::Document::Description:
+        return QStringLiteral("description");
+    case Mobipocket::Document::Subject:
+        return QStringLiteral("subject");
+    }
+    return {};
+}
+
+/**
+ * Extracts the book at @p path into @p outDir, unless a book with the same
+ * fingerprint was extracted before. Runs on the worker threads.
+ */
+Result indexBook(const QString &path, const FileState &state, const QString &outPath, Mobipocket::TextCache &textCache)
+{
+    const QDir outDir(outPath);
+    Result result{path, state, false, {}};
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        result.error = QStringLiteral("can not be opened");
+        return result;
+    }
+    Mobipocket::Document doc(&file);
+    if (!doc.isValid()) {
+        result.error = QStringLiteral("is not a valid MobiPocket file");
+        return result;
+    }
+    result.state.fingerprint = doc.fingerprint();
+    result.indexed = true;
+
+    const QString name = QString::fromLatin1(result.state.fingerprint.toHex());
+    const QString metadataPath = outDir.filePath(QLatin1String("metadata/") + name + QLatin1String(".json"));
+    if (QFile::exists(metadataPath)) {
+        return result;
+    }
+
+    QJsonObject metadata;
+    for (const auto &meta : doc.metadata().asKeyValueRange()) {
+        metadata.insert(metadataKey(meta.first), meta.second);
+    }
+    metadata.insert(QStringLiteral("drm"), doc.hasDRM());
+    metadata.insert(QStringLiteral("kf8"), doc.isKf8());
+    metadata.insert(QStringLiteral("images"), doc.imageCount());
+
+    if (const QImage thumbnail = doc.thumbnail(); !thumbnail.isNull()) {
+        thumbnail.save(outDir.filePath(QLatin1String("thumbnails/") + name + QLatin1String(".png")));
+    }
+
+    if (!doc.hasDRM()) {
+        const auto text = textCache.text(doc, Mobipocket::TextCache::PlainText);
+        if (text.isNull()) {
+            result.error = QStringLiteral("text extraction failed");
+            result.indexed = false;
+            return result;
+        }
+        // Counted in the cached text, not decompressed again
+        const auto statistics = Mobipocket::TextStatistics::count(text.view());
+        metadata.insert(QStringLiteral("characters"), statistics.characters);
+        metadata.insert(QStringLiteral("words"), statistics.words);
+        metadata.insert(QStringLiteral("readingMinutes"), statistics.readingMinutes());
+        metadata.insert(QStringLiteral("pages"), statistics.pages());
+    }
+
+    QSaveFile out(metadataPath);
+    if (!out.open(QIODevice::WriteOnly) || out.write(QJsonDocument(metadata).toJson()) < 0 || !out.commit()) {
+        result.error = QStringLiteral("can not write %1").arg(metadataPath);
+        result.indexed = false;
+    }
+    return result;
+}
+
+class Indexer
+{
+public:
+    Indexer(const QDir &outDir, int jobs, int batchDelay)
+        : outPath(outDir.absolutePath())
+        , statePath(outDir.filePath(QStringLiteral("state")))
+        , textCache(outDir.filePath(QStringLiteral("text")))
+    {
+        outDir.mkpath(QStringLiteral("metadata"));
+        outDir.mkpath(QStringLiteral("thumbnails"));
+        pool.setMaxThreadCount(jobs);
+        batchTimer.setSingleShot(true);
+        batchTimer.setInterval(batchDelay);
+        QObject::connect(&batchTimer, &QTimer::timeout, [this]() {
+            processBatch();
+        });
+        QObject::connect(&watcher, &QFileSystemWatcher::directoryChanged, [this](const QString &directory) {
+            pendingDirectories.insert(directory);
+            // Collects bursts from the first event on, later events do not delay the batch
+            if (!batchTimer.isActive()) {
+                batchTimer.start();
+            }
+        });
+    }
+
+    ~Indexer()
+    {
+        pool.waitForDone();
+    }
+
+    bool loadState()
+    {
+        QFile file(statePath);
+        if (!file.exists()) {
+            return true;
+        }
+        if (!file.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        QDataStream stream(&file);
+        quint32 magic = 0;
+        quint32 version = 0;
+        stream >> magic >> version;
+        if (magic != stateMagic || version != stateVersion) {
+            // Rebuilt, unchanged books are found by their fingerprint
+            return true;
+        }
+        stream >> directories;
+        return stream.status() == QDataStream::Ok;
+    }
+
+    bool saveState()
+    {
+        QSaveFile file(statePath);
+        if (!file.open(QIODevice::WriteOnly)) {
+            return false;
+        }
+        QDataStream stream(&file);
+        stream << stateMagic << stateVersion << directories;
+        return stream.status() == QDataStream::Ok && file.commit();
+    }
+
+    void addRoot(const QString &root)
+    {
+        roots.append(QDir(root).absolutePath());
+    }
+
+    /**
+     * Scans the roots completely, only opening books which changed since the
+     * state was saved. Watches them afterwards unless @p once is set.
+     */
+    void start(bool once)
+    {
+        this->once = once;
+        for (const auto &root : std::as_const(roots)) {
+            scanDirectory(root, true);
+        }
+        // Removed while not running
+        const QStringList known = directories.keys();
+        for (const auto &directory : known) {
+            if (!QFileInfo(directory).isDir()) {
+                removeDirectory(directory);
+            }
+        }
+        checkDone();
+    }
+
+    std::function<void()> finished;
+    int books = 0;
+    int indexed = 0;
+    int unchanged = 0;
+    int failed = 0;
+
+private:
+    void processBatch()
+    {
+        const QSet<QString> batch = std::exchange(pendingDirectories, {});
+        for (const auto &directory : batch) {
+            scanDirectory(directory, false);
+        }
+        checkDone();
+    }
+
+    // Compares the books in @p directory with the state, new subdirectories are scanned as well
+    void scanDirectory(const QString &directory, bool recursive)
+    {
+        if (!QFileInfo(directory).isDir()) {
+            removeDirectory(directory);
+            return;
+        }
+        if (!once && !watcher.directories().contains(directory) && !watcher.addPath(directory)) {
+            QTextStream(stderr) << "Can not watch " << directory << ", the inotify watch limit may be exceeded" << Qt::endl;
+        }
+
+        QHash<QString, FileState> &known = directories[directory];
+        QSet<QString> seen;
+        // Symbolic links are not followed, they could form loops
+        QDirIterator it(directory, QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::Readable | QDir::NoSymLinks);
+        while (it.hasNext()) {
+            it.next();
+            const QFileInfo info = it.fileInfo();
+            if (info.isDir()) {
+                if (recursive || !directories.contains(info.absoluteFilePath())) {
+                    scanDirectory(info.absoluteFilePath(), recursive);
+                }
+                continue;
+            }
+            if (!QDir::match(bookFilters, info.fileName())) {
+                continue;
+            }
+            seen.insert(info.fileName());
+            books++;
+            const FileState current{info.size(), info.lastModified().toMSecsSinceEpoch(), {}};
+            const FileState previous = known.value(info.fileName());
+            if (previous.size == current.size && previous.modified == current.modified) {
+                unchanged++;
+                continue;
+            }
+            submit(info.absoluteFilePath(), current);
+        }
+        for (auto it = known.begin(); it != known.end();) {
+            it = seen.contains(it.key()) ? std::next(it) : known.erase(it);
+        }
+        dirty = true;
+    }
+
+    void removeDirectory(const QString &directory)
+    {
+        const QString prefix = directory + QLatin1Char('/');
+        for (auto it = directories.begin(); it != directories.end();) {
+            it = (it.key() == directory || it.key().startsWith(prefix)) ? directories.erase(it) : std::next(it);
+        }
+        watcher.removePath(directory);
+        dirty = true;
+    }
+
+    void submit(const QString &path, const FileState &state)
+    {
+        // Changed again while being indexed, checked once more when done
+        if (running.contains(path)) {
+            rerun.insert(QFileInfo(path).path());
+            return;
+        }
+        running.insert(path);
+        pool.start([this, path, state]() {
+            const Result result = indexBook(path, state, outPath, textCache);
+            QMetaObject::invokeMethod(
+                QCoreApplication::instance(),
+                [this, result]() {
+                    done(result);
+                },
+                Qt::QueuedConnection);
+        });
+    }
+
+    // On the main thread
+    void done(const Result &result)
+    {
+        running.remove(result.path);
+        const QFileInfo info(result.path);
+        // Failed books are kept as well, not to retry them until they change
+        if (const auto it = directories.find(info.path()); it != directories.end()) {
+            it->insert(info.fileName(), result.state);
+            dirty = true;
+        }
+        if (result.indexed) {
+            indexed++;
+        } else {
+            failed++;
+            QTextStream(stderr) << "File " << result.path << " " << result.error << Qt::endl;
+        }
+        if (rerun.remove(info.path())) {
+            pendingDirectories.insert(info.path());
+            if (!batchTimer.isActive()) {
+                batchTimer.start();
+            }
+        }
+        checkDone();
+    }
+
+    void checkDone()
+    {
+        if (!running.isEmpty() || !pendingDirectories.isEmpty()) {
+            return;
+        }
+        // Saved after each batch, a lost batch is only fingerprinted again
+        if (dirty) {
+            if (!saveState()) {
+                QTextStream(stderr) << "Can not write " << statePath << Qt::endl;
+            }
+            dirty = false;
+        }
+        if (once && finished) {
+            finished();
+        }
+    }
+
+    const QString outPath;
+    const QString statePath;
+    Mobipocket::TextCache textCache;
+    QStringList roots;
+    // Directory, file name, state
+    QHash<QString, QHash<QString, FileState>> directories;
+    QFileSystemWatcher watcher;
+    QSet<QString> pendingDirectories;
+    QTimer batchTimer;
+    QThreadPool pool;
+    // Books being indexed, and directories to rescan afterwards
+    QSet<QString> running;
+    QSet<QString> rerun;
+    bool once = false;
+    bool dirty = false;
+};
+} // namespace
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Indexes the MobiPocket books in directories, and keeps the index up to date"));
+    parser.addOption({{QStringLiteral("o"), QStringLiteral("output")}, QStringLiteral("Write the index to <dir>"), QStringLiteral("dir")});
+    parser.addOption({{QStringLiteral("j"), QStringLiteral("jobs")},
+                      QStringLiteral("Index up to <n> books in parallel, the number of CPU cores by default"),
+                      QStringLiteral("n")});
+    parser.addOption({QStringLiteral("delay"), QStringLiteral("Collect changes for <ms> milliseconds before indexing them"), QStringLiteral("ms"), QStringLiteral("2000")});
+    parser.addOption({QStringLiteral("once"), QStringLiteral("Index the changes since the last run and exit, without watching")});
+    parser.addPositionalArgument(QStringLiteral("directories"), QStringLiteral("Library directories, searched recursively"));
+    parser.process(app);
+
+    const auto args = parser.positionalArguments();
+    if (args.isEmpty() || !parser.isSet(QStringLiteral("output"))) {
+        QTextStream(stderr) << "An output directory and at least one library directory are required" << Qt::endl;
+        parser.showHelp(1);
+    }
+    for (const auto &arg : args) {
+        if (!QFileInfo(arg).isDir()) {
+            QTextStream(stderr) << "Directory " << arg << " not found" << Qt::endl;
+            return 1;
+        }
+    }
+
+    const QDir outDir(parser.value(QStringLiteral("output")));
+    if (!QDir().mkpath(outDir.absolutePath())) {
+        QTextStream(stderr) << "Can not create " << outDir.absolutePath() << Qt::endl;
+        return 1;
+    }
+    const int jobs = parser.isSet(QStringLiteral("jobs")) ? parser.value(QStringLiteral("jobs")).toInt() : QThread::idealThreadCount();
+    const int delay = parser.value(QStringLiteral("delay")).toInt();
+
+    Indexer indexer(outDir, std::max(jobs, 1), std::max(delay, 0));
+    if (!indexer.loadState()) {
+        QTextStream(stderr) << "Can not read the state in " << outDir.absolutePath() << Qt::endl;
+        return 1;
+    }
+    for (const auto &arg : args) {
+        indexer.addRoot(arg);
+    }
+
+    const bool once = parser.isSet(QStringLiteral("once"));
+    indexer.finished = [&indexer]() {
+        QTextStream(stdout) << indexer.books << " books, " << indexer.indexed << " indexed, " << indexer.unchanged << " unchanged, " << indexer.failed
+                            << " failed" << Qt::endl;
+        QCoreApplication::exit(indexer.failed ? 1 : 0);
+    };
+    // Started from the event loop, results are delivered through it
+    QTimer::singleShot(0, &app, [&indexer, once]() {
+        indexer.start(once);
+    });
+    return app.exec();
+}